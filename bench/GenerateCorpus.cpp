@@ -0,0 +1,218 @@
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/dcmdata/dcuid.h"
+
+/* Synthetic study corpus for the benchmarks.
+ *
+ * usage: bench_generate_corpus <out-directory> [options]
+ *   --studies n        studies (directories), default 4
+ *   --series n         series per study, default 3
+ *   --instances n      instances per series, default 50
+ *   --rows n           rows, default 512
+ *   --columns n        columns, default 512
+ *   --xfer list        transfer syntaxes cycled per instance, comma
+ *                      separated: ile, ele, ebe (default ele)
+ *   --private n        private elements per instance, default 20
+ *   --sequence-depth n nested sequence levels per instance, default 2
+ *
+ * Every instance carries identifying attributes at the top level and in
+ * each nested ReferencedImageSequence item, private elements of one creator
+ * and 16 bit pixel data with a gradient pattern.
+ */
+
+namespace {
+struct CorpusOptions {
+  unsigned int studies{4};
+  unsigned int series{3};
+  unsigned int instances{50};
+  unsigned short rows{512};
+  unsigned short columns{512};
+  std::vector<E_TransferSyntax> transfer_syntaxes{EXS_LittleEndianExplicit};
+  unsigned int private_elements{20};
+  unsigned int sequence_depth{2};
+};
+
+bool parseTransferSyntaxes(std::string_view list,
+                           std::vector<E_TransferSyntax> &result) {
+  result.clear();
+  while (!list.empty()) {
+    const std::size_t comma = list.find(',');
+    const std::string_view name = list.substr(0, comma);
+    if (name == "ile")
+      result.push_back(EXS_LittleEndianImplicit);
+    else if (name == "ele")
+      result.push_back(EXS_LittleEndianExplicit);
+    else if (name == "ebe")
+      result.push_back(EXS_BigEndianExplicit);
+    else
+      return false;
+    list = comma == std::string_view::npos ? std::string_view{}
+                                           : list.substr(comma + 1);
+  }
+  return !result.empty();
+}
+
+std::string newUid() {
+  char uid[65];
+  dcmGenerateUniqueIdentifier(uid, SITE_INSTANCE_UID_ROOT);
+  return uid;
+}
+
+void addNestedItems(DcmItem *item, unsigned int depth,
+                    const std::string &patient_name) {
+  if (depth == 0)
+    return;
+
+  DcmItem *nested = nullptr;
+  if (item->findOrCreateSequenceItem(DCM_ReferencedImageSequence, nested, -2)
+          .bad())
+    return;
+  nested->putAndInsertString(DCM_ReferencedSOPClassUID, UID_CTImageStorage);
+  nested->putAndInsertString(DCM_ReferencedSOPInstanceUID, newUid().c_str());
+  nested->putAndInsertString(DCM_PatientName, patient_name.c_str());
+  nested->putAndInsertString(DCM_ReferringPhysicianName, "Smith^Jane");
+  addNestedItems(nested, depth - 1, patient_name);
+}
+
+OFCondition writeInstance(const CorpusOptions &options,
+                          const std::string &path, unsigned int study,
+                          const std::string &study_uid,
+                          const std::string &series_uid, unsigned int series,
+                          unsigned int instance,
+                          const std::vector<Uint16> &pixels) {
+  DcmFileFormat fileformat{};
+  DcmDataset *dataset = fileformat.getDataset();
+
+  const std::string patient_name = fmt::format("Patient^{:04}", study);
+  dataset->putAndInsertString(DCM_SOPClassUID, UID_CTImageStorage);
+  dataset->putAndInsertString(DCM_SOPInstanceUID, newUid().c_str());
+  dataset->putAndInsertString(DCM_StudyDate, "20250318");
+  dataset->putAndInsertString(DCM_Modality, "CT");
+  dataset->putAndInsertString(DCM_Manufacturer, "FNO SYNTHETIC");
+  dataset->putAndInsertString(DCM_InstitutionName, "Synthetic Hospital");
+  dataset->putAndInsertString(DCM_ReferringPhysicianName, "Smith^Jane");
+  dataset->putAndInsertString(DCM_StationName, "STATION01");
+  dataset->putAndInsertString(DCM_PatientName, patient_name.c_str());
+  dataset->putAndInsertString(DCM_PatientID,
+                              fmt::format("{:08}", study).c_str());
+  dataset->putAndInsertString(DCM_PatientSex, "F");
+  dataset->putAndInsertString(DCM_PatientAge, "042Y");
+  dataset->putAndInsertString(DCM_StudyInstanceUID, study_uid.c_str());
+  dataset->putAndInsertString(DCM_SeriesInstanceUID, series_uid.c_str());
+  dataset->putAndInsertString(DCM_SeriesNumber,
+                              std::to_string(series + 1).c_str());
+  dataset->putAndInsertString(DCM_InstanceNumber,
+                              std::to_string(instance + 1).c_str());
+  dataset->putAndInsertString(DCM_FrameOfReferenceUID, series_uid.c_str());
+
+  addNestedItems(dataset, options.sequence_depth, patient_name);
+
+  // one private creator block, (0009,0010) reserves (0009,10xx)
+  if (options.private_elements > 0) {
+    dataset->putAndInsertString(DcmTag(0x0009, 0x0010, EVR_LO),
+                                "FNO SYNTHETIC");
+    for (unsigned int i = 0; i < options.private_elements && i < 0x100; ++i) {
+      const DcmTag tag{0x0009, static_cast<Uint16>(0x1000 + i), EVR_LO};
+      dataset->putAndInsertString(tag,
+                                  fmt::format("private {}", i).c_str());
+    }
+  }
+
+  dataset->putAndInsertUint16(DCM_SamplesPerPixel, 1);
+  dataset->putAndInsertString(DCM_PhotometricInterpretation, "MONOCHROME2");
+  dataset->putAndInsertUint16(DCM_Rows, options.rows);
+  dataset->putAndInsertUint16(DCM_Columns, options.columns);
+  dataset->putAndInsertUint16(DCM_BitsAllocated, 16);
+  dataset->putAndInsertUint16(DCM_BitsStored, 12);
+  dataset->putAndInsertUint16(DCM_HighBit, 11);
+  dataset->putAndInsertUint16(DCM_PixelRepresentation, 0);
+  dataset->putAndInsertUint16Array(DCM_PixelData, pixels.data(),
+                                   pixels.size());
+
+  const std::size_t index = (series * options.instances + instance) %
+                            options.transfer_syntaxes.size();
+  return fileformat.saveFile(path, options.transfer_syntaxes[index]);
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fmt::print("usage: {} <out-directory> [--studies n] [--series n] "
+               "[--instances n] [--rows n] [--columns n] [--xfer ile,ele,ebe] "
+               "[--private n] [--sequence-depth n]\n",
+               argv[0]);
+    return 1;
+  }
+
+  CorpusOptions options{};
+  for (int i = 2; i + 1 < argc; i += 2) {
+    const std::string_view name{argv[i]};
+    const std::string value{argv[i + 1]};
+    if (name == "--studies")
+      options.studies = std::stoul(value);
+    else if (name == "--series")
+      options.series = std::stoul(value);
+    else if (name == "--instances")
+      options.instances = std::stoul(value);
+    else if (name == "--rows")
+      options.rows = static_cast<unsigned short>(std::stoul(value));
+    else if (name == "--columns")
+      options.columns = static_cast<unsigned short>(std::stoul(value));
+    else if (name == "--private")
+      options.private_elements = std::stoul(value);
+    else if (name == "--sequence-depth")
+      options.sequence_depth = std::stoul(value);
+    else if (name != "--xfer" ||
+             !parseTransferSyntaxes(value, options.transfer_syntaxes)) {
+      fmt::print("invalid option {} {}\n", name, value);
+      return 1;
+    }
+  }
+
+  std::vector<Uint16> pixels(static_cast<std::size_t>(options.rows) *
+                             options.columns);
+  for (std::size_t i = 0; i < pixels.size(); ++i) {
+    const std::size_t x = i % options.columns, y = i / options.columns;
+    pixels[i] = static_cast<Uint16>((x + y) & 0x0FFF);
+  }
+
+  const std::filesystem::path output{argv[1]};
+  std::uint64_t files{0};
+  for (unsigned int study = 0; study < options.studies; ++study) {
+    const std::filesystem::path study_dir =
+        output / fmt::format("study_{:04}", study);
+    std::filesystem::create_directories(study_dir);
+    const std::string study_uid = newUid();
+
+    for (unsigned int series = 0; series < options.series; ++series) {
+      const std::string series_uid = newUid();
+      for (unsigned int instance = 0; instance < options.instances;
+           ++instance) {
+        const std::string path =
+            (study_dir / fmt::format("S{:03}_I{:05}.dcm", series, instance))
+                .string();
+        const OFCondition cond =
+            writeInstance(options, path, study, study_uid, series_uid, series,
+                          instance, pixels);
+        if (cond.bad()) {
+          fmt::print("error writing {}: {}\n", path, cond.text());
+          return 1;
+        }
+        ++files;
+      }
+    }
+  }
+
+  fmt::print("generated {} studies, {} files in {}\n", options.studies, files,
+             output.string());
+  return 0;
+}
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "DicomAnonymizer.hpp"
+
+/* Anonymize the same input once per I/O backend and compare wall time.
+ *
+ * usage: bench_io_backends <in-directory> [jobs] [io depth]
+ *
+ * <in-directory> holds study directories, as for fnodcmanon. Outputs go to a
+ * fresh directory per backend under the system temporary directory, run with
+ * a cold page cache (drop_caches) for numbers that include the disk.
+ */
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fmt::print("usage: {} <in-directory> [jobs] [io depth]\n", argv[0]);
+    return 1;
+  }
+
+  const std::filesystem::path input{argv[1]};
+  const unsigned int jobs = argc > 2 ? std::stoul(argv[2]) : 1;
+  const unsigned int depth = argc > 3 ? std::stoul(argv[3]) : 8;
+
+  std::vector<StudyInput> studies{};
+  for (const auto &entry : std::filesystem::directory_iterator(input)) {
+    if (entry.is_directory())
+      studies.push_back({.input_directory = entry.path()});
+  }
+  std::ranges::sort(studies, {}, &StudyInput::input_directory);
+
+  const std::filesystem::path output_root =
+      std::filesystem::temp_directory_path() / "fnodcmanon_io_bench";
+
+  struct Backend {
+    E_IO_BACKEND backend;
+    const char *name;
+  };
+  fmt::print("{:>8} {:>8} {:>12} {:>12}\n", "backend", "files", "seconds",
+             "files/s");
+
+  for (const auto &[backend, name] : {Backend{I_SYNC, "sync"},
+                                      Backend{I_THREADS, "threads"},
+                                      Backend{I_URING, "uring"}}) {
+    const std::filesystem::path output = output_root / name;
+    std::filesystem::remove_all(output);
+    std::filesystem::create_directories(output);
+
+    StudyAnonymizer anonymizer{};
+    anonymizer.m_jobs = jobs;
+    anonymizer.setup({.pseudoname_prefix = "BENCH_",
+                      .pseudoname_type = P_INTEGER_ORDER});
+    anonymizer.setupIoBackend(backend, depth);
+
+    const auto start = std::chrono::steady_clock::now();
+    anonymizer.anonymizeStudies(
+        studies, output.string(), "1.2.840.113619.2",
+        [](const StudyContext &, const OFCondition &) {});
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    const std::uint64_t files = anonymizer.metrics().counter(C_FILES);
+
+    fmt::print("{:>8} {:>8} {:>12.3f} {:>12.1f}\n", name, files,
+               elapsed.count(), static_cast<double>(files) / elapsed.count());
+  }
+
+  std::filesystem::remove_all(output_root);
+  return 0;
+}
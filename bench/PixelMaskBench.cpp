@@ -0,0 +1,110 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmdata/dcdeftag.h"
+
+#include "PixelMaskTable.hpp"
+
+/* Time PixelMaskTable::apply() on synthetic multi-frame images.
+ *
+ * Every image gets a full-width band at the top, which is one span per frame,
+ * and a box at the bottom left, which is one span per row, so both the long
+ * and the short span case of fillPixelSpan() are measured.
+ */
+
+namespace {
+constexpr int REPEATS{5};
+
+struct Layout {
+  const char *name;
+  const char *photometric;
+  Uint16 samples;
+  Uint16 allocated;
+  Uint16 planar;
+};
+
+std::unique_ptr<DcmDataset> makeDataset(const Layout &layout, Uint16 columns,
+                                        Uint16 rows, unsigned int frames) {
+  auto dataset = std::make_unique<DcmDataset>();
+  dataset->putAndInsertString(DCM_Modality, "US");
+  dataset->putAndInsertString(DCM_Manufacturer, "BENCH");
+  dataset->putAndInsertUint16(DCM_Rows, rows);
+  dataset->putAndInsertUint16(DCM_Columns, columns);
+  dataset->putAndInsertUint16(DCM_SamplesPerPixel, layout.samples);
+  dataset->putAndInsertUint16(DCM_BitsAllocated, layout.allocated);
+  dataset->putAndInsertUint16(DCM_BitsStored, layout.allocated);
+  dataset->putAndInsertUint16(DCM_HighBit, layout.allocated - 1);
+  dataset->putAndInsertUint16(DCM_PixelRepresentation, 0);
+  dataset->putAndInsertString(DCM_PhotometricInterpretation,
+                              layout.photometric);
+  if (layout.samples > 1)
+    dataset->putAndInsertUint16(DCM_PlanarConfiguration, layout.planar);
+  dataset->putAndInsertString(DCM_NumberOfFrames,
+                              fmt::format("{}", frames).c_str());
+
+  const std::size_t bytes = std::size_t{columns} * rows * layout.samples *
+                            (layout.allocated / 8) * frames;
+  if (layout.allocated == 8) {
+    const std::vector<Uint8> pixels(bytes, 0x7f);
+    dataset->putAndInsertUint8Array(DCM_PixelData, pixels.data(),
+                                    pixels.size());
+  } else {
+    const std::vector<Uint16> pixels(bytes / 2, 0x7ff);
+    dataset->putAndInsertUint16Array(DCM_PixelData, pixels.data(),
+                                     pixels.size());
+  }
+  return dataset;
+}
+} // namespace
+
+int main() {
+  const std::filesystem::path maskFile =
+      std::filesystem::temp_directory_path() / "bench_pixel_masks.txt";
+  {
+    std::ofstream masks{maskFile};
+    masks << "US BENCH * 0,0,4096,64 0,400,320,80\n";
+  }
+  PixelMaskTable table{};
+  if (table.load(maskFile.string()).bad())
+    return 1;
+
+  constexpr Uint16 COLUMNS{640};
+  constexpr Uint16 ROWS{480};
+  constexpr unsigned int FRAMES{200};
+  const std::vector<Layout> layouts{
+      {"mono 8", "MONOCHROME2", 1, 8, 0},
+      {"mono 16", "MONOCHROME2", 1, 16, 0},
+      {"rgb 8", "RGB", 3, 8, 0},
+      {"rgb 8 planar", "RGB", 3, 8, 1},
+      {"rgb 16", "RGB", 3, 16, 0}};
+
+  fmt::print("{:>14} {:>8} {:>14} {:>14}\n", "layout", "frames", "us/frame",
+             "GB/s masked");
+  for (const Layout &layout : layouts) {
+    const auto dataset = makeDataset(layout, COLUMNS, ROWS, FRAMES);
+    // masked bytes per frame: the band and the box
+    const double masked = static_cast<double>(
+        (std::size_t{COLUMNS} * 64 + std::size_t{320} * 80) *
+        layout.samples * (layout.allocated / 8));
+
+    bool isMasked{false};
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < REPEATS; i++)
+      table.apply(dataset.get(), isMasked);
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    const double perFrame = static_cast<double>(elapsed.count()) /
+                            (REPEATS * static_cast<double>(FRAMES));
+    fmt::print("{:>14} {:>8} {:>14.2f} {:>14.2f}\n", layout.name, FRAMES,
+               perFrame * 1.0e-3, masked / perFrame);
+  }
+  std::filesystem::remove(maskFile);
+  return 0;
+}
@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/dcmdata/dcsequen.h"
+
+#include "DicomAnonymizer.hpp"
+#include "TagActionTable.hpp"
+#include "UidRemapper.hpp"
+
+/* Throughput of every anonymization stage measured on its own.
+ *
+ * usage: bench_stages <corpus-directory> [--json <file>]
+ *
+ * <corpus-directory> holds study directories, e.g. from
+ * bench_generate_corpus. Stages are timed in pipeline order, each on a fresh
+ * clone of the loaded dataset so no stage works on the output of another:
+ *   discovery  StudyAnonymizer::walkDicomFiles()
+ *   probe      StudyAnonymizer::setBasicTags()
+ *   load       StudyAnonymizer::loadDicomFile()
+ *   strip      TagActionTable::apply() with no actions, removes private and
+ *              unknown tags only (the former removeInvalidTags())
+ *   profile    TagActionTable::apply() with the basic profile
+ *   uid_remap  UidRemapper::remapElement() on every UI element
+ *   write      StudyAnonymizer::writeDicomFile()
+ * A table goes to stdout, --json writes the same numbers as JSON ("-" for
+ * stdout instead of the table).
+ */
+
+namespace {
+struct StageResult {
+  const char *name{};
+  std::uint64_t items{0};
+  std::uint64_t bytes{0};
+  double seconds{0.0};
+};
+
+template <typename F> void timeStage(StageResult &stage, F &&function) {
+  const auto start = std::chrono::steady_clock::now();
+  function();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  stage.seconds += elapsed.count();
+}
+
+void remapUids(DcmItem *item, const UidRemapper &remapper) {
+  DcmObject *object = nullptr;
+  while ((object = item->nextInContainer(object)) != nullptr) {
+    if (object->ident() == EVR_UI) {
+      remapper.remapElement(static_cast<DcmElement *>(object));
+    } else if (object->ident() == EVR_SQ) {
+      auto *sequence = static_cast<DcmSequenceOfItems *>(object);
+      DcmObject *nested = nullptr;
+      while ((nested = sequence->nextInContainer(nested)) != nullptr)
+        remapUids(static_cast<DcmItem *>(nested), remapper);
+    }
+  }
+}
+
+double perSecond(double value, double seconds) {
+  return seconds > 0.0 ? value / seconds : 0.0;
+}
+
+std::string toJson(const std::vector<StageResult> &stages,
+                   const std::string &corpus, std::size_t studies) {
+  std::string json = fmt::format("{{\"corpus\": \"{}\", \"studies\": {}, "
+                                 "\"stages\": [",
+                                 corpus, studies);
+  for (std::size_t i = 0; i < stages.size(); ++i) {
+    const StageResult &stage = stages[i];
+    json += fmt::format(
+        "{}\n  {{\"name\": \"{}\", \"items\": {}, \"bytes\": {}, "
+        "\"seconds\": {:.6f}, \"items_per_second\": {:.1f}, "
+        "\"bytes_per_second\": {:.1f}}}",
+        i == 0 ? "" : ",", stage.name, stage.items, stage.bytes, stage.seconds,
+        perSecond(static_cast<double>(stage.items), stage.seconds),
+        perSecond(static_cast<double>(stage.bytes), stage.seconds));
+  }
+  json += "\n]}\n";
+  return json;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fmt::print("usage: {} <corpus-directory> [--json <file>]\n", argv[0]);
+    return 1;
+  }
+
+  const std::filesystem::path input{argv[1]};
+  std::string json_file{};
+  if (argc > 3 && std::string_view{argv[2]} == "--json")
+    json_file = argv[3];
+
+  std::vector<std::filesystem::path> study_directories{};
+  for (const auto &entry : std::filesystem::directory_iterator(input)) {
+    if (entry.is_directory())
+      study_directories.push_back(entry.path());
+  }
+  std::ranges::sort(study_directories);
+
+  const std::filesystem::path output =
+      std::filesystem::temp_directory_path() / "fnodcmanon_stage_bench";
+  std::filesystem::remove_all(output);
+  std::filesystem::create_directories(output);
+
+  // fixed key, the remap stage measures hashing and not key handling
+  const std::string key_file = (output / "uid.key").string();
+  std::ofstream{key_file} << "bench-stage-key";
+  UidRemapper remapper{};
+  if (remapper.setup(key_file, "1.2.840.113619.2").bad()) {
+    fmt::print("unable to set up the UID remapper\n");
+    return 1;
+  }
+
+  const StudyAnonymizer anonymizer{};
+  const TagActionTable strip_table{};
+  const TagActionTable profile_table = TagActionTable::fromProfiles({});
+
+  StageResult discovery{"discovery"}, probe{"probe"}, load{"load"},
+      strip{"strip"}, profile{"profile"}, uid_remap{"uid_remap"},
+      write{"write"};
+
+  for (const auto &directory : study_directories) {
+    StudyContext study{};
+    study.input_directory = directory;
+
+    OFCondition cond{};
+    std::vector<std::string> files{};
+    timeStage(discovery, [&] {
+      cond = anonymizer.walkDicomFiles(directory, [&files](const auto &file) {
+        files.push_back(file);
+        return true;
+      });
+    });
+    if (cond.bad() || files.empty())
+      continue;
+    discovery.items += files.size();
+
+    timeStage(probe, [&] { cond = anonymizer.setBasicTags(study, files[0]); });
+    probe.items++;
+
+    for (const auto &file : files) {
+      const std::uint64_t size = std::filesystem::file_size(file);
+
+      DcmFileFormat fileformat{};
+      PassThroughRange pass_through{};
+      timeStage(load, [&] {
+        cond = anonymizer.loadDicomFile(file, fileformat, pass_through);
+      });
+      if (cond.bad())
+        continue;
+      fileformat.loadAllDataIntoMemory();
+      load.items++;
+      load.bytes += size;
+
+      DcmDataset *source = fileformat.getDataset();
+      std::unique_ptr<DcmDataset> copy{
+          static_cast<DcmDataset *>(source->clone())};
+      timeStage(strip, [&] { strip_table.apply(copy.get(), "BENCH"); });
+      strip.items++;
+      strip.bytes += size;
+
+      copy.reset(static_cast<DcmDataset *>(source->clone()));
+      timeStage(profile, [&] { profile_table.apply(copy.get(), "BENCH"); });
+      profile.items++;
+      profile.bytes += size;
+
+      copy.reset(static_cast<DcmDataset *>(source->clone()));
+      timeStage(uid_remap, [&] { remapUids(copy.get(), remapper); });
+      uid_remap.items++;
+      uid_remap.bytes += size;
+
+      const std::string path =
+          (output / fmt::format("{:08}.dcm", write.items)).string();
+      timeStage(write, [&] {
+        cond = anonymizer.writeDicomFile(path, fileformat, pass_through);
+      });
+      if (cond.good()) {
+        write.items++;
+        write.bytes += std::filesystem::file_size(path);
+      }
+      std::filesystem::remove(path);
+    }
+  }
+  std::filesystem::remove_all(output);
+
+  const std::vector<StageResult> stages{discovery, probe,     load, strip,
+                                        profile,   uid_remap, write};
+  if (json_file != "-") {
+    fmt::print("{:>10} {:>8} {:>10} {:>12} {:>12}\n", "stage", "items",
+               "seconds", "items/s", "MB/s");
+    for (const StageResult &stage : stages) {
+      fmt::print("{:>10} {:>8} {:>10.3f} {:>12.1f} {:>12.1f}\n", stage.name,
+                 stage.items, stage.seconds,
+                 perSecond(static_cast<double>(stage.items), stage.seconds),
+                 perSecond(static_cast<double>(stage.bytes) / 1.0e6,
+                           stage.seconds));
+    }
+  }
+
+  if (!json_file.empty()) {
+    const std::string json =
+        toJson(stages, input.string(), study_directories.size());
+    if (json_file == "-") {
+      fmt::print("{}", json);
+    } else {
+      std::ofstream{json_file} << json;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcsequen.h"
+
+#include "TagActionTable.hpp"
+
+/* Time TagActionTable::apply() on synthetic datasets of growing size.
+ *
+ * Every dataset carries a ReferencedImageSequence of N items, each holding
+ * identifying names and UIDs. With a linear walk the time per element stays
+ * flat as N grows.
+ */
+
+namespace {
+constexpr int REPEATS{20};
+
+std::unique_ptr<DcmDataset> makeDataset(unsigned int items) {
+  auto dataset = std::make_unique<DcmDataset>();
+  dataset->putAndInsertString(DCM_PatientName, "Doe^John");
+  dataset->putAndInsertString(DCM_PatientID, "123456");
+  dataset->putAndInsertString(DCM_StudyDate, "20250318");
+  dataset->putAndInsertString(DCM_InstitutionName, "Hospital");
+
+  for (unsigned int i = 0; i < items; i++) {
+    DcmItem *item = nullptr;
+    if (dataset->findOrCreateSequenceItem(DCM_ReferencedImageSequence, item,
+                                          -2)
+            .bad())
+      break;
+    const std::string uid = fmt::format("1.2.3.4.{}", i);
+    item->putAndInsertString(DCM_ReferencedSOPClassUID,
+                             "1.2.840.10008.5.1.4.1.1.2");
+    item->putAndInsertString(DCM_ReferencedSOPInstanceUID, uid.c_str());
+    item->putAndInsertString(DCM_PatientName, "Doe^John");
+    item->putAndInsertString(DCM_ReferringPhysicianName, "Smith^Jane");
+  }
+  return dataset;
+}
+
+unsigned long countElements(DcmItem *item) {
+  unsigned long count = 0;
+  DcmObject *object = nullptr;
+  while ((object = item->nextInContainer(object)) != nullptr) {
+    count++;
+    if (object->ident() != EVR_SQ)
+      continue;
+    auto *sequence = static_cast<DcmSequenceOfItems *>(object);
+    DcmObject *nested = nullptr;
+    while ((nested = sequence->nextInContainer(nested)) != nullptr)
+      count += countElements(static_cast<DcmItem *>(nested));
+  }
+  return count;
+}
+} // namespace
+
+int main() {
+  const TagActionTable table = TagActionTable::fromProfiles({});
+
+  fmt::print("{:>8} {:>10} {:>14} {:>14}\n", "items", "elements", "ns/file",
+             "ns/element");
+
+  for (unsigned int items : {0u, 10u, 100u, 1000u, 10000u}) {
+    const auto source = makeDataset(items);
+    const unsigned long elements = countElements(source.get());
+
+    // clone beforehand, only apply() is timed
+    std::vector<std::unique_ptr<DcmDataset>> copies{};
+    for (int i = 0; i < REPEATS; i++)
+      copies.emplace_back(static_cast<DcmDataset *>(source->clone()));
+
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto &copy : copies)
+      table.apply(copy.get(), "ANON");
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    const double per_file = static_cast<double>(elapsed.count()) / REPEATS;
+    fmt::print("{:>8} {:>10} {:>14.0f} {:>14.1f}\n", items, elements, per_file,
+               per_file / static_cast<double>(elements));
+  }
+  return 0;
+}
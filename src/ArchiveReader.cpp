@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <string_view>
+
+#include "fmt/format.h"
+
+#include "dcmtk/ofstd/ofexit.h"
+
+#if defined(FNO_HAVE_LIBARCHIVE)
+#include <archive.h>
+#include <archive_entry.h>
+#endif
+
+#include "ArchiveReader.hpp"
+#include "MainLogger.hpp"
+
+bool ArchiveReader::isArchive(const std::filesystem::path &path) {
+  constexpr std::array<std::string_view, 10> EXTENSIONS{
+      ".tar", ".tar.gz", ".tgz",     ".tar.bz2", ".tbz2",
+      ".tar.xz", ".txz", ".tar.zst", ".tzst",    ".zip"};
+
+  std::string name = path.filename().string();
+  std::ranges::transform(name, name.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  return std::ranges::any_of(EXTENSIONS, [&name](std::string_view extension) {
+    return name.ends_with(extension);
+  });
+}
+
+#if defined(FNO_HAVE_LIBARCHIVE)
+ArchiveReader::~ArchiveReader() {
+  if (m_archive != nullptr)
+    archive_read_free(m_archive);
+}
+
+OFCondition ArchiveReader::open(const std::string &filename) {
+  m_filename = filename;
+  m_status = EC_Normal;
+  m_archive = archive_read_new();
+  archive_read_support_filter_all(m_archive);
+  archive_read_support_format_tar(m_archive);
+  archive_read_support_format_zip(m_archive);
+
+  if (archive_read_open_filename(m_archive, filename.c_str(), 1 << 20) !=
+      ARCHIVE_OK) {
+    const std::string msg = fmt::format("unable to open archive `{}` ({})",
+                                        filename,
+                                        archive_error_string(m_archive));
+    FNO_LOG_ERROR("{}", msg);
+    m_status = {0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error, msg.c_str()};
+  }
+  return m_status;
+}
+
+bool ArchiveReader::next(std::string &name, std::vector<char> &data) {
+  if (m_archive == nullptr || m_status.bad())
+    return false;
+
+  const auto fail = [this](std::string_view what) {
+    const std::string msg =
+        fmt::format("error {} archive `{}` ({})", what, m_filename,
+                    archive_error_string(m_archive));
+    FNO_LOG_ERROR("{}", msg);
+    m_status = {0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error, msg.c_str()};
+    return false;
+  };
+
+  archive_entry *entry = nullptr;
+  while (true) {
+    const int result = archive_read_next_header(m_archive, &entry);
+    if (result == ARCHIVE_EOF)
+      return false;
+    if (result < ARCHIVE_WARN)
+      return fail("reading");
+    if (archive_entry_filetype(entry) == AE_IFREG)
+      break;
+  }
+
+  name = archive_entry_pathname(entry);
+  data.clear();
+  data.resize(archive_entry_size_is_set(entry) != 0
+                  ? static_cast<std::size_t>(archive_entry_size(entry))
+                  : std::size_t{1} << 16);
+
+  // decompress into the member buffer, growing it for sizes not in the header
+  std::size_t used{0};
+  while (true) {
+    if (used == data.size()) {
+      // a member of known size ends here, one more byte decides
+      char extra{};
+      const la_ssize_t count = archive_read_data(m_archive, &extra, 1);
+      if (count < 0)
+        return fail("decompressing");
+      if (count == 0)
+        break;
+      data.resize(data.size() * 2 + (std::size_t{1} << 16));
+      data[used++] = extra;
+      continue;
+    }
+    const la_ssize_t count =
+        archive_read_data(m_archive, data.data() + used, data.size() - used);
+    if (count < 0)
+      return fail("decompressing");
+    if (count == 0)
+      break;
+    used += static_cast<std::size_t>(count);
+  }
+  data.resize(used);
+  return true;
+}
+#else
+ArchiveReader::~ArchiveReader() = default;
+
+OFCondition ArchiveReader::open(const std::string &filename) {
+  const std::string msg = fmt::format(
+      "unable to read archive `{}`, built without libarchive", filename);
+  FNO_LOG_ERROR("{}", msg);
+  m_status = {0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error, msg.c_str()};
+  return m_status;
+}
+
+bool ArchiveReader::next(std::string &, std::vector<char> &) { return false; }
+#endif
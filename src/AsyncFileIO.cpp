@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <stop_token>
+#include <thread>
+
+#include "AsyncFileIO.hpp"
+#include "MainLogger.hpp"
+
+#if defined(FNO_HAVE_LIBURING)
+// UringFileIO.cpp, nullptr when the kernel refuses to set up a ring
+std::unique_ptr<AsyncFileIO> createUringFileIO(unsigned int queue_depth);
+#endif
+
+namespace {
+// blocking reads and writes on a few dedicated threads, reads are served
+// before writes as a worker is already waiting for them
+class ThreadFileIO final : public AsyncFileIO {
+public:
+  explicit ThreadFileIO(unsigned int queue_depth);
+  ~ThreadFileIO() override;
+
+  void write(const std::string &filename, std::vector<char> data,
+             WriteCallback on_written) override;
+  void flush() override;
+
+protected:
+  void submitRead(const std::string &filename,
+                  std::shared_ptr<ReadSlot> slot) override;
+
+private:
+  void run(std::stop_token stop);
+
+  std::mutex m_mutex;
+  std::condition_variable_any m_wake;
+  std::condition_variable m_idle;
+  std::deque<std::function<void()>> m_tasks{};
+  std::size_t m_running{0};
+  std::vector<std::jthread> m_threads{}; // last, joined first
+};
+
+ThreadFileIO::ThreadFileIO(unsigned int queue_depth)
+    : AsyncFileIO{queue_depth} {
+  const unsigned int count = std::max(1U, queue_depth);
+  m_threads.reserve(count);
+  for (unsigned int i = 0; i < count; ++i)
+    m_threads.emplace_back([this](std::stop_token stop) { this->run(stop); });
+}
+
+ThreadFileIO::~ThreadFileIO() {
+  this->flush();
+  for (auto &thread : m_threads)
+    thread.request_stop();
+  m_wake.notify_all();
+}
+
+void ThreadFileIO::run(std::stop_token stop) {
+  while (true) {
+    std::function<void()> task{};
+    {
+      std::unique_lock lock{m_mutex};
+      if (!m_wake.wait(lock, stop, [this] { return !m_tasks.empty(); }))
+        return;
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+      ++m_running;
+    }
+
+    task();
+
+    const std::lock_guard lock{m_mutex};
+    if (--m_running == 0 && m_tasks.empty())
+      m_idle.notify_all();
+  }
+}
+
+void ThreadFileIO::submitRead(const std::string &filename,
+                              std::shared_ptr<ReadSlot> slot) {
+  {
+    const std::lock_guard lock{m_mutex};
+    m_tasks.emplace_front([this, filename, slot]() {
+      const OFCondition cond = readWholeFile(filename, slot->data);
+      this->completeRead(*slot, cond);
+    });
+  }
+  m_wake.notify_one();
+}
+
+void ThreadFileIO::write(const std::string &filename, std::vector<char> data,
+                         WriteCallback on_written) {
+  {
+    const std::lock_guard lock{m_mutex};
+    m_tasks.emplace_back([filename, data = std::move(data),
+                          on_written = std::move(on_written)]() {
+      on_written(writeWholeFile(filename, data));
+    });
+  }
+  m_wake.notify_one();
+}
+
+void ThreadFileIO::flush() {
+  std::unique_lock lock{m_mutex};
+  m_idle.wait(lock, [this] { return m_tasks.empty() && m_running == 0; });
+}
+} // namespace
+
+std::unique_ptr<AsyncFileIO> AsyncFileIO::create(E_IO_BACKEND backend,
+                                                 unsigned int queue_depth) {
+  if (backend == I_SYNC)
+    return nullptr;
+
+#if defined(FNO_HAVE_LIBURING)
+  if (backend == I_URING) {
+    if (auto uring = createUringFileIO(queue_depth))
+      return uring;
+    FNO_LOG_WARN("io_uring setup failed, using I/O threads");
+  }
+#else
+  if (backend == I_URING)
+    FNO_LOG_WARN("built without io_uring, using I/O threads");
+#endif
+  return std::make_unique<ThreadFileIO>(queue_depth);
+}
+
+void AsyncFileIO::prefetch(const std::string &filename) {
+  std::shared_ptr<ReadSlot> slot{};
+  {
+    const std::lock_guard lock{m_read_mutex};
+    if (m_reads.contains(filename) || m_reads.size() >= m_max_prefetch)
+      return;
+    slot = std::make_shared<ReadSlot>();
+    m_reads.emplace(filename, slot);
+  }
+  this->submitRead(filename, std::move(slot));
+}
+
+OFCondition AsyncFileIO::take(const std::string &filename,
+                              std::vector<char> &data) {
+  std::unique_lock lock{m_read_mutex};
+  const auto it = m_reads.find(filename);
+  if (it == m_reads.end()) {
+    lock.unlock();
+    return readWholeFile(filename, data);
+  }
+
+  const std::shared_ptr<ReadSlot> slot = it->second;
+  m_read_done.wait(lock, [&slot] { return slot->done; });
+  m_reads.erase(filename);
+
+  data = std::move(slot->data);
+  return slot->cond;
+}
+
+void AsyncFileIO::discard(const std::string &filename) {
+  const std::lock_guard lock{m_read_mutex};
+  m_reads.erase(filename);
+}
+
+void AsyncFileIO::completeRead(ReadSlot &slot, const OFCondition &cond) {
+  {
+    const std::lock_guard lock{m_read_mutex};
+    slot.cond = cond;
+    slot.done = true;
+  }
+  m_read_done.notify_all();
+}
+
+OFCondition readWholeFile(const std::string &filename,
+                          std::vector<char> &data) {
+  std::ifstream file{filename, std::ios::in | std::ios::binary | std::ios::ate};
+  if (!file.is_open())
+    return {0, 0, OF_error, "unable to open input file"};
+
+  data.resize(static_cast<std::size_t>(file.tellg()));
+  file.seekg(0, std::ios::beg);
+  file.read(data.data(), static_cast<std::streamsize>(data.size()));
+  if (file.gcount() != static_cast<std::streamsize>(data.size()))
+    return {0, 0, OF_error, "error reading input file"};
+  return EC_Normal;
+}
+
+OFCondition writeWholeFile(const std::string &filename,
+                           const std::vector<char> &data) {
+  std::ofstream file{filename,
+                     std::ios::out | std::ios::binary | std::ios::trunc};
+  if (!file.is_open())
+    return {0, 0, OF_error, "unable to create output file"};
+
+  file.write(data.data(), static_cast<std::streamsize>(data.size()));
+  file.close();
+  if (file.fail())
+    return {0, 0, OF_error, "error writing output file"};
+  return EC_Normal;
+}
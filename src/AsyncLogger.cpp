@@ -0,0 +1,251 @@
+#include <chrono>
+#include <string_view>
+
+#include "fmt/chrono.h"
+
+#include "dcmtk/ofstd/ofexit.h"
+
+#include "AsyncLogger.hpp"
+
+namespace {
+constexpr std::array<std::string_view, 5> LEVEL_NAMES{"debug", "info", "warn",
+                                                      "error", "console"};
+constexpr std::array<char, 5> LEVEL_LETTERS{'D', 'I', 'W', 'E', ' '};
+constexpr std::size_t BATCH_RECORDS{256};
+
+// small sequential numbers, easier to follow than native thread ids
+unsigned int threadNumber() {
+  static std::atomic<unsigned int> next{0};
+  thread_local const unsigned int number = next.fetch_add(1);
+  return number;
+}
+
+void appendJsonString(std::string &out, std::string_view text) {
+  out.push_back('"');
+  for (const char c : text) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20)
+        fmt::format_to(std::back_inserter(out), "\\u{:04x}",
+                       static_cast<unsigned int>(c));
+      else
+        out.push_back(c);
+    }
+  }
+  out.push_back('"');
+}
+} // namespace
+
+AsyncLogger::AsyncLogger() : m_slots{std::make_unique<Slot[]>(CAPACITY)} {
+  for (std::size_t i = 0; i < CAPACITY; ++i)
+    m_slots[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+AsyncLogger::~AsyncLogger() { this->stop(); }
+
+OFCondition AsyncLogger::start(E_LOG_LEVEL level, const std::string &json_file,
+                               const OFLogger *appenders) {
+  const std::lock_guard lock{m_output_mutex};
+  m_level.store(level, std::memory_order_relaxed);
+  m_appenders = appenders;
+  if (json_file == "-") {
+    m_json = stdout;
+    m_text = false;
+  } else if (!json_file.empty()) {
+    m_json = std::fopen(json_file.c_str(), "ab");
+    if (m_json == nullptr) {
+      const std::string msg =
+          fmt::format("unable to open log file `{}`", json_file);
+      return {0, EXITCODE_CANNOT_WRITE_OUTPUT_FILE, OF_error, msg.c_str()};
+    }
+  }
+
+  // opens the ring, nothing was claimed while it was closed
+  m_head = m_tail.load(std::memory_order_acquire) & ~CLOSED;
+  m_written.store(m_head, std::memory_order_relaxed);
+  m_running.store(true, std::memory_order_release);
+  m_tail.store(m_head, std::memory_order_release);
+  m_flusher = std::jthread{[this](const std::stop_token &stop) { run(stop); }};
+  return EC_Normal;
+}
+
+void AsyncLogger::stop() {
+  if (!m_running.load(std::memory_order_acquire))
+    return;
+  // close admission first, the flusher then drains up to the final tail
+  m_tail.fetch_or(CLOSED, std::memory_order_acq_rel);
+  m_flusher.request_stop();
+  m_flusher.join();
+  m_running.store(false, std::memory_order_release);
+
+  const std::lock_guard lock{m_output_mutex};
+  m_appenders = nullptr;
+  if (m_json != nullptr && m_json != stdout)
+    std::fclose(m_json);
+  m_json = nullptr;
+  m_text = true;
+}
+
+void AsyncLogger::flush() {
+  if (!m_running.load(std::memory_order_acquire))
+    return;
+  const std::uint64_t tail = m_tail.load(std::memory_order_acquire) & ~CLOSED;
+  while (m_written.load(std::memory_order_acquire) < tail)
+    std::this_thread::sleep_for(std::chrono::microseconds{100});
+}
+
+E_LOG_LEVEL AsyncLogger::levelOf(const OFLogger &logger) {
+  if (logger.isEnabledFor(OFLogger::DEBUG_LOG_LEVEL))
+    return V_DEBUG;
+  if (logger.isEnabledFor(OFLogger::INFO_LOG_LEVEL))
+    return V_INFO;
+  if (logger.isEnabledFor(OFLogger::WARN_LOG_LEVEL))
+    return V_WARN;
+  if (logger.isEnabledFor(OFLogger::ERROR_LOG_LEVEL))
+    return V_ERROR;
+  return V_CONSOLE;
+}
+
+AsyncLogger::Slot *AsyncLogger::claim() {
+  std::uint64_t position = m_tail.load(std::memory_order_relaxed);
+  while (true) {
+    if (position & CLOSED)
+      return nullptr;
+    Slot &slot = m_slots[position & (CAPACITY - 1)];
+    const std::uint64_t sequence =
+        slot.sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      // fails once stop() set the closed bit, claimed slots are drained
+      if (m_tail.compare_exchange_weak(position, position + 1,
+                                       std::memory_order_relaxed))
+        return &slot;
+    } else {
+      // ring full, or another producer took the slot first
+      if (sequence < position)
+        std::this_thread::yield();
+      position = m_tail.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void AsyncLogger::stamp(Slot &slot, E_LOG_LEVEL level) {
+  slot.level = level;
+  slot.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+  slot.thread = threadNumber();
+}
+
+void AsyncLogger::publish(Slot &slot, E_LOG_LEVEL level) {
+  stamp(slot, level);
+  const std::uint64_t position = slot.sequence.load(std::memory_order_relaxed);
+  slot.sequence.store(position + 1, std::memory_order_release);
+}
+
+void AsyncLogger::writeNow(Slot &slot, E_LOG_LEVEL level) {
+  stamp(slot, level);
+  const std::lock_guard lock{m_output_mutex};
+  this->format(slot);
+  this->write();
+}
+
+void AsyncLogger::run(const std::stop_token &stop) {
+  while (true) {
+    if (this->drain() > 0)
+      continue;
+    // the tail is closed and final once stop is requested
+    if (stop.stop_requested() &&
+        m_head == (m_tail.load(std::memory_order_acquire) & ~CLOSED))
+      return;
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  }
+}
+
+std::size_t AsyncLogger::drain() {
+  const std::lock_guard lock{m_output_mutex};
+  std::size_t count{0};
+  while (true) {
+    Slot &slot = m_slots[m_head & (CAPACITY - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != m_head + 1)
+      break;
+    this->format(slot);
+    slot.sequence.store(m_head + CAPACITY, std::memory_order_release);
+    ++m_head;
+    if (++count % BATCH_RECORDS == 0)
+      this->write();
+  }
+  if (count > 0) {
+    this->write();
+    m_written.store(m_head, std::memory_order_release);
+  }
+  return count;
+}
+
+void AsyncLogger::format(const Slot &slot) {
+  std::string_view message{slot.message.data(), slot.size};
+  if (m_text && m_appenders != nullptr && slot.level != V_CONSOLE) {
+    // --log-config, its appenders write the record on this thread
+    this->write();
+    switch (slot.level) {
+    case V_DEBUG:
+      OFLOG_DEBUG(*m_appenders, message);
+      break;
+    case V_INFO:
+      OFLOG_INFO(*m_appenders, message);
+      break;
+    case V_WARN:
+      OFLOG_WARN(*m_appenders, message);
+      break;
+    default:
+      OFLOG_ERROR(*m_appenders, message);
+    }
+  } else if (m_text) {
+    if (slot.level == V_CONSOLE)
+      fmt::format_to(std::back_inserter(m_stdout), "{}\n", message);
+    else
+      fmt::format_to(std::back_inserter(m_stderr), "{}: {}\n",
+                     LEVEL_LETTERS[slot.level], message);
+  }
+  if (m_json == nullptr)
+    return;
+
+  // console messages carry their own blank lines
+  while (!message.empty() && message.front() == '\n')
+    message.remove_prefix(1);
+  while (!message.empty() && message.back() == '\n')
+    message.remove_suffix(1);
+  const std::chrono::sys_seconds time{
+      std::chrono::seconds{slot.time_us / 1000000}};
+  fmt::format_to(
+      std::back_inserter(m_json_lines),
+      R"({{"time":"{:%FT%T}.{:06}Z","level":"{}","thread":{},"message":)",
+      time, slot.time_us % 1000000, LEVEL_NAMES[slot.level], slot.thread);
+  appendJsonString(m_json_lines, message);
+  m_json_lines += "}\n";
+}
+
+void AsyncLogger::write() {
+  const auto put = [](std::string &buffer, std::FILE *file) {
+    if (buffer.empty())
+      return;
+    std::fwrite(buffer.data(), 1, buffer.size(), file);
+    std::fflush(file);
+    buffer.clear();
+  };
+  put(m_stdout, stdout);
+  put(m_stderr, stderr);
+  if (m_json != nullptr)
+    put(m_json_lines, m_json);
+}
@@ -0,0 +1,342 @@
+#include <string_view>
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcuid.h"
+
+#include "fmt/format.h"
+
+#include "AsyncLogger.hpp"
+#include "DatasetAnonymizer.hpp"
+#include "DicomIO.hpp"
+
+OFLogger anonymizerLogger = OFLog::getLogger("fno.anonymizer");
+
+OFCondition DatasetAnonymizer::setup(const AnonymizerOptions &options) {
+  m_options = options;
+
+  m_tag_actions = TagActionTable::fromProfiles(options.methods);
+  if (!options.tag_rule_file.empty()) {
+    if (OFCondition cond = m_tag_actions.mergeRuleFile(options.tag_rule_file);
+        cond.bad())
+      return cond;
+  }
+  if (!options.safe_private_file.empty()) {
+    if (OFCondition cond =
+            m_tag_actions.mergeSafePrivateCreators(options.safe_private_file);
+        cond.bad())
+      return cond;
+  }
+
+  if (!options.pixel_mask_file.empty()) {
+    if (OFCondition cond = m_pixel_masks.load(options.pixel_mask_file);
+        cond.bad())
+      return cond;
+  }
+
+  if (!options.uid_key_file.empty()) {
+    if (OFCondition cond =
+            m_uid_remapper.setup(options.uid_key_file, options.uid_root);
+        cond.bad())
+      return cond;
+  }
+
+  if (options.pseudoname_type == P_FROM_FILE) {
+    if (OFCondition cond = this->readPseudonamesFromFile(
+            options.pseudoname_file, options.pseudoname_index);
+        cond.bad())
+      return cond;
+  }
+
+  if (!options.pseudoname_vault.empty()) {
+    if (OFCondition cond = m_vault.open(options.pseudoname_vault);
+        cond.bad()) {
+      this->log(V_ERROR, "{}", cond.text());
+      return cond;
+    }
+    this->log(V_INFO, "found {} pseudonames in vault `{}`", m_vault.size(),
+              options.pseudoname_vault);
+  }
+
+  m_pixel_encoder =
+      options.pixel_codec == X_KEEP
+          ? nullptr
+          : std::make_unique<PixelEncoder>(options.pixel_codec,
+                                           options.encode_threads);
+  return EC_Normal;
+}
+
+OFCondition DatasetAnonymizer::anonymize(DcmDataset *dataset,
+                                         AnonymizedDataset &result) const {
+  result = {};
+  dataset->findAndGetOFString(DCM_PatientID, result.old_patient_id);
+  dataset->findAndGetOFString(DCM_PatientName, result.old_patient_name);
+  dataset->findAndGetOFString(DCM_StudyInstanceUID, result.old_study_uid);
+  dataset->findAndGetOFString(DCM_StudyDate, result.study_date);
+
+  std::shared_ptr<StudyMapping> mapping{};
+  {
+    // the slot is taken under the lock, a forgotten study keeps its mapping
+    // for the datasets still being anonymized
+    const std::lock_guard lock{m_studies_mutex};
+    auto [entry, inserted] = m_studies.try_emplace(result.old_study_uid);
+    if (inserted) {
+      entry->second = std::make_shared<StudyMapping>();
+      entry->second->index = m_study_count++;
+      m_study_order.push_front(result.old_study_uid);
+      entry->second->order = m_study_order.begin();
+    } else {
+      m_study_order.splice(m_study_order.begin(), m_study_order,
+                           entry->second->order);
+    }
+    mapping = entry->second;
+
+    if (m_options.max_studies != 0 &&
+        m_studies.size() > m_options.max_studies) {
+      m_studies.erase(m_study_order.back());
+      m_study_order.pop_back();
+    }
+  }
+
+  // the first dataset of a study decides its pseudoname and UID, outside the
+  // map lock since a vault syncs new pseudonames to disk
+  std::call_once(mapping->decided, [&] {
+    mapping->pseudoname =
+        this->pseudoname(result.old_patient_id, mapping->index);
+    mapping->new_study_uid = this->newStudyUid(result.old_study_uid);
+    m_metrics.add(C_STUDIES);
+    result.new_study = true;
+  });
+  result.pseudoname = mapping->pseudoname;
+  result.new_study_uid = mapping->new_study_uid;
+
+  const DatasetStudy datasetStudy{
+      result.pseudoname, result.new_study_uid,
+      [this, &mapping](const std::string &old_series_uid) {
+        const std::lock_guard lock{mapping->series_mutex};
+        auto [series, inserted] =
+            mapping->series_uids.try_emplace(old_series_uid);
+        if (inserted) {
+          char uid[65];
+          dcmGenerateUniqueIdentifier(uid, m_options.uid_root.c_str());
+          series->second = uid;
+        }
+        return series->second;
+      }};
+
+  OFCondition cond =
+      this->process(dataset, datasetStudy, true, m_metrics, result);
+  m_metrics.add(cond.good() ? C_FILES : C_FILES_FAILED);
+  return cond;
+}
+
+OFCondition DatasetAnonymizer::anonymize(DcmFileFormat &fileformat,
+                                         AnonymizedDataset &result) const {
+  OFCondition cond = this->anonymize(fileformat.getDataset(), result);
+  if (cond.good())
+    cond = fileformat.getMetaInfo()->putAndInsertString(
+        DCM_MediaStorageSOPInstanceUID, result.new_sop_instance_uid.c_str());
+  return cond;
+}
+
+OFCondition DatasetAnonymizer::anonymize(const char *data, std::size_t size,
+                                         std::vector<char> &output,
+                                         AnonymizedDataset &result) const {
+  DcmFileFormat fileformat{};
+  OFCondition cond = readFileFormatFromBuffer(fileformat, data, size);
+  if (cond.bad()) {
+    m_metrics.add(C_FILES_FAILED);
+    return cond;
+  }
+  m_metrics.add(C_BYTES_READ, size);
+
+  cond = this->anonymize(fileformat, result);
+  if (cond.bad())
+    return cond;
+
+  const RunMetrics::StageTimer timer{m_metrics, S_WRITE};
+  DcmDataset *dataset = fileformat.getDataset();
+  const E_TransferSyntax xfer = dataset->getCurrentXfer();
+  dataset->chooseRepresentation(xfer, nullptr);
+  cond = writeFileFormatToBuffer(fileformat, xfer, EET_UndefinedLength,
+                                 EGL_recalcGL, output);
+  if (cond.good())
+    m_metrics.add(C_BYTES_WRITTEN, output.size());
+  return cond;
+}
+
+void DatasetAnonymizer::forgetStudies() {
+  const std::lock_guard lock{m_studies_mutex};
+  m_studies.clear();
+  m_study_order.clear();
+  m_study_count = 0;
+}
+
+std::string DatasetAnonymizer::pseudoname(const std::string &patient_id,
+                                          unsigned int study_index) const {
+  const std::string &prefix = m_options.pseudoname_prefix;
+  switch (m_options.pseudoname_type) {
+  case P_RANDOM_STRING:
+    return this->vaultPseudoname(patient_id, [this, &prefix] {
+      return fmt::format("{}{}", prefix, this->randomString());
+    });
+  case P_INTEGER_ORDER:
+    // numbering follows directory order, not the order studies finish in
+    return fmt::format("{0}{1:0{2}}", prefix, study_index + 1,
+                       m_options.count_width);
+  case P_FROM_FILE:
+    break;
+  }
+
+  std::string_view pseudoname{};
+  if (m_pseudonames.find(patient_id, pseudoname))
+    return fmt::format("{}{}", prefix, pseudoname);
+
+  std::string generated = this->vaultPseudoname(patient_id, [this, &prefix] {
+    return fmt::format("{}{}_{}", prefix, "UN", this->randomString());
+  });
+  this->log(V_WARN, "ID {} not in PatientID-pseudoname file", patient_id);
+  this->log(V_WARN, "generated random string instead {} -> {}", patient_id,
+            generated);
+  return generated;
+}
+
+std::string
+DatasetAnonymizer::newStudyUid(const std::string &old_study_uid) const {
+  if (m_uid_remapper.isEnabled())
+    return m_uid_remapper.map(old_study_uid);
+
+  char uid[65];
+  dcmGenerateUniqueIdentifier(uid, m_options.uid_root.c_str());
+  return uid;
+}
+
+OFCondition DatasetAnonymizer::process(DcmDataset *dataset,
+                                       const DatasetStudy &study,
+                                       bool encode_pixels, RunMetrics &metrics,
+                                       AnonymizedDataset &result,
+                                       std::string_view name) const {
+  OFCondition cond{};
+
+  // burned-in annotations, selected by the tags of the input
+  if (!m_pixel_masks.isEmpty()) {
+    const RunMetrics::StageTimer timer{metrics, S_MASK};
+    cond = m_pixel_masks.apply(dataset, result.pixels_masked);
+    if (cond.bad()) {
+      this->log(V_ERROR, "unable to mask pixel data of `{}`: {}", name,
+                cond.text());
+      return cond;
+    }
+    if (result.pixels_masked)
+      metrics.add(C_FILES_MASKED);
+  }
+
+  dataset->findAndGetOFString(DCM_SeriesInstanceUID, result.old_series_uid);
+
+  // Basic Application Confidentiality Profile, retain options, removal of
+  // private and unknown tags and keyed UIDs, applied at every nesting level
+  // in one walk
+  const UidRemapper *uidRemapper =
+      m_uid_remapper.isEnabled() ? &m_uid_remapper : nullptr;
+  {
+    const RunMetrics::StageTimer timer{metrics, S_TAG_ACTIONS};
+    TagActionCounts counts{};
+    m_tag_actions.apply(dataset, std::string{study.pseudoname}, uidRemapper,
+                        &counts);
+    metrics.addTagCounts(counts);
+  }
+
+  {
+    const RunMetrics::StageTimer timer{metrics, S_UIDS};
+    if (uidRemapper != nullptr) {
+      // SeriesInstanceUID and SOPInstanceUID were remapped by the walk
+      result.new_series_uid = uidRemapper->map(result.old_series_uid);
+      dataset->findAndGetOFString(DCM_SOPInstanceUID,
+                                  result.new_sop_instance_uid);
+    } else {
+      result.new_series_uid = study.series_uid(result.old_series_uid);
+      dataset->putAndInsertString(DCM_SeriesInstanceUID,
+                                  result.new_series_uid.c_str());
+
+      char newSOPInstanceUID[65];
+      dcmGenerateUniqueIdentifier(newSOPInstanceUID,
+                                  m_options.uid_root.c_str());
+      result.new_sop_instance_uid = newSOPInstanceUID;
+      dataset->putAndInsertOFStringArray(DCM_SOPInstanceUID,
+                                         newSOPInstanceUID);
+    }
+
+    dataset->putAndInsertOFStringArray(DCM_StudyInstanceUID,
+                                       std::string{study.new_study_uid});
+  }
+
+  // native pixel data is encoded losslessly, frames on the encoder threads
+  if (m_pixel_encoder && encode_pixels) {
+    const RunMetrics::StageTimer timer{metrics, S_ENCODE};
+    PixelEncodeResult encoded{};
+    if (OFCondition encodeCond = m_pixel_encoder->encode(dataset, encoded);
+        encodeCond.bad()) {
+      this->log(V_WARN, "pixel data of `{}` not encoded: {}", name,
+                encodeCond.text());
+    } else if (encoded.encoded) {
+      result.pixels_encoded = true;
+      metrics.add(C_FILES_ENCODED);
+      metrics.add(C_PIXEL_BYTES_NATIVE, encoded.native_bytes);
+      metrics.add(C_PIXEL_BYTES_ENCODED, encoded.encoded_bytes);
+    }
+  }
+  return cond;
+}
+
+std::string DatasetAnonymizer::randomString() const {
+  static constexpr std::string_view chars{"abcdefghijklmnopqrstuvwxyz"
+                                          "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                          "0123456789"};
+  std::uniform_int_distribution<std::size_t> dist(0, chars.size() - 1);
+
+  std::string retval(10, '\0');
+  const std::lock_guard lock{m_rng_mutex};
+  for (char &c : retval) {
+    c = chars[dist(m_rng)];
+  }
+
+  return retval;
+}
+
+std::string DatasetAnonymizer::vaultPseudoname(
+    const std::string &patient_id,
+    const std::function<std::string()> &generate) const {
+  if (!m_vault.isOpen())
+    return generate();
+
+  std::string pseudoname{};
+  const OFCondition cond = m_vault.assign(patient_id, generate, pseudoname);
+  if (cond.good())
+    return pseudoname;
+  this->log(V_WARN, "pseudoname of ID {} not kept in vault ({})", patient_id,
+            cond.text());
+  return generate();
+}
+
+OFCondition
+DatasetAnonymizer::readPseudonamesFromFile(const std::string &filename,
+                                           bool use_index) {
+  // binary sidecar of the table, rebuilt whenever the file changes
+  const std::string indexFile = filename + ".fnoidx";
+  if (use_index && m_pseudonames.loadIndex(indexFile, filename).good()) {
+    this->log(V_INFO, "loaded pseudoname index `{}`", indexFile);
+  } else {
+    if (OFCondition cond = m_pseudonames.load(filename); cond.bad()) {
+      this->log(V_ERROR, "{}", cond.text());
+      return cond;
+    }
+    if (use_index) {
+      if (OFCondition cond = m_pseudonames.saveIndex(indexFile, filename);
+          cond.bad())
+        this->log(V_WARN, "{} `{}`", cond.text(), indexFile);
+    }
+  }
+
+  this->log(V_INFO, "found {} PatientID-pseudoname pairs to apply",
+            m_pseudonames.size());
+  return EC_Normal;
+};
@@ -1,8 +1,15 @@
 //
 // Created by Vojtěch on 18.03.2025.
 //
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <fstream>
-#include <random>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "dcmtk/dcmdata/dcdeftag.h"
 #include "dcmtk/dcmdata/dctagkey.h"
@@ -13,397 +20,948 @@
 
 #include "fmt/format.h"
 
+#include "ArchiveReader.hpp"
 #include "DicomAnonymizer.hpp"
+#include "DicomIO.hpp"
+#include "DicomProbe.hpp"
+#include "BoundedQueue.hpp"
+#include "MainLogger.hpp"
+#include "Sha256.hpp"
+
+OFCondition StudyAnonymizer::walkDicomFiles(
+    const std::filesystem::path &directory,
+    const std::function<bool(const std::string &)> &on_file) const {
+  using Clock = std::chrono::steady_clock;
+
+  // time spent in on_file() (queueing, anonymizing) is not discovery
+  std::chrono::nanoseconds walking{0};
+  Clock::time_point start = Clock::now();
+
+  std::error_code ec{};
+  std::filesystem::recursive_directory_iterator it{directory, ec};
+  for (; !ec && it != std::filesystem::recursive_directory_iterator{};
+       it.increment(ec)) {
+    std::error_code status_ec{};
+    if (it->is_directory(status_ec) || it->path().filename() == "DICOMDIR")
+      continue;
 
-OFLogger mainLogger = OFLog::getLogger("");
-
-void setupLogger(std::string_view logger_name) {
-  mainLogger = OFLog::getLogger(logger_name.data());
-};
-
-std::string generate_random_string() {
-  static constexpr std::string_view chars{"abcdefghijklmnopqrstuvwxyz"
-                                          "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                                          "0123456789"};
-  static std::mt19937_64 rng{std::random_device{}()};
-  std::uniform_int_distribution<std::size_t> dist(0, chars.size() - 1);
+    // non-DICOM files would fail to load and abort the whole study
+    const std::string file = it->path().string();
+    if (!hasDicomMagic(file)) {
+      FNO_LOG_DEBUG("ignoring `{}`, no DICM magic", file);
+      m_metrics.add(C_FILES_IGNORED);
+      continue;
+    }
 
-  std::string retval(10, '\0');
-  for (char &c : retval) {
-    c = chars[dist(rng)];
+    walking += Clock::now() - start;
+    const bool more = on_file(file);
+    start = Clock::now();
+    if (!more)
+      break;
   }
+  walking += Clock::now() - start;
+  m_metrics.record(S_DISCOVERY, walking);
 
-  return retval;
-};
+  if (ec) {
+    const std::string msg =
+        fmt::format("error while searching dicom files in `{}` ({})",
+                    directory.string(), ec.message());
+    FNO_LOG_ERROR("{}", msg);
+    return {0, 0, OF_error, msg.c_str()};
+  }
+  return EC_Normal;
+}
 
 OFCondition
-StudyAnonymizer::findDicomFiles(const std::filesystem::path &study_directory) {
-
-  // remove previous filenames and series uids when iterating over new study
-  // directory
-  if (!m_dicom_files.empty())
-    m_dicom_files.clear();
-  if (!m_series_uids.empty())
-    m_series_uids.clear();
-
-  for (const auto &entry :
-       std::filesystem::recursive_directory_iterator(study_directory)) {
-    if (entry.is_directory() || entry.path().filename() == "DICOMDIR")
-      continue;
+StudyAnonymizer::scanStudies(const std::filesystem::path &root,
+                             std::vector<StudyInput> &studies) const {
+  const RunMetrics::StageTimer timer{m_metrics, S_DISCOVERY};
+  StudyScanner scanner{m_jobs};
+  const OFCondition cond = scanner.scan(root, studies);
+  m_metrics.add(C_FILES_IGNORED, scanner.ignoredFiles());
+  return cond;
+}
 
-    m_dicom_files.push_back(entry.path().string());
+OFCondition
+StudyAnonymizer::countArchiveStudies(const std::filesystem::path &archive,
+                                     std::size_t &count) const {
+  std::unordered_set<std::string> studyUids{};
+  ArchiveReader reader{};
+  OFCondition cond = reader.open(archive.string());
+  std::string name{};
+  std::vector<char> data{};
+  while (cond.good() && reader.next(name, data)) {
+    DicomProbe probe{data.data(), data.size()};
+    StudyInput tags{};
+    if (probeStudyTags(probe, tags).good())
+      studyUids.insert(std::move(tags.study_uid));
   }
+  count = studyUids.size();
+  return cond.good() ? reader.status() : cond;
+}
 
-  OFCondition cond{};
-  if (m_dicom_files.empty()) {
-    const std::string msg =
-        fmt::format("no dicom files found in `{}`", study_directory.string());
-    OFLOG_WARN(mainLogger, msg.c_str());
-    return {0, 0, OF_failure, msg.c_str()};
+namespace {
+void setupStudy(StudyContext &study, const StudyInput &input,
+                std::size_t index) {
+  study.study_index = static_cast<unsigned int>(index);
+  study.input_directory = input.input_directory;
+  if (input.study_uid.empty()) {
+    study.study_key = study.input_directory.string();
+    return;
   }
 
-  return EC_Normal;
+  // scanned or archived study, basic tags are known already
+  study.study_key = input.study_uid;
+  study.old_id = input.patient_id;
+  study.old_name = input.patient_name;
+  study.old_studyuid = input.study_uid;
+  study.study_date = input.study_date;
 }
 
-OFCondition StudyAnonymizer::anonymizeStudy(
-    const std::filesystem::path &input_study_directory,
-    const std::string &output_directory,
-    const std::set<E_ADDIT_ANONYM_METHODS> &methods,
-    const std::string &uid_root) {
-
+// study between discovery and the in-order report in anonymizeStudies()
+struct PipelineStudy {
+  StudyContext study{};
+  std::atomic<std::size_t> files_pending{1}; // one held by discovery
+  std::size_t files_found{0};                // written by discovery only
+  bool prepared{false};         // discovery only, set by the first file
+  bool probe_first_file{false}; // basic tags not known before the first file
+  std::atomic<bool> failed{false};
+  std::mutex cond_mutex;
   OFCondition cond{};
+  bool finished{false}; // guarded by the report mutex
+};
 
-  cond = this->findDicomFiles(input_study_directory);
-  if (cond.bad()) {
-    OFLOG_ERROR(mainLogger, "error while searching dicom files");
-    OFLOG_ERROR(mainLogger, cond.text());
-    return cond;
+// file handed from discovery to the anonymizing workers
+struct FileTask {
+  PipelineStudy *study{nullptr};
+  std::string file{};
+  unsigned int file_index{0};
+  std::vector<char> data{}; // archive member content, empty for files on disk
+  MemoryBudget::Lease lease{};
+};
+} // namespace
+
+void StudyAnonymizer::anonymizeStudies(std::vector<StudyInput> inputs,
+                                       const std::string &output_directory,
+                                       const std::string &uid_root,
+                                       const StudyCallback &on_study_finished) {
+
+  // studies finish in any order, results are reported in input order; only
+  // studies still in flight are kept
+  std::mutex report_mutex;
+  std::deque<std::unique_ptr<PipelineStudy>> in_flight{};
+
+  const auto failStudy = [](PipelineStudy &pipeline, const OFCondition &cond) {
+    const std::lock_guard lock{pipeline.cond_mutex};
+    if (!pipeline.failed.exchange(true))
+      pipeline.cond = cond;
+  };
+
+  const auto finishStudy = [&](PipelineStudy &pipeline) {
+    const StudyContext &study = pipeline.study;
+    if (study.archive && pipeline.failed) {
+      study.archive->discard();
+    } else if (study.archive) {
+      if (const OFCondition cond = study.archive->close(); cond.bad())
+        failStudy(pipeline, cond);
+    }
+
+    m_metrics.add(C_STUDIES);
+    if (pipeline.failed) {
+      m_metrics.add(C_STUDIES_FAILED);
+      FNO_LOG_ERROR("error while processing study `{}`, skipping to next study",
+                    study.input_directory.stem().string());
+    } else {
+      if (study.files_skipped > 0)
+        FNO_LOG_CONSOLE("skipped {} unchanged files of {}",
+                        study.files_skipped.load(), study.old_id);
+      FNO_LOG_CONSOLE("finished anonymization of {}, {} dicom files",
+                      study.old_id, pipeline.files_found);
+    }
+
+    const std::lock_guard lock{report_mutex};
+    pipeline.finished = true;
+    while (!in_flight.empty() && in_flight.front()->finished) {
+      on_study_finished(in_flight.front()->study, in_flight.front()->cond);
+      in_flight.pop_front();
+    }
+  };
+
+  // the last reference to a study, file or discovery, completes it
+  const auto releaseStudy = [&](PipelineStudy &pipeline) {
+    if (pipeline.files_pending.fetch_sub(1) == 1)
+      finishStudy(pipeline);
+  };
+
+  const auto processFile = [&](FileTask &task) {
+    PipelineStudy &pipeline = *task.study;
+    // returned to the budget once the file is done or its output written
+    MemoryBudget::Lease lease = std::move(task.lease);
+    if (!pipeline.failed.load(std::memory_order_relaxed)) {
+      // a queued write keeps the study open until its output is on disk,
+      // a lost output fails the study
+      pipeline.files_pending.fetch_add(1);
+      AsyncFileIO::WriteCallback onWritten = [&](const OFCondition &cond) {
+        if (cond.bad())
+          failStudy(pipeline, cond);
+        releaseStudy(pipeline);
+      };
+
+      std::vector<char> data = std::move(task.data);
+      const OFCondition cond = this->anonymizeFile(
+          pipeline.study, task.file, task.file_index, uid_root,
+          data.empty() ? nullptr : &data, &lease, &onWritten);
+      if (cond.bad())
+        failStudy(pipeline, cond);
+      // not taken over by a write, or dropped before it was queued
+      if (onWritten || cond.bad())
+        releaseStudy(pipeline);
+    } else if (m_async_io && task.data.empty()) {
+      m_async_io->discard(task.file);
+    }
+    releaseStudy(pipeline);
+  };
+
+  // discovery runs at most a bounded number of files ahead of the workers,
+  // without workers the files are anonymized on this thread behind a
+  // read-ahead window of the I/O backend depth
+  BoundedQueue<FileTask> queue{
+      std::max<std::size_t>(2 * std::size_t{m_jobs}, m_prefetch_depth)};
+  std::deque<FileTask> window{};
+  std::vector<std::jthread> workers{};
+  for (unsigned int i = 0; m_jobs > 1 && i < m_jobs; ++i) {
+    workers.emplace_back([&] {
+      FileTask task{};
+      while (queue.pop(task))
+        processFile(task);
+    });
   }
 
-  cond = this->setBasicTags();
+  const auto processWindowFront = [&] {
+    FileTask next = std::move(window.front());
+    window.pop_front();
+    processFile(next);
+  };
 
-  fmt::print("\nanonymizing study {}, {} dicom files\n", m_old_id,
-             m_dicom_files.size());
+  const auto dispatch = [&](FileTask task) {
+    if (!workers.empty()) {
+      queue.push(std::move(task));
+      return;
+    }
+    window.push_back(std::move(task));
+    if (window.size() > m_prefetch_depth)
+      processWindowFront();
+  };
+
+  // waits until the workers return enough of the budget, without workers
+  // the files held in the read-ahead window are anonymized first
+  const auto admit = [&](std::uint64_t size) {
+    MemoryBudget::Lease lease = m_memory_budget.tryAcquire(size);
+    while (!lease && !window.empty()) {
+      processWindowFront();
+      lease = m_memory_budget.tryAcquire(size);
+    }
+    return lease ? std::move(lease) : m_memory_budget.acquire(size);
+  };
+
+  // studies are numbered in the order discovery opens them, an archive
+  // opens one for every StudyInstanceUID it holds
+  unsigned int studyIndex{0};
+  const auto openStudy = [&](const StudyInput &input) -> PipelineStudy & {
+    auto owned = std::make_unique<PipelineStudy>();
+    PipelineStudy &pipeline = *owned;
+    setupStudy(pipeline.study, input, studyIndex++);
+    pipeline.probe_first_file = input.study_uid.empty();
+    const std::lock_guard lock{report_mutex};
+    in_flight.push_back(std::move(owned));
+    return pipeline;
+  };
+
+  // files are queued as they are found, the first one names the study
+  const auto enqueue = [&](PipelineStudy &pipeline, const std::string &file,
+                           std::vector<char> data) {
+    if (pipeline.failed.load(std::memory_order_relaxed))
+      return false;
+    if (!pipeline.prepared) {
+      if (pipeline.probe_first_file)
+        (void)this->setBasicTags(pipeline.study, file);
+      const OFCondition cond =
+          this->prepareStudy(pipeline.study, output_directory);
+      if (cond.bad()) {
+        failStudy(pipeline, cond);
+        return false;
+      }
+      pipeline.prepared = true;
+    }
+
+    MemoryBudget::Lease lease{};
+    if (m_memory_budget.isLimited()) {
+      std::error_code ec{};
+      const std::uintmax_t size =
+          data.empty() ? std::filesystem::file_size(file, ec) : data.size();
+      lease = admit(ec ? 0 : size);
+    }
+
+    ++pipeline.files_found;
+    pipeline.files_pending.fetch_add(1);
+    if (m_async_io && data.empty() && !this->isLargeFile(lease.size()))
+      m_async_io->prefetch(file);
+    dispatch(FileTask{&pipeline, file, m_files_processed.fetch_add(1),
+                      std::move(data), std::move(lease)});
+    return true;
+  };
+
+  // members are read in archive order and grouped by StudyInstanceUID, all
+  // studies of an archive stay open until its last member is read
+  const auto readArchive = [&](const std::filesystem::path &archive) {
+    using Clock = std::chrono::steady_clock;
+    std::chrono::nanoseconds reading{0};
+    Clock::time_point start = Clock::now();
+
+    std::unordered_map<std::string, PipelineStudy *> studies{};
+    std::vector<PipelineStudy *> opened{};
+    ArchiveReader reader{};
+    OFCondition cond = reader.open(archive.string());
+    std::string name{};
+    std::vector<char> data{};
+    while (cond.good() && reader.next(name, data)) {
+      if (std::filesystem::path{name}.filename() == "DICOMDIR")
+        continue;
+
+      DicomProbe probe{data.data(), data.size()};
+      StudyInput tags{};
+      if (const OFCondition probed = probeStudyTags(probe, tags);
+          probed.bad()) {
+        FNO_LOG_DEBUG("ignoring `{}` in `{}`, {}", name, archive.string(),
+                      probed.text());
+        m_metrics.add(C_FILES_IGNORED);
+        continue;
+      }
+
+      PipelineStudy *&pipeline = studies[tags.study_uid];
+      if (pipeline == nullptr) {
+        tags.input_directory = archive;
+        pipeline = &openStudy(tags);
+        opened.push_back(pipeline);
+      }
+
+      reading += Clock::now() - start;
+      (void)enqueue(*pipeline, (archive / name).string(), std::move(data));
+      data = {};
+      start = Clock::now();
+    }
+    reading += Clock::now() - start;
+    m_metrics.record(S_DISCOVERY, reading);
+    if (cond.good())
+      cond = reader.status();
+
+    if (opened.empty()) {
+      // nothing to report per study, the archive counts as one failed study
+      if (cond.good())
+        FNO_LOG_WARN("no dicom files found in `{}`", archive.string());
+      m_metrics.add(C_STUDIES);
+      m_metrics.add(C_STUDIES_FAILED);
+      return;
+    }
+    for (PipelineStudy *pipeline : opened) {
+      if (cond.bad())
+        failStudy(*pipeline, cond);
+      releaseStudy(*pipeline);
+    }
+  };
 
-  char newStudyUID[65];
-  dcmGenerateUniqueIdentifier(newStudyUID, uid_root.c_str());
-  m_new_studyuid = OFString(newStudyUID);
+  for (StudyInput &input : inputs) {
+    if (input.archive) {
+      readArchive(input.input_directory);
+      continue;
+    }
 
-  OFLOG_INFO(mainLogger, "replacing StudyInstanceUID (old) " << m_old_studyuid
-                                                             << " with (new) "
-                                                             << m_new_studyuid);
+    PipelineStudy &pipeline = openStudy(input);
+    OFCondition cond{};
+    if (!input.dicom_files.empty()) {
+      for (const std::string &file : input.dicom_files) {
+        if (!enqueue(pipeline, file, {}))
+          break;
+      }
+      input.dicom_files = {};
+    } else {
+      cond = this->walkDicomFiles(
+          pipeline.study.input_directory,
+          [&](const std::string &file) { return enqueue(pipeline, file, {}); });
+      if (cond.good() && pipeline.files_found == 0 && !pipeline.failed) {
+        const std::string msg =
+            fmt::format("no dicom files found in `{}`",
+                        pipeline.study.input_directory.string());
+        FNO_LOG_WARN("{}", msg);
+        cond = {0, 0, OF_failure, msg.c_str()};
+      }
+    }
+    if (cond.bad())
+      failStudy(pipeline, cond);
+    releaseStudy(pipeline);
+  }
 
-  this->setPseudoname();
+  while (!window.empty())
+    processWindowFront();
+  queue.close();
+  for (auto &worker : workers)
+    worker.join();
+  if (m_async_io)
+    m_async_io->flush();
+
+  if (m_memory_budget.isLimited())
+    FNO_LOG_INFO("at most {} of {} budgeted bytes in flight",
+                 m_memory_budget.peak(), m_memory_budget.limit());
+}
 
-  fmt::print("applying pseudoname {} to ID {}\n", m_pseudoname, m_old_id);
+OFCondition StudyAnonymizer::prepareStudy(StudyContext &study,
+                                          const std::string &output_directory) {
 
-  m_output_study_dir = fmt::format("{}/{}", output_directory, m_pseudoname);
+  FNO_LOG_CONSOLE("\nanonymizing study {}", study.old_id);
 
-  if (std::filesystem::exists(m_output_study_dir)) {
-    OFLOG_INFO(mainLogger, "directory `" << m_output_study_dir
-                                         << "` exists, overwriting files");
+  // a resumed study keeps the pseudoname and UIDs of the previous run
+  const std::string &study_dir = study.study_key;
+  if (const JournalStudyRecord *previous = m_journal.findStudy(study_dir)) {
+    study.new_studyuid = previous->new_studyuid;
+    study.pseudoname = previous->pseudoname;
+    study.series_uids = previous->series_uids;
   } else {
-    std::filesystem::create_directories(m_output_study_dir + "/DICOM");
-    OFLOG_INFO(mainLogger, "created directory `" << m_output_study_dir << "`");
+    study.new_studyuid = m_dataset_anonymizer.newStudyUid(study.old_studyuid);
+    study.pseudoname =
+        m_dataset_anonymizer.pseudoname(study.old_id, study.study_index);
+    m_journal.recordStudy(study_dir, study.pseudoname, study.new_studyuid);
   }
 
-  for (const auto &file : m_dicom_files) {
-    OFCondition cond = m_fileformat.loadFile(file);
-    if (cond.bad()) {
-      OFLOG_ERROR(mainLogger, "unable to load file " << file.c_str());
-      OFLOG_ERROR(mainLogger, cond.text());
-      return cond;
-    }
+  FNO_LOG_INFO("replacing StudyInstanceUID (old) {} with (new) {}",
+               study.old_studyuid, study.new_studyuid);
 
-    m_dataset = m_fileformat.getDataset();
+  FNO_LOG_CONSOLE("applying pseudoname {} to ID {}", study.pseudoname,
+                  study.old_id);
 
-    // dicom tags anonymization specification
-    // https://dicom.nema.org/medical/dicom/current/output/chtml/part15/chapter_E.html
-    // deidentification methods explained
-    // https://dicom.nema.org/medical/dicom/current/output/chtml/part16/sect_CID_7050.html
+  study.output_study_dir =
+      fmt::format("{}/{}", output_directory, study.pseudoname);
 
-    // Basic Application Confidentiality Profile
-    this->anonymizeBasicProfile();
+  if (m_output_format != O_FILES) {
+    // members keep the <pseudoname>/DICOM/ layout inside the container
+    study.archive = std::make_unique<StudyArchiveWriter>(m_output_format);
+    return study.archive->open(
+        fmt::format("{}{}", study.output_study_dir,
+                    StudyArchiveWriter::extension(m_output_format)));
+  }
 
-    // Retain Patient Characteristics Option
-    if (methods.contains(M_113108)) {
-      // clean some patient characteristics tags, others are kept as is
-      m_dataset->putAndInsertString(DCM_Allergies, "");
-      m_dataset->putAndInsertString(DCM_PatientState, "");
-      m_dataset->putAndInsertString(DCM_PreMedication, "");
-      m_dataset->putAndInsertString(DCM_SpecialNeeds, "");
-    } else {
-      // remove patient characteristics tags
-      this->anonymizePatientCharacteristicsProfile();
-    }
+  if (std::filesystem::exists(study.output_study_dir)) {
+    FNO_LOG_INFO("directory `{}` exists, {}", study.output_study_dir,
+                 m_journal.findStudy(study_dir) != nullptr
+                     ? "resuming"
+                     : "overwriting files");
+  } else {
+    std::filesystem::create_directories(study.output_study_dir + "/DICOM");
+    FNO_LOG_INFO("created directory `{}`", study.output_study_dir);
+  }
+
+  return EC_Normal;
+}
 
-    if (!methods.contains(M_113109)) {
-      this->anonymizeDeviceProfile();
+OFCondition StudyAnonymizer::anonymizeFile(
+    StudyContext &study, const std::string &file, unsigned int file_index,
+    const std::string &uid_root, std::vector<char> *member,
+    MemoryBudget::Lease *lease, AsyncFileIO::WriteCallback *on_written) const {
+
+  const std::string &study_dir = study.study_key;
+
+  JournalFileRecord record{};
+  bool unchanged{false};
+  if (m_journal.isOpen() && member != nullptr) {
+    // archive members have no mtime of their own, the content decides
+    record.size = member->size();
+    const JournalFileRecord *previous = m_journal.findFile(file);
+    if (previous != nullptr && previous->size == record.size) {
+      Sha256 sha{};
+      sha.update(member->data(), member->size());
+      record.sha256 = Sha256::toHex(sha.finish());
+      unchanged = record.sha256 == previous->sha256;
     }
-    // Retain Institution Identity Option
-    if (!methods.contains(M_113112)) {
-      this->anonymizeInstitutionProfile();
+  } else if (m_journal.isOpen()) {
+    unchanged = m_journal.isUnchanged(file, record);
+  }
+  if (unchanged) {
+    FNO_LOG_DEBUG("skipping unchanged file `{}`", file);
+    ++study.files_skipped;
+    m_metrics.add(C_FILES_SKIPPED);
+
+    // same content under a new mtime, journal it so the next run skips the
+    // hashing
+    if (!record.sha256.empty() && member == nullptr) {
+      JournalFileRecord updated = *m_journal.findFile(file);
+      updated.mtime = record.mtime;
+      m_journal.recordFile(study_dir, file, updated);
     }
+    if (m_async_io && member == nullptr)
+      m_async_io->discard(file);
+    return EC_Normal;
+  }
 
-    std::string oldSeriesUID{};
-    m_dataset->findAndGetOFString(DCM_SeriesInstanceUID, oldSeriesUID);
+  const RunMetrics::StageTimer fileTimer{m_metrics, S_FILE};
 
-    const std::string newSeriesUID =
-        this->getSeriesUids(oldSeriesUID, uid_root.c_str());
-    m_dataset->putAndInsertString(DCM_SeriesInstanceUID, newSeriesUID.c_str());
+  // over its share of the budget: loaded from disk without large values,
+  // which are copied from the input when the output is written
+  const bool large = lease != nullptr && member == nullptr &&
+                     this->isLargeFile(lease->size());
 
-    char newSOPInstanceUID[65];
-    dcmGenerateUniqueIdentifier(newSOPInstanceUID, uid_root.c_str());
-    m_dataset->putAndInsertOFStringArray(DCM_SOPInstanceUID, newSOPInstanceUID);
+  // every file gets its own fileformat so that workers never share a dataset
+  DcmFileFormat fileformat{};
+  PassThroughRange passThrough{};
+  std::vector<char> input{}; // whole input when read by the I/O backend
+  OFCondition cond{};
+  {
+    const RunMetrics::StageTimer timer{m_metrics, S_LOAD};
+    if (member != nullptr) {
+      input = std::move(*member);
+      cond = this->loadFileFromMemory(file, input.data(), input.size(),
+                                      fileformat, passThrough);
+    } else if (m_async_io && !large) {
+      // prefetched when discovery queued the file
+      cond = m_async_io->take(file, input);
+      if (cond.good())
+        cond = this->loadFileFromMemory(file, input.data(), input.size(),
+                                        fileformat, passThrough);
+    } else {
+      cond = this->loadDicomFile(file, fileformat, passThrough, large);
+    }
+  }
+  if (cond.bad()) {
+    FNO_LOG_ERROR("unable to load file {}", file);
+    FNO_LOG_ERROR("{}", cond.text());
+    m_metrics.add(C_FILES_FAILED);
+    return cond;
+  }
+  if (large) {
+    m_metrics.add(C_FILES_STREAMED);
+    // an archive member is still serialized in memory as a whole
+    if (!study.archive)
+      lease->shrink(loadedValueBytes(fileformat.getDataset()));
+  }
 
-    m_dataset->putAndInsertOFStringArray(DCM_StudyInstanceUID, newStudyUID);
+  if (!input.empty()) {
+    m_metrics.add(C_BYTES_READ, input.size());
+  } else {
+    std::error_code ec{};
+    const std::uintmax_t size = std::filesystem::file_size(file, ec);
+    if (!ec)
+      m_metrics.add(C_BYTES_READ, size);
+  }
 
-    cond = this->removeInvalidTags();
+  DcmDataset *dataset = fileformat.getDataset();
+
+  // dicom tags anonymization specification
+  // https://dicom.nema.org/medical/dicom/current/output/chtml/part15/chapter_E.html
+  // deidentification methods explained
+  // https://dicom.nema.org/medical/dicom/current/output/chtml/part16/sect_CID_7050.html
+
+  // pass-through and large values are not in memory and are not encoded
+  const DatasetStudy datasetStudy{
+      study.pseudoname, study.new_studyuid,
+      [&study, &uid_root](const std::string &old_series_uid) {
+        return getSeriesUids(study, old_series_uid, uid_root.c_str());
+      }};
+  AnonymizedDataset anonymized{};
+  cond = m_dataset_anonymizer.process(dataset, datasetStudy,
+                                      !passThrough.enabled && !large,
+                                      m_metrics, anonymized, file);
+  if (cond.good())
+    cond = fileformat.getMetaInfo()->putAndInsertString(
+        DCM_MediaStorageSOPInstanceUID,
+        anonymized.new_sop_instance_uid.c_str());
+  if (cond.bad()) {
+    m_metrics.add(C_FILES_FAILED);
+    return cond;
+  }
 
-    cond = this->writeDicomFile();
+  // modified inputs overwrite their previous output, new ones must not
+  // take the output of another journaled input
+  std::string path{};
+  if (const JournalFileRecord *previous = m_journal.findFile(file)) {
+    path = previous->output_path;
+  } else {
+    path = this->outputFilePath(study, dataset, file_index);
+    const std::string base = path;
+    for (unsigned int n = 1; m_journal.isOutputTaken(path); ++n)
+      path = fmt::format("{}_{}", base, n);
+  }
 
+  // input hash for the journal, from memory when the file was read ahead
+  if (m_journal.isOpen() && record.sha256.empty() && !input.empty()) {
+    Sha256 sha{};
+    sha.update(input.data(), input.size());
+    record.sha256 = Sha256::toHex(sha.finish());
+  }
+  record.output_path = path;
+  record.old_series_uid = anonymized.old_series_uid;
+  record.new_series_uid = anonymized.new_series_uid;
+
+  const RunMetrics::StageTimer timer{m_metrics, S_WRITE};
+  if (study.archive) {
+    // path is the member name below the output directory
+    std::vector<char> output{};
+    std::uint64_t stored{0};
+    cond = this->encodeDicomFile(fileformat, passThrough, input, output);
+    if (cond.good())
+      cond = study.archive->add(
+          fmt::format("{}{}", study.pseudoname,
+                      path.substr(study.output_study_dir.size())),
+          output, &stored);
     if (cond.bad()) {
-      OFLOG_ERROR(mainLogger, "error while processing study `"
-                                  << input_study_directory.stem().string()
-                                  << "`, skipping to next study");
-      OFLOG_ERROR(mainLogger, cond.text());
+      FNO_LOG_ERROR("error writing `{}` to archive", path);
+      FNO_LOG_ERROR("{}", cond.text());
+      m_metrics.add(C_FILES_FAILED);
       return cond;
     }
+    m_metrics.add(C_FILES);
+    m_metrics.add(C_BYTES_WRITTEN, stored);
+    this->journalFile(study_dir, file, record);
+    return cond;
   }
 
-  // TODO: add in future?
-  //  this->writeTags();
-  fmt::print("finished anonymization of {}\n", m_old_id);
+  if (m_async_io && !large) {
+    // the output is journaled only once it is on disk
+    cond = this->writeDicomFileAsync(
+        path, fileformat, passThrough, input,
+        lease != nullptr ? std::move(*lease) : MemoryBudget::Lease{},
+        [this, study_dir, file, record,
+         done = on_written != nullptr ? std::exchange(*on_written, nullptr)
+                                      : AsyncFileIO::WriteCallback{}](
+            const OFCondition &write_cond) {
+          if (write_cond.bad()) {
+            FNO_LOG_ERROR("error writing file `{}`", record.output_path);
+            FNO_LOG_ERROR("{}", write_cond.text());
+            m_metrics.add(C_FILES_FAILED);
+          } else {
+            m_metrics.add(C_FILES);
+            this->journalFile(study_dir, file, record);
+          }
+          if (done)
+            done(write_cond);
+        });
+    if (cond.bad())
+      m_metrics.add(C_FILES_FAILED);
+    return cond;
+  }
+
+  cond = this->writeDicomFile(path, fileformat, passThrough,
+                              input.empty() ? nullptr : &input, large);
+  if (cond.bad()) {
+    m_metrics.add(C_FILES_FAILED);
+    return cond;
+  }
+
+  m_metrics.add(C_FILES);
+  std::error_code ec{};
+  const std::uintmax_t written = std::filesystem::file_size(path, ec);
+  if (!ec)
+    m_metrics.add(C_BYTES_WRITTEN, written);
+  this->journalFile(study_dir, file, record);
   return cond;
 }
 
-void StudyAnonymizer::anonymizeBasicProfile() {
-  // basic patient tags
-  m_dataset->putAndInsertOFStringArray(DCM_PatientName, m_pseudoname);
-  m_dataset->putAndInsertOFStringArray(DCM_PatientID, m_pseudoname);
-  m_dataset->putAndInsertString(DCM_PatientSex, "O");
-  m_dataset->findAndDeleteElement(DCM_PatientAddress);
-  m_dataset->findAndDeleteElement(DCM_AdditionalPatientHistory);
-  m_dataset->findAndDeleteElement(DCM_PatientInstitutionResidence);
-
-  // other institution staff - operator, physicians
-  m_dataset->putAndInsertString(DCM_ConsultingPhysicianName, "");
-  m_dataset->findAndDeleteElement(
-      DCM_ConsultingPhysicianIdentificationSequence);
-  m_dataset->findAndDeleteElement(DCM_OperatorsName);
-  m_dataset->findAndDeleteElement(DCM_NameOfPhysiciansReadingStudy);
-  m_dataset->findAndDeleteElement(DCM_PerformingPhysicianName);
-  m_dataset->findAndDeleteElement(
-      DCM_PerformingPhysicianIdentificationSequence);
-  m_dataset->findAndDeleteElement(DCM_PhysiciansOfRecord);
-  m_dataset->findAndDeleteElement(DCM_PhysiciansOfRecordIdentificationSequence);
-  m_dataset->findAndDeleteElement(DCM_ReferringPhysicianName);
-  m_dataset->findAndDeleteElement(DCM_ReferringPhysicianAddress);
-  m_dataset->findAndDeleteElement(DCM_ReferringPhysicianIdentificationSequence);
-  m_dataset->findAndDeleteElement(DCM_ReferringPhysicianTelephoneNumbers);
-  m_dataset->findAndDeleteElement(DCM_RequestingPhysician);
-  m_dataset->findAndDeleteElement(DCM_ScheduledPerformingPhysicianName);
-  m_dataset->findAndDeleteElement(
-      DCM_ScheduledPerformingPhysicianIdentificationSequence);
-};
+void StudyAnonymizer::journalFile(const std::string &study_dir,
+                                  const std::string &file,
+                                  JournalFileRecord record) const {
+  if (!m_journal.isOpen())
+    return;
 
-void StudyAnonymizer::anonymizePatientCharacteristicsProfile() {
-  m_dataset->findAndDeleteElement(DCM_Allergies);
-  m_dataset->findAndDeleteElement(DCM_PatientAge);
-  m_dataset->findAndDeleteElement(DCM_PatientSexNeutered);
-  m_dataset->findAndDeleteElement(DCM_PatientSize);
-  m_dataset->findAndDeleteElement(DCM_PatientWeight);
-  m_dataset->findAndDeleteElement(DCM_PatientState);
-  m_dataset->findAndDeleteElement(DCM_PregnancyStatus);
-  m_dataset->findAndDeleteElement(DCM_PreMedication);
-  m_dataset->findAndDeleteElement(DCM_SmokingStatus);
-  m_dataset->findAndDeleteElement(DCM_SpecialNeeds);
-};
+  if (record.sha256.empty() && sha256File(file, record.sha256).bad()) {
+    FNO_LOG_WARN("unable to hash `{}`, not journaled", file);
+    return;
+  }
+  m_journal.recordFile(study_dir, file, record);
+}
 
-void StudyAnonymizer::anonymizeInstitutionProfile() {
-  m_dataset->findAndDeleteElement(DCM_InstitutionAddress);
-  m_dataset->findAndDeleteElement(DCM_InstitutionName);
-  m_dataset->findAndDeleteElement(DCM_InstitutionalDepartmentName);
-  m_dataset->findAndDeleteElement(DCM_InstitutionalDepartmentTypeCodeSequence);
-  m_dataset->findAndDeleteElement(DCM_InstitutionCodeSequence);
-};
+OFCondition StudyAnonymizer::loadDicomFile(const std::string &file,
+                                           DcmFileFormat &fileformat,
+                                           PassThroughRange &pass_through,
+                                           bool keep_large_values) const {
+  pass_through = PassThroughRange{};
+
+  // parsing from memory reads every value, DCMTK's file stream leaves values
+  // above DCM_MaxReadLength in the file
+  if (m_mmap_input && !keep_large_values) {
+    // the mapping only has to outlive parsing, DCMTK copies element values
+    MappedFile mapped{};
+    OFCondition cond = mapped.open(file, m_mmap_huge_pages);
+    if (cond.good())
+      return this->loadFileFromMemory(file, mapped.data(), mapped.size(),
+                                      fileformat, pass_through);
+
+    FNO_LOG_DEBUG("unable to map `{}` ({}), reading file", file, cond.text());
+  }
 
-void StudyAnonymizer::anonymizeDeviceProfile() {
-  m_dataset->findAndDeleteElement(DCM_DeviceDescription);
-  m_dataset->findAndDeleteElement(DCM_DeviceLabel);
-  m_dataset->findAndDeleteElement(DCM_DeviceSerialNumber);
-  m_dataset->findAndDeleteElement(DCM_ManufacturerDeviceIdentifier);
-  m_dataset->findAndDeleteElement(DCM_PerformedStationName);
-  m_dataset->findAndDeleteElement(DCM_PerformedStationNameCodeSequence);
-  m_dataset->findAndDeleteElement(DCM_ScheduledStationName);
-  m_dataset->findAndDeleteElement(DCM_ScheduledStationNameCodeSequence);
-  m_dataset->findAndDeleteElement(DCM_SourceManufacturer);
-  m_dataset->findAndDeleteElement(DCM_SourceSerialNumber);
-  m_dataset->findAndDeleteElement(DCM_StationName);
-};
+  if (!m_stream_pixel_data)
+    return fileformat.loadFile(file);
+
+  // parse only the bytes in front of (7FE0,0010), the rest of the file is
+  // appended to the output unchanged by writeDicomFile(), so it has to hold
+  // the pixel data only, elements behind it would escape anonymization
+  DicomProbe probe{file};
+  DicomProbeResult result{};
+  OFCondition cond = probe.probe({}, DCM_PixelData, result);
+  if (cond.good() && result.stop_tag_last) {
+    std::vector<char> header(static_cast<std::size_t>(result.stop_offset));
+    std::ifstream input{file, std::ios::in | std::ios::binary};
+    input.read(header.data(), static_cast<std::streamsize>(header.size()));
+
+    if (input.gcount() == static_cast<std::streamsize>(header.size())) {
+      cond = readFileFormatFromBuffer(fileformat, header.data(), header.size());
+      if (cond.good()) {
+        pass_through = PassThroughRange{file, result.stop_offset, true};
+        return cond;
+      }
+    }
+  }
 
-void StudyAnonymizer::setPseudoname() {
-
-  if (m_pseudoname_type == P_RANDOM_STRING) {
-    m_pseudoname =
-        fmt::format("{}{}", m_pseudoname_prefix, generate_random_string());
-  } else if (m_pseudoname_type == P_INTEGER_ORDER) {
-    m_pseudoname = fmt::format("{0}{1:0{2}}", m_pseudoname_prefix,
-                               m_study_count, m_count_width);
-    ++m_study_count;
-  } else if (m_pseudoname_type == P_FROM_FILE) {
-    if (m_id_pseudoname_map.contains(m_old_id)) {
-      m_pseudoname = fmt::format("{}{}", m_pseudoname_prefix,
-                                 m_id_pseudoname_map[m_old_id]);
-      return;
+  FNO_LOG_DEBUG("pixel data pass-through not possible for `{}`, loading "
+                "whole file",
+                file);
+  return fileformat.loadFile(file);
+}
+
+OFCondition
+StudyAnonymizer::loadFileFromMemory(const std::string &file, const char *data,
+                                    std::size_t size, DcmFileFormat &fileformat,
+                                    PassThroughRange &pass_through) const {
+  if (m_stream_pixel_data) {
+    // header is parsed straight from memory, pixel data is never touched
+    DicomProbe probe{data, size};
+    DicomProbeResult result{};
+    OFCondition cond = probe.probe({}, DCM_PixelData, result);
+    if (cond.good() && result.stop_tag_last) {
+      cond = readFileFormatFromBuffer(
+          fileformat, data, static_cast<std::size_t>(result.stop_offset));
+      if (cond.good()) {
+        pass_through = PassThroughRange{file, result.stop_offset, true};
+        return cond;
+      }
     }
 
-    m_pseudoname = fmt::format("{}{}_{}", m_pseudoname_prefix, "UN",
-                               generate_random_string());
-    OFLOG_WARN(mainLogger,
-               "ID " << m_old_id << " not in PatientID-pseudoname file");
-    OFLOG_WARN(mainLogger, "generated random string instead "
-                               << m_old_id << " -> " << m_pseudoname);
+    FNO_LOG_DEBUG("pixel data pass-through not possible for `{}`, parsing "
+                  "whole file",
+                  file);
   }
-};
 
-std::string StudyAnonymizer::getSeriesUids(const std::string &old_series_uid,
+  return readFileFormatFromBuffer(fileformat, data, size);
+}
+
+void StudyAnonymizer::setupIoBackend(E_IO_BACKEND backend,
+                                     unsigned int queue_depth) {
+  m_async_io = AsyncFileIO::create(backend, queue_depth);
+  m_prefetch_depth = queue_depth;
+}
+
+void StudyAnonymizer::setMemoryBudget(std::uint64_t bytes) {
+  m_memory_budget.setLimit(bytes);
+  // discovery keeps up to two files per worker in flight
+  m_large_file_size = bytes / (2 * std::uint64_t{std::max(1U, m_jobs)});
+}
+
+OFCondition StudyAnonymizer::setup(const AnonymizerOptions &options) {
+  return m_dataset_anonymizer.setup(options);
+}
+
+OFCondition StudyAnonymizer::openJournal(const std::string &output_directory,
+                                         bool resume) {
+  return m_journal.open(output_directory, resume);
+}
+
+std::string StudyAnonymizer::getSeriesUids(StudyContext &study,
+                                           const std::string &old_series_uid,
                                            const char *root) {
 
   // add old-new series uid map if there isn't one
   // otherwise return existing new uid
-  if (!m_series_uids.contains(old_series_uid)) {
+  const std::lock_guard lock{study.series_uids_mutex};
+  if (!study.series_uids.contains(old_series_uid)) {
     char uid[65];
     dcmGenerateUniqueIdentifier(uid, root);
-    m_series_uids[old_series_uid] = std::string(uid);
+    study.series_uids[old_series_uid] = std::string(uid);
   }
 
-  return m_series_uids[old_series_uid];
+  return study.series_uids[old_series_uid];
 };
 
-OFCondition StudyAnonymizer::removeInvalidTags() const {
-
-  OFCondition cond{};
-  // sanity check
-  if (m_dataset == nullptr) {
-    cond = {0, 0, OF_error, "dataset is nullptr"};
-    OFLOG_ERROR(mainLogger, cond.text());
+OFCondition StudyAnonymizer::setBasicTags(StudyContext &study,
+                                          const std::string &file) const {
+  const RunMetrics::StageTimer timer{m_metrics, S_PROBE};
+
+  // walk element headers only up to StudyInstanceUID, the last needed tag,
+  // instead of parsing the whole (possibly multi-GB) first file
+  DicomProbe probe{file};
+  DicomProbeResult result{};
+  OFCondition cond = probe.probe({DCM_StudyDate, DCM_PatientName,
+                                  DCM_PatientID, DCM_StudyInstanceUID},
+                                 DCM_UndefinedTagKey, result);
+  if (cond.good()) {
+    // first value only, same as findAndGetOFString()
+    const auto firstValue = [&result](const DcmTagKey &tag) {
+      const std::string &value = result.values[tag];
+      return value.substr(0, value.find('\\'));
+    };
+    study.old_id = firstValue(DCM_PatientID);
+    study.old_name = firstValue(DCM_PatientName);
+    study.old_studyuid = firstValue(DCM_StudyInstanceUID);
+    study.study_date = firstValue(DCM_StudyDate);
     return cond;
   }
 
-  for (unsigned long i = 0; i < m_dataset->card(); ++i) {
-    const DcmElement *element = m_dataset->getElement(i);
-    DcmTag tag = element->getTag();
-    const DcmTagKey tagKey = DcmTagKey(element->getGTag(), element->getETag());
-    const std::string tagName = tag.getTagName();
-    if (tagName == "Unknown Tag & Data") {
-      m_dataset->findAndDeleteElement(tagKey);
-      --i; // decrement due to deleting total number of tags
-    }
-  }
+  FNO_LOG_DEBUG("header probe failed for `{}` ({}), parsing with dcmtk", file,
+                cond.text());
 
+  DcmFileFormat fileformat{};
+  cond = fileformat.loadFileUntilTag(file, EXS_Unknown, EGL_noChange,
+                                     DCM_MaxReadLength, ERM_autoDetect,
+                                     DCM_SeriesInstanceUID);
   if (cond.bad()) {
-    OFLOG_ERROR(mainLogger, "error while removing invalid tags");
+    FNO_LOG_ERROR("unable to load file {}", file);
+    FNO_LOG_ERROR("{}", cond.text());
+    return cond;
   }
 
+  DcmDataset *ds = fileformat.getDataset();
+  ds->findAndGetOFString(DCM_PatientID, study.old_id);
+  ds->findAndGetOFString(DCM_PatientName, study.old_name);
+  ds->findAndGetOFString(DCM_StudyInstanceUID, study.old_studyuid);
+  ds->findAndGetOFString(DCM_StudyDate, study.study_date);
   return cond;
-};
+}
 
-OFCondition StudyAnonymizer::setBasicTags() {
-  OFCondition cond = m_fileformat.loadFile(m_dicom_files[0].c_str());
-  if (cond.bad()) {
-    OFLOG_ERROR(mainLogger, "unable to load file " << m_dicom_files[0].c_str());
-    OFLOG_ERROR(mainLogger, cond.text());
-    return cond;
+std::string StudyAnonymizer::outputFilePath(const StudyContext &study,
+                                            DcmDataset *dataset,
+                                            unsigned int file_index) const {
+  std::string path = fmt::format("{}/DICOM/", study.output_study_dir);
+  switch (m_filename_type) {
+  case F_HEX:
+    path += fmt::format("{:08X}", file_index);
+    break;
+  case F_MODALITY_SOPINSTUID: {
+    std::string modality{}, sopInstanceUid{};
+    dataset->findAndGetOFString(DCM_Modality, modality);
+    dataset->findAndGetOFString(DCM_SOPInstanceUID, sopInstanceUid);
+    path += fmt::format("{}{}", modality, sopInstanceUid);
+    break;
   }
-
-  DcmDataset *ds = m_fileformat.getDataset();
-  ds->findAndGetOFString(DCM_PatientID, m_old_id);
-  ds->findAndGetOFString(DCM_PatientName, m_old_name);
-  ds->findAndGetOFString(DCM_StudyInstanceUID, m_old_studyuid);
-  ds->findAndGetOFString(DCM_StudyDate, m_study_date);
-  ds = nullptr;
-  m_fileformat.clear();
-  return cond;
+  }
+  return path;
 }
 
 OFCondition
-StudyAnonymizer::readPseudonamesFromFile(const std::string &filename) {
+StudyAnonymizer::writeDicomFile(const std::string &path,
+                                DcmFileFormat &fileformat,
+                                const PassThroughRange &pass_through,
+                                const std::vector<char> *input,
+                                bool keep_large_values) const {
   OFCondition cond{};
 
-  std::ifstream file{filename, std::ios::in};
-  if (!file.is_open()) {
-    OFCondition cond{0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error,
-                     "error reading file with pseudonames"};
-    OFLOG_ERROR(mainLogger, cond.text());
+  if (pass_through.enabled && input != nullptr) {
+    // the pass-through source is in memory (read ahead or archive member)
+    std::vector<char> output{};
+    cond = this->encodeDicomFile(fileformat, pass_through, *input, output);
+    if (cond.good())
+      cond = writeWholeFile(path, output);
+    if (cond.bad()) {
+      FNO_LOG_ERROR("error writing file `{}`", path);
+      FNO_LOG_ERROR("{}", cond.text());
+    }
     return cond;
   }
 
-  std::string line{};
-  while (std::getline(file, line)) {
-
-    std::erase_if(line, ::isspace);
-    const std::size_t delimiter_pos = line.find(',');
-    std::string patient_id = line.substr(0, delimiter_pos);
-    const std::string pseudoname = line.substr(delimiter_pos + 1);
-
-    // correct PatientID formatting
-    std::erase(patient_id, '/');
-    std::erase_if(patient_id, ::isalpha);
-
-    if (!m_id_pseudoname_map.contains(patient_id)) {
-      m_id_pseudoname_map.emplace(patient_id, pseudoname);
-    }
+  DcmDataset *dataset = fileformat.getDataset();
+  const E_TransferSyntax xfer = dataset->getCurrentXfer();
+  dataset->chooseRepresentation(xfer, nullptr);
+  // values left in the input are copied in chunks by DCMTK's write cache
+  if (!pass_through.enabled && !keep_large_values)
+    fileformat.loadAllDataIntoMemory();
+
+  if (pass_through.enabled) {
+    // header keeps the input encoding so the copied tail stays valid, group
+    // lengths are dropped as they would no longer match
+    cond = fileformat.saveFile(path, xfer, EET_UndefinedLength, EGL_withoutGL);
+    if (cond.good())
+      cond = appendFileRange(pass_through.source, pass_through.offset, path);
+  } else {
+    cond = fileformat.saveFile(path, xfer);
   }
-  file.close();
-  OFLOG_INFO(mainLogger,
-             "found " << static_cast<unsigned int>(m_id_pseudoname_map.size())
-                      << " PatientID-pseudoname pairs to apply");
 
+  if (cond.bad()) {
+    FNO_LOG_ERROR("error writing file `{}`", path);
+    FNO_LOG_ERROR("{}", cond.text());
+  }
   return cond;
 };
 
-OFCondition StudyAnonymizer::writeDicomFile() {
-  OFCondition cond{};
-
-  const E_TransferSyntax xfer = m_dataset->getCurrentXfer();
-  m_dataset->chooseRepresentation(xfer, nullptr);
-  m_fileformat.loadAllDataIntoMemory();
-
-  std::string path = fmt::format("{}/DICOM/", m_output_study_dir);
-  switch (m_filename_type) {
-  case F_HEX:
-    path += fmt::format("{:08X}", m_files_processed);
-    ++m_files_processed;
-    break;
-  case F_MODALITY_SOPINSTUID: {
-    std::string modality{}, sopInstanceUid{};
-    m_dataset->findAndGetOFString(DCM_Modality, modality);
-    m_dataset->findAndGetOFString(DCM_SOPInstanceUID, sopInstanceUid);
-    path += fmt::format("{}{}", modality, sopInstanceUid);
-    break;
-  }
+OFCondition StudyAnonymizer::writeDicomFileAsync(
+    const std::string &path, DcmFileFormat &fileformat,
+    const PassThroughRange &pass_through, const std::vector<char> &input,
+    MemoryBudget::Lease lease, AsyncFileIO::WriteCallback on_written) const {
+  // serialized here, on the worker, the backend only moves bytes
+  std::vector<char> output{};
+  const OFCondition cond =
+      this->encodeDicomFile(fileformat, pass_through, input, output);
+  if (cond.bad()) {
+    FNO_LOG_ERROR("error writing file `{}`", path);
+    FNO_LOG_ERROR("{}", cond.text());
+    return cond;
   }
 
-  cond = m_fileformat.saveFile(path, xfer);
+  // the budget is returned once the queued output is on disk, not before
+  const std::size_t size = output.size();
+  lease.grow(size);
+  auto held = std::make_shared<MemoryBudget::Lease>(std::move(lease));
+  m_async_io->write(path, std::move(output),
+                    [this, size, held, on_written = std::move(on_written)](
+                        const OFCondition &write_cond) {
+                      if (write_cond.good())
+                        m_metrics.add(C_BYTES_WRITTEN, size);
+                      on_written(write_cond);
+                      held->shrink(0);
+                    });
+  return EC_Normal;
+}
 
-  if (cond.bad()) {
-    OFLOG_ERROR(mainLogger, "error writing file `" << path << "`");
-    OFLOG_ERROR(mainLogger, cond.text());
+OFCondition StudyAnonymizer::encodeDicomFile(
+    DcmFileFormat &fileformat, const PassThroughRange &pass_through,
+    const std::vector<char> &input, std::vector<char> &output) const {
+  DcmDataset *dataset = fileformat.getDataset();
+  const E_TransferSyntax xfer = dataset->getCurrentXfer();
+  dataset->chooseRepresentation(xfer, nullptr);
+
+  if (!pass_through.enabled)
+    return writeFileFormatToBuffer(fileformat, xfer, EET_UndefinedLength,
+                                   EGL_recalcGL, output);
+
+  OFCondition cond = writeFileFormatToBuffer(fileformat, xfer,
+                                             EET_UndefinedLength,
+                                             EGL_withoutGL, output);
+  if (cond.good() && input.empty()) {
+    // not read ahead, the tail is still in the input file
+    cond = readFileRange(pass_through.source, pass_through.offset, output);
+  } else if (cond.good() && pass_through.offset <= input.size()) {
+    output.insert(output.end(),
+                  input.begin() +
+                      static_cast<std::ptrdiff_t>(pass_through.offset),
+                  input.end());
   }
   return cond;
-};
+}
 
-OFCondition StudyAnonymizer::writeTags() const {
-  std::ofstream csvfile{m_output_study_dir + "/tags.csv", std::ios::out};
+OFCondition StudyAnonymizer::writeTags(const StudyContext &study) const {
+  std::ofstream csvfile{study.output_study_dir + "/tags.csv", std::ios::out};
   if (!csvfile.is_open()) {
-    OFLOG_ERROR(mainLogger, "error while creating `tags.csv`");
+    FNO_LOG_ERROR("error while creating `tags.csv`");
     return {0, 0, OF_error, "error while creating `tags.csv`"};
   }
 
   csvfile << "PatientID,PatientName,Pseudoname,StudyInstanceUID,StudyDate\n";
-  csvfile << fmt::format("{},{},{},{},{}\n", m_old_id, m_old_name, m_pseudoname,
-                         m_old_studyuid, m_study_date);
+  csvfile << fmt::format("{},{},{},{},{}\n", study.old_id, study.old_name,
+                         study.pseudoname, study.old_studyuid,
+                         study.study_date);
 
   csvfile.close();
   return EC_Normal;
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <string_view>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "dcmtk/dcmdata/dcelem.h"
+#include "dcmtk/dcmdata/dcistrmb.h"
+#include "dcmtk/dcmdata/dcostrmb.h"
+#include "dcmtk/dcmdata/dcwcache.h"
+
+#include "DicomIO.hpp"
+
+OFCondition readFileFormatFromBuffer(DcmFileFormat &fileformat,
+                                     const char *data, std::size_t size) {
+  DcmInputBufferStream stream{};
+  stream.setBuffer(data, static_cast<offile_off_t>(size));
+  stream.setEos();
+
+  fileformat.clear();
+  fileformat.transferInit();
+  OFCondition cond = fileformat.read(stream);
+  fileformat.transferEnd();
+  stream.releaseBuffer();
+  return cond;
+}
+
+OFCondition writeFileFormatToBuffer(DcmFileFormat &fileformat,
+                                    E_TransferSyntax xfer,
+                                    E_EncodingType encoding,
+                                    E_GrpLenEncoding group_length,
+                                    std::vector<char> &buffer) {
+  // DCMTK fills a fixed block and asks to drain it whenever it is full
+  std::vector<char> block(1 << 20);
+  DcmOutputBufferStream stream{block.data(),
+                               static_cast<offile_off_t>(block.size())};
+  buffer.clear();
+
+  const auto drain = [&stream, &buffer]() {
+    void *data = nullptr;
+    offile_off_t length = 0;
+    stream.flushBuffer(data, length);
+    const char *bytes = static_cast<const char *>(data);
+    buffer.insert(buffer.end(), bytes, bytes + length);
+  };
+
+  DcmWriteCache cache{};
+  OFCondition cond{};
+  fileformat.transferInit();
+  while ((cond = fileformat.write(stream, xfer, encoding, &cache,
+                                  group_length)) == EC_StreamNotifyClient) {
+    drain();
+  }
+  fileformat.transferEnd();
+  drain();
+  return cond;
+}
+
+std::uint64_t loadedValueBytes(DcmObject *object) {
+  if (object->isLeaf()) {
+    const auto *element = static_cast<DcmElement *>(object);
+    return element->valueLoaded() ? object->getLength() : 0;
+  }
+  std::uint64_t bytes{0};
+  DcmObject *child = nullptr;
+  while ((child = object->nextInContainer(child)) != nullptr)
+    bytes += loadedValueBytes(child);
+  return bytes;
+}
+
+bool hasDicomMagic(const std::string &filename) {
+  std::ifstream file{filename, std::ios::in | std::ios::binary};
+  char header[132]{};
+  if (!file.read(header, sizeof(header)))
+    return false;
+  return std::string_view{header + 128, 4} == "DICM";
+}
+
+OFCondition readFileRange(const std::string &source, std::uint64_t offset,
+                          std::vector<char> &buffer) {
+  std::ifstream in{source, std::ios::in | std::ios::binary | std::ios::ate};
+  const std::streamoff end = in.tellg();
+  if (!in.is_open() || end < static_cast<std::streamoff>(offset))
+    return {0, 0, OF_error, "unable to open file for pass-through copy"};
+
+  const std::size_t start = buffer.size();
+  buffer.resize(start + static_cast<std::size_t>(end - offset));
+  in.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+  in.read(buffer.data() + start, static_cast<std::streamsize>(end - offset));
+  if (in.gcount() != static_cast<std::streamsize>(end - offset))
+    return {0, 0, OF_error, "error while copying pass-through data"};
+  return EC_Normal;
+}
+
+#if defined(__linux__)
+namespace {
+class FileDescriptor {
+public:
+  explicit FileDescriptor(int fd) : m_fd{fd} {}
+  ~FileDescriptor() {
+    if (m_fd >= 0)
+      ::close(m_fd);
+  }
+  FileDescriptor(const FileDescriptor &) = delete;
+  FileDescriptor &operator=(const FileDescriptor &) = delete;
+
+  int get() const { return m_fd; }
+
+private:
+  int m_fd{-1};
+};
+} // namespace
+
+MappedFile::~MappedFile() {
+  if (m_data != nullptr && m_buffer.empty())
+    ::munmap(const_cast<char *>(m_data), m_size);
+}
+
+OFCondition MappedFile::open(const std::string &filename, bool huge_pages) {
+  const FileDescriptor fd{::open(filename.c_str(), O_RDONLY | O_CLOEXEC)};
+  struct stat info {};
+  if (fd.get() < 0 || ::fstat(fd.get(), &info) != 0)
+    return {0, 0, OF_error, "unable to open file for mapping"};
+  if (info.st_size == 0)
+    return {0, 0, OF_error, "empty file cannot be mapped"};
+
+  const std::size_t size = static_cast<std::size_t>(info.st_size);
+  void *data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+  if (data == MAP_FAILED)
+    return {0, 0, OF_error, "unable to map file"};
+
+  // hints only, failures do not matter
+  ::madvise(data, size, MADV_SEQUENTIAL);
+#if defined(MADV_HUGEPAGE)
+  if (huge_pages)
+    ::madvise(data, size, MADV_HUGEPAGE);
+#endif
+
+  m_data = static_cast<const char *>(data);
+  m_size = size;
+  return EC_Normal;
+}
+
+OFCondition appendFileRange(const std::string &source, std::uint64_t offset,
+                            const std::string &destination) {
+  const FileDescriptor in{::open(source.c_str(), O_RDONLY | O_CLOEXEC)};
+  // copy_file_range() rejects O_APPEND descriptors, seek to the end instead
+  const FileDescriptor out{::open(destination.c_str(), O_WRONLY | O_CLOEXEC)};
+  if (in.get() < 0 || out.get() < 0)
+    return {0, 0, OF_error, "unable to open file for pass-through copy"};
+
+  struct stat info {};
+  if (::fstat(in.get(), &info) != 0 || ::lseek(out.get(), 0, SEEK_END) < 0)
+    return {0, 0, OF_error, "unable to stat file for pass-through copy"};
+
+  const std::uint64_t end = static_cast<std::uint64_t>(info.st_size);
+  loff_t in_offset = static_cast<loff_t>(offset);
+  bool use_copy_file_range{true};
+
+  while (static_cast<std::uint64_t>(in_offset) < end) {
+    const std::size_t chunk = static_cast<std::size_t>(
+        std::min<std::uint64_t>(end - in_offset, 1ULL << 30));
+
+    ssize_t copied{-1};
+    if (use_copy_file_range) {
+      copied = ::copy_file_range(in.get(), &in_offset, out.get(), nullptr,
+                                 chunk, 0);
+      if (copied < 0 && (errno == EXDEV || errno == ENOSYS ||
+                         errno == EINVAL || errno == EOPNOTSUPP)) {
+        // cross filesystem or unsupported, sendfile() copies in the kernel too
+        use_copy_file_range = false;
+        continue;
+      }
+    } else {
+      off_t sendfile_offset = static_cast<off_t>(in_offset);
+      copied = ::sendfile(out.get(), in.get(), &sendfile_offset, chunk);
+      in_offset = static_cast<loff_t>(sendfile_offset);
+    }
+
+    if (copied < 0 && errno == EINTR)
+      continue;
+    if (copied <= 0)
+      return {0, 0, OF_error, "error while copying pass-through data"};
+  }
+  return EC_Normal;
+}
+#else
+MappedFile::~MappedFile() = default;
+
+OFCondition MappedFile::open(const std::string &filename, bool) {
+  std::ifstream file{filename, std::ios::in | std::ios::binary | std::ios::ate};
+  if (!file.is_open() || file.tellg() <= 0)
+    return {0, 0, OF_error, "unable to open file for mapping"};
+
+  m_buffer.resize(static_cast<std::size_t>(file.tellg()));
+  file.seekg(0, std::ios::beg);
+  file.read(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+  if (file.gcount() != static_cast<std::streamsize>(m_buffer.size()))
+    return {0, 0, OF_error, "error reading file"};
+
+  m_data = m_buffer.data();
+  m_size = m_buffer.size();
+  return EC_Normal;
+}
+
+OFCondition appendFileRange(const std::string &source, std::uint64_t offset,
+                            const std::string &destination) {
+  std::ifstream in{source, std::ios::in | std::ios::binary};
+  std::ofstream out{destination,
+                    std::ios::out | std::ios::binary | std::ios::app};
+  if (!in.is_open() || !out.is_open())
+    return {0, 0, OF_error, "unable to open file for pass-through copy"};
+
+  in.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+  std::vector<char> buffer(1 << 20);
+  while (in) {
+    in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    out.write(buffer.data(), in.gcount());
+  }
+  return out.good() ? EC_Normal
+                    : OFCondition{0, 0, OF_error,
+                                  "error while copying pass-through data"};
+}
+#endif
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+
+#include "dcmtk/dcmdata/dcuid.h"
+
+#include "DicomProbe.hpp"
+
+namespace {
+constexpr std::uint32_t UNDEFINED_LENGTH{0xFFFFFFFF};
+constexpr std::size_t MAX_VALUE_LENGTH{1024}; // longer requested values skip
+constexpr unsigned int MAX_NESTING_DEPTH{64};
+
+const DcmTagKey ITEM_TAG{0xFFFE, 0xE000};
+const DcmTagKey ITEM_DELIMITATION_TAG{0xFFFE, 0xE00D};
+const DcmTagKey SEQUENCE_DELIMITATION_TAG{0xFFFE, 0xE0DD};
+
+// explicit VRs encoded with 2 reserved bytes and a 4 byte length
+bool hasLongLength(const char *vr) {
+  static constexpr std::string_view LONG_VRS[]{"OB", "OD", "OF", "OL", "OV",
+                                               "OW", "SQ", "SV", "UC", "UN",
+                                               "UR", "UT", "UV"};
+  const std::string_view value{vr, 2};
+  return std::ranges::find(LONG_VRS, value) != std::end(LONG_VRS);
+}
+
+std::string trimValue(std::string value) {
+  while (!value.empty() && (value.back() == ' ' || value.back() == '\0'))
+    value.pop_back();
+  return value;
+}
+
+OFCondition probeError(const char *text) {
+  return {0, 0, OF_error, text};
+}
+} // namespace
+
+DicomProbe::DicomProbe(const std::string &filename)
+    : m_file{filename, std::ios::in | std::ios::binary} {
+  // seekg() past the end succeeds, skips are checked against the size
+  if (m_file.seekg(0, std::ios::end))
+    m_size = static_cast<std::size_t>(m_file.tellg());
+  m_file.seekg(0, std::ios::beg);
+}
+
+DicomProbe::DicomProbe(const char *data, std::size_t size)
+    : m_data{data}, m_size{size} {}
+
+bool DicomProbe::read(void *buffer, std::size_t size) {
+  if (m_data != nullptr) {
+    if (m_size - m_position < size)
+      return false;
+    std::memcpy(buffer, m_data + m_position, size);
+    m_position += size;
+    return true;
+  }
+
+  m_file.read(static_cast<char *>(buffer), static_cast<std::streamsize>(size));
+  return m_file.gcount() == static_cast<std::streamsize>(size);
+}
+
+bool DicomProbe::skip(std::uint64_t size) {
+  if (m_data != nullptr) {
+    if (m_size - m_position < size)
+      return false;
+    m_position += static_cast<std::size_t>(size);
+    return true;
+  }
+
+  const std::uint64_t position = this->tell();
+  if (!m_file.good() || position > m_size || size > m_size - position)
+    return false;
+  m_file.seekg(static_cast<std::streamoff>(size), std::ios::cur);
+  return m_file.good();
+}
+
+std::uint64_t DicomProbe::tell() {
+  if (m_data != nullptr)
+    return m_position;
+  return static_cast<std::uint64_t>(m_file.tellg());
+}
+
+bool DicomProbe::seek(std::uint64_t offset) {
+  if (m_data != nullptr) {
+    if (offset > m_size)
+      return false;
+    m_position = static_cast<std::size_t>(offset);
+    return true;
+  }
+
+  if (offset > m_size)
+    return false;
+  m_file.clear();
+  m_file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+  return m_file.good();
+}
+
+std::uint16_t DicomProbe::toUint16(const unsigned char *bytes) const {
+  return m_big_endian ? static_cast<std::uint16_t>(bytes[0] << 8 | bytes[1])
+                      : static_cast<std::uint16_t>(bytes[1] << 8 | bytes[0]);
+}
+
+std::uint32_t DicomProbe::toUint32(const unsigned char *bytes) const {
+  if (m_big_endian)
+    return static_cast<std::uint32_t>(bytes[0]) << 24 |
+           static_cast<std::uint32_t>(bytes[1]) << 16 |
+           static_cast<std::uint32_t>(bytes[2]) << 8 | bytes[3];
+  return static_cast<std::uint32_t>(bytes[3]) << 24 |
+         static_cast<std::uint32_t>(bytes[2]) << 16 |
+         static_cast<std::uint32_t>(bytes[1]) << 8 | bytes[0];
+}
+
+bool DicomProbe::readElementHeader(ElementHeader &header, bool explicit_vr) {
+  unsigned char bytes[8];
+  if (!this->read(bytes, 8))
+    return false;
+
+  header.tag = DcmTagKey(toUint16(bytes), toUint16(bytes + 2));
+
+  // items and delimiters never carry a VR
+  if (!explicit_vr || header.tag.getGroup() == 0xFFFE) {
+    header.length = toUint32(bytes + 4);
+    return true;
+  }
+
+  const char vr[2]{static_cast<char>(bytes[4]), static_cast<char>(bytes[5])};
+  if (hasLongLength(vr)) {
+    unsigned char length[4];
+    if (!this->read(length, 4))
+      return false;
+    header.length = toUint32(length);
+  } else {
+    header.length = toUint16(bytes + 6);
+  }
+  return true;
+}
+
+bool DicomProbe::isLastElement(const ElementHeader &header, bool explicit_vr) {
+  if (header.length == UNDEFINED_LENGTH) {
+    if (!this->skipUndefinedLength(explicit_vr, 0))
+      return false;
+  } else if (!this->skip(header.length)) {
+    return false;
+  }
+
+  // anything behind the element, padding included, has to be parsed
+  char byte{};
+  return !this->read(&byte, 1);
+}
+
+bool DicomProbe::skipUndefinedLength(bool explicit_vr, unsigned int depth) {
+  // value of undefined length: sequence items or pixel data fragments
+  if (depth > MAX_NESTING_DEPTH)
+    return false;
+
+  ElementHeader item{};
+  while (this->readElementHeader(item, explicit_vr)) {
+    if (item.tag == SEQUENCE_DELIMITATION_TAG)
+      return true;
+    if (item.tag != ITEM_TAG)
+      return false;
+
+    if (item.length != UNDEFINED_LENGTH) {
+      if (!this->skip(item.length))
+        return false;
+      continue;
+    }
+
+    // item of undefined length, walk its elements up to the delimiter
+    ElementHeader element{};
+    while (true) {
+      if (!this->readElementHeader(element, explicit_vr))
+        return false;
+      if (element.tag == ITEM_DELIMITATION_TAG)
+        break;
+      if (element.length == UNDEFINED_LENGTH) {
+        if (!this->skipUndefinedLength(explicit_vr, depth + 1))
+          return false;
+      } else if (!this->skip(element.length)) {
+        return false;
+      }
+    }
+  }
+  return false;
+}
+
+OFCondition DicomProbe::probe(const std::vector<DcmTagKey> &tags,
+                              const DcmTagKey &stop_tag,
+                              DicomProbeResult &result) {
+  result = DicomProbeResult{};
+  m_big_endian = false;
+
+  if (m_data == nullptr && !m_file.is_open())
+    return probeError("unable to open file");
+
+  char preamble[132];
+  if (!this->read(preamble, sizeof(preamble)) ||
+      std::memcmp(preamble + 128, "DICM", 4) != 0) {
+    return probeError("missing DICM preamble");
+  }
+
+  // meta header is always explicit VR little endian
+  ElementHeader header{};
+  std::uint64_t position = this->tell();
+  while (this->readElementHeader(header, true)) {
+    if (header.tag.getGroup() != 0x0002)
+      break;
+    if (header.length == UNDEFINED_LENGTH)
+      return probeError("invalid meta header");
+
+    if (header.tag == DcmTagKey(0x0002, 0x0010) &&
+        header.length < MAX_VALUE_LENGTH) {
+      std::string value(header.length, '\0');
+      if (!this->read(value.data(), value.size()))
+        return probeError("truncated meta header");
+      result.transfer_syntax = trimValue(std::move(value));
+    } else if (!this->skip(header.length)) {
+      return probeError("truncated meta header");
+    }
+    position = this->tell();
+  }
+
+  result.dataset_offset = position;
+  if (!this->seek(position))
+    return probeError("truncated meta header");
+
+  const std::string &xfer = result.transfer_syntax;
+  if (xfer == UID_DeflatedExplicitVRLittleEndianTransferSyntax)
+    return probeError("deflated transfer syntax not supported");
+
+  const bool explicit_vr = xfer != UID_LittleEndianImplicitTransferSyntax;
+  m_big_endian = xfer == UID_BigEndianExplicitTransferSyntax;
+
+  DcmTagKey last_tag = stop_tag;
+  if (stop_tag == DCM_UndefinedTagKey && !tags.empty())
+    last_tag = *std::ranges::max_element(tags);
+
+  while (true) {
+    position = this->tell();
+    if (!this->readElementHeader(header, explicit_vr)) {
+      // end of file, every element was walked
+      result.stop_offset = position;
+      return EC_Normal;
+    }
+
+    if ((stop_tag != DCM_UndefinedTagKey && header.tag >= stop_tag) ||
+        (stop_tag == DCM_UndefinedTagKey && header.tag > last_tag)) {
+      result.stop_offset = position;
+      result.stop_tag_found = header.tag == stop_tag;
+      if (result.stop_tag_found)
+        result.stop_tag_last = this->isLastElement(header, explicit_vr);
+      return EC_Normal;
+    }
+
+    const bool requested = std::ranges::find(tags, header.tag) != tags.end();
+    if (requested && header.length != UNDEFINED_LENGTH &&
+        header.length < MAX_VALUE_LENGTH) {
+      std::string value(header.length, '\0');
+      if (!this->read(value.data(), value.size()))
+        return probeError("truncated dataset");
+      result.values[header.tag] = trimValue(std::move(value));
+    } else if (header.length == UNDEFINED_LENGTH) {
+      if (!this->skipUndefinedLength(explicit_vr, 0))
+        return probeError("invalid sequence encoding");
+    } else if (!this->skip(header.length)) {
+      return probeError("truncated dataset");
+    }
+
+    if (stop_tag == DCM_UndefinedTagKey && header.tag == last_tag) {
+      result.stop_offset = this->tell();
+      return EC_Normal;
+    }
+  }
+}
@@ -0,0 +1,8 @@
+#include "MainLogger.hpp"
+
+OFLogger mainLogger = OFLog::getLogger("");
+AsyncLogger asyncLogger{};
+
+void setupLogger(std::string_view logger_name) {
+  mainLogger = OFLog::getLogger(logger_name.data());
+};
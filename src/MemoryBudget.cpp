@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <utility>
+
+#include "MemoryBudget.hpp"
+
+MemoryBudget::Lease::~Lease() { this->reset(); }
+
+MemoryBudget::Lease::Lease(Lease &&other) noexcept
+    : m_budget{std::exchange(other.m_budget, nullptr)},
+      m_bytes{std::exchange(other.m_bytes, 0)} {}
+
+MemoryBudget::Lease &MemoryBudget::Lease::operator=(Lease &&other) noexcept {
+  if (this != &other) {
+    this->reset();
+    m_budget = std::exchange(other.m_budget, nullptr);
+    m_bytes = std::exchange(other.m_bytes, 0);
+  }
+  return *this;
+}
+
+void MemoryBudget::Lease::shrink(std::uint64_t bytes) {
+  if (m_budget == nullptr || bytes >= m_bytes)
+    return;
+  m_budget->release(m_bytes - bytes);
+  m_bytes = bytes;
+}
+
+void MemoryBudget::Lease::grow(std::uint64_t bytes) {
+  // the output already exists, it is accounted for even above the limit
+  if (m_budget == nullptr || bytes <= m_bytes)
+    return;
+  m_budget->charge(bytes - m_bytes);
+  m_bytes = bytes;
+}
+
+void MemoryBudget::Lease::reset() {
+  if (m_budget != nullptr)
+    m_budget->release(m_bytes);
+  m_budget = nullptr;
+  m_bytes = 0;
+}
+
+bool MemoryBudget::fits(std::uint64_t bytes) const {
+  return m_in_flight == 0 || m_in_flight + bytes <= m_limit;
+}
+
+MemoryBudget::Lease MemoryBudget::acquire(std::uint64_t bytes) {
+  if (!this->isLimited())
+    return {};
+  std::unique_lock lock{m_mutex};
+  m_released.wait(lock, [this, bytes] { return this->fits(bytes); });
+  m_in_flight += bytes;
+  m_peak = std::max(m_peak, m_in_flight);
+  return {this, bytes};
+}
+
+MemoryBudget::Lease MemoryBudget::tryAcquire(std::uint64_t bytes) {
+  if (!this->isLimited())
+    return {};
+  const std::lock_guard lock{m_mutex};
+  if (!this->fits(bytes))
+    return {};
+  m_in_flight += bytes;
+  m_peak = std::max(m_peak, m_in_flight);
+  return {this, bytes};
+}
+
+std::uint64_t MemoryBudget::peak() const {
+  const std::lock_guard lock{m_mutex};
+  return m_peak;
+}
+
+void MemoryBudget::charge(std::uint64_t bytes) {
+  const std::lock_guard lock{m_mutex};
+  m_in_flight += bytes;
+  m_peak = std::max(m_peak, m_in_flight);
+}
+
+void MemoryBudget::release(std::uint64_t bytes) {
+  {
+    const std::lock_guard lock{m_mutex};
+    m_in_flight -= bytes;
+  }
+  m_released.notify_all();
+}
@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <latch>
+#include <mutex>
+#include <vector>
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcpixel.h"
+#include "dcmtk/dcmdata/dcpixseq.h"
+#include "dcmtk/dcmdata/dcpxitem.h"
+#include "dcmtk/dcmdata/dcrleerg.h"
+#include "dcmtk/dcmdata/dcrlerp.h"
+#include "dcmtk/dcmjpeg/djencode.h"
+#include "dcmtk/dcmjpeg/djrplol.h"
+#include "dcmtk/dcmjpls/djencode.h"
+#include "dcmtk/dcmjpls/djrparam.h"
+
+#include "PixelEncoder.hpp"
+
+namespace {
+// attributes the codecs read next to the PixelData of a frame
+struct ImagePixel {
+  Uint16 rows{0};
+  Uint16 columns{0};
+  Uint16 samples{1};
+  Uint16 allocated{0};
+  Uint16 stored{0};
+  Uint16 high{0};
+  Uint16 representation{0};
+  Uint16 planar{0};
+  OFString photometric{};
+};
+
+struct EncodedFrame {
+  OFCondition cond{};
+  std::vector<Uint8> data{};
+  OFString photometric{};
+  Uint16 planar{0};
+};
+
+OFCondition notEncoded(const char *reason) {
+  return {0, 0, OF_error, reason};
+}
+
+void registerCodecs() {
+  // registered for the rest of the process, like the decoders
+  static std::once_flag once{};
+  std::call_once(once, [] {
+    DcmRLEEncoderRegistration::registerCodecs();
+    DJLSEncoderRegistration::registerCodecs();
+    DJEncoderRegistration::registerCodecs();
+  });
+}
+
+void encodeFrame(const ImagePixel &pixel, const Uint8 *bytes,
+                 std::size_t length, E_TransferSyntax xfer,
+                 const DcmRepresentationParameter *parameter,
+                 EncodedFrame &frame) {
+  DcmDataset dataset{};
+  dataset.putAndInsertUint16(DCM_Rows, pixel.rows);
+  dataset.putAndInsertUint16(DCM_Columns, pixel.columns);
+  dataset.putAndInsertUint16(DCM_SamplesPerPixel, pixel.samples);
+  dataset.putAndInsertUint16(DCM_BitsAllocated, pixel.allocated);
+  dataset.putAndInsertUint16(DCM_BitsStored, pixel.stored);
+  dataset.putAndInsertUint16(DCM_HighBit, pixel.high);
+  dataset.putAndInsertUint16(DCM_PixelRepresentation, pixel.representation);
+  dataset.putAndInsertOFStringArray(DCM_PhotometricInterpretation,
+                                    pixel.photometric);
+  if (pixel.samples > 1)
+    dataset.putAndInsertUint16(DCM_PlanarConfiguration, pixel.planar);
+  if (pixel.allocated == 8)
+    frame.cond = dataset.putAndInsertUint8Array(
+        DCM_PixelData, bytes, static_cast<unsigned long>(length));
+  else
+    frame.cond = dataset.putAndInsertUint16Array(
+        DCM_PixelData, reinterpret_cast<const Uint16 *>(bytes),
+        static_cast<unsigned long>(length / 2));
+  if (frame.cond.bad())
+    return;
+
+  frame.cond = dataset.chooseRepresentation(xfer, parameter);
+  if (frame.cond.bad())
+    return;
+  if (!dataset.canWriteXfer(xfer)) {
+    frame.cond = notEncoded("codec refused the pixel data");
+    return;
+  }
+
+  DcmElement *element = nullptr;
+  DcmPixelSequence *sequence = nullptr;
+  frame.cond = dataset.findAndGetElement(DCM_PixelData, element);
+  if (frame.cond.good())
+    frame.cond = static_cast<DcmPixelData *>(element)
+                     ->getEncapsulatedRepresentation(xfer, parameter,
+                                                     sequence);
+  if (frame.cond.bad())
+    return;
+
+  // item 0 is the empty offset table of the single frame
+  for (unsigned long i = 1; i < sequence->card(); ++i) {
+    DcmPixelItem *item = nullptr;
+    Uint8 *fragment = nullptr;
+    frame.cond = sequence->getItem(item, i);
+    if (frame.cond.good())
+      frame.cond = item->getUint8Array(fragment);
+    if (frame.cond.bad())
+      return;
+    if (fragment != nullptr)
+      frame.data.insert(frame.data.end(), fragment,
+                        fragment + item->getLength());
+  }
+  dataset.findAndGetOFStringArray(DCM_PhotometricInterpretation,
+                                  frame.photometric);
+  dataset.findAndGetUint16(DCM_PlanarConfiguration, frame.planar);
+}
+} // namespace
+
+PixelEncoder::PixelEncoder(E_PIXEL_CODEC codec, unsigned int threads)
+    : m_codec{codec}, m_xfer{transferSyntax(codec)},
+      m_pool{std::max(1u, threads)} {
+  registerCodecs();
+  switch (m_codec) {
+  case X_RLE:
+    m_parameter = std::make_unique<DcmRLERepresentationParameter>();
+    break;
+  case X_JPEG_LS:
+    m_parameter = std::make_unique<DJLSRepresentationParameter>(0, OFTrue);
+    break;
+  case X_JPEG_LOSSLESS:
+    m_parameter = std::make_unique<DJ_RPLossless>(1, 0);
+    break;
+  case X_KEEP:
+    break;
+  }
+}
+
+PixelEncoder::~PixelEncoder() = default;
+
+E_TransferSyntax PixelEncoder::transferSyntax(E_PIXEL_CODEC codec) {
+  switch (codec) {
+  case X_RLE:
+    return EXS_RLELossless;
+  case X_JPEG_LS:
+    return EXS_JPEGLSLossless;
+  case X_JPEG_LOSSLESS:
+    return EXS_JPEGProcess14SV1;
+  case X_KEEP:
+    break;
+  }
+  return EXS_Unknown;
+}
+
+OFCondition PixelEncoder::encode(DcmDataset *dataset,
+                                 PixelEncodeResult &result) {
+  result = {};
+  DcmElement *element = nullptr;
+  if (m_codec == X_KEEP ||
+      dataset->findAndGetElement(DCM_PixelData, element).bad() ||
+      element->ident() != EVR_PixelData)
+    return EC_Normal;
+  if (DcmXfer{dataset->getCurrentXfer()}.isEncapsulated())
+    return EC_Normal;
+
+  ImagePixel pixel{};
+  long frames{1};
+  if (dataset->findAndGetUint16(DCM_Rows, pixel.rows).bad() ||
+      dataset->findAndGetUint16(DCM_Columns, pixel.columns).bad() ||
+      dataset->findAndGetUint16(DCM_BitsAllocated, pixel.allocated).bad() ||
+      dataset->findAndGetUint16(DCM_BitsStored, pixel.stored).bad() ||
+      dataset->findAndGetUint16(DCM_HighBit, pixel.high).bad() ||
+      dataset->findAndGetOFStringArray(DCM_PhotometricInterpretation,
+                                       pixel.photometric)
+          .bad())
+    return notEncoded("image pixel attributes missing");
+  dataset->findAndGetUint16(DCM_SamplesPerPixel, pixel.samples);
+  dataset->findAndGetUint16(DCM_PixelRepresentation, pixel.representation);
+  dataset->findAndGetUint16(DCM_PlanarConfiguration, pixel.planar);
+  dataset->findAndGetLongInt(DCM_NumberOfFrames, frames);
+  if (pixel.allocated != 8 && pixel.allocated != 16)
+    return notEncoded("only 8 and 16 bits allocated are encoded");
+  if (pixel.rows == 0 || pixel.columns == 0 || pixel.samples == 0 ||
+      frames < 1)
+    return notEncoded("empty image");
+
+  const std::size_t frameBytes = std::size_t{pixel.rows} * pixel.columns *
+                                 pixel.samples * (pixel.allocated / 8);
+  const std::size_t nativeBytes = frameBytes * static_cast<std::size_t>(frames);
+  auto *pixelData = static_cast<DcmPixelData *>(element);
+  const Uint8 *bytes = nullptr;
+  if (pixel.allocated == 8) {
+    Uint8 *values = nullptr;
+    if (pixelData->getUint8Array(values).good())
+      bytes = values;
+  } else {
+    Uint16 *values = nullptr;
+    if (pixelData->getUint16Array(values).good())
+      bytes = reinterpret_cast<const Uint8 *>(values);
+  }
+  if (bytes == nullptr || pixelData->getLength() < nativeBytes)
+    return notEncoded("pixel data shorter than the image");
+
+  std::vector<EncodedFrame> encoded(static_cast<std::size_t>(frames));
+  std::latch done{frames};
+  for (std::size_t i = 0; i < encoded.size(); ++i)
+    m_pool.submit([&, i] {
+      encodeFrame(pixel, bytes + i * frameBytes, frameBytes, m_xfer,
+                  m_parameter.get(), encoded[i]);
+      done.count_down();
+    });
+  done.wait();
+
+  std::uint64_t encodedBytes{0};
+  for (const EncodedFrame &frame : encoded) {
+    if (frame.cond.bad())
+      return frame.cond;
+    encodedBytes += frame.data.size();
+  }
+  if (encodedBytes >= nativeBytes)
+    return EC_Normal;
+
+  auto *sequence = new DcmPixelSequence(DcmTag{DCM_PixelSequenceTag});
+  auto *offsetTable = new DcmPixelItem(DcmTag{DCM_Item, EVR_OB});
+  sequence->insert(offsetTable);
+  DcmOffsetList offsets{};
+  for (EncodedFrame &frame : encoded) {
+    const OFCondition cond = sequence->storeCompressedFrame(
+        offsets, frame.data.data(), static_cast<Uint32>(frame.data.size()),
+        0);
+    if (cond.bad()) {
+      delete sequence;
+      return cond;
+    }
+    frame.data = {};
+  }
+  offsetTable->createOffsetTable(offsets);
+
+  // the encoded frames become the original representation, the native one
+  // is dropped and the dataset is written with the target transfer syntax
+  pixelData->putOriginalRepresentation(m_xfer, m_parameter->clone(), sequence);
+  OFCondition cond = dataset->chooseRepresentation(m_xfer, m_parameter.get());
+  if (cond.bad())
+    return cond;
+  dataset->putAndInsertOFStringArray(DCM_PhotometricInterpretation,
+                                     encoded.front().photometric);
+  if (pixel.samples > 1)
+    dataset->putAndInsertUint16(DCM_PlanarConfiguration,
+                                encoded.front().planar);
+
+  result.encoded = true;
+  result.native_bytes = nativeBytes;
+  result.encoded_bytes = encodedBytes;
+  return EC_Normal;
+}
@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcpixel.h"
+#include "dcmtk/dcmdata/dcrledrg.h"
+#include "dcmtk/dcmdata/dcxfer.h"
+#include "dcmtk/dcmjpeg/djdecode.h"
+#include "dcmtk/dcmjpls/djdecode.h"
+#include "dcmtk/oflog/oflog.h"
+#include "dcmtk/ofstd/ofexit.h"
+
+#include "DatasetAnonymizer.hpp"
+#include "PixelMaskTable.hpp"
+
+namespace {
+OFCondition notMasked(const char *reason) {
+  return {0, 0, OF_error, reason};
+}
+
+void registerDecoders() {
+  // encapsulated pixel data is decoded before it is masked
+  static std::once_flag once{};
+  std::call_once(once, [] {
+    DcmRLEDecoderRegistration::registerCodecs();
+    DJLSDecoderRegistration::registerCodecs();
+    DJDecoderRegistration::registerCodecs();
+  });
+}
+
+std::string toUpper(std::string_view text) {
+  std::string upper{text};
+  std::transform(upper.begin(), upper.end(), upper.begin(), [](char c) {
+    return static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+  });
+  return upper;
+}
+
+// unsigned integers separated by separator, all of text
+bool parseNumbers(std::string_view text, char separator,
+                  std::vector<unsigned int> &numbers) {
+  numbers.clear();
+  while (true) {
+    unsigned int value{0};
+    const auto [end, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc{})
+      return false;
+    numbers.push_back(value);
+    text.remove_prefix(static_cast<std::size_t>(end - text.data()));
+    if (text.empty())
+      return true;
+    if (text.front() != separator)
+      return false;
+    text.remove_prefix(1);
+  }
+}
+
+bool parseRule(const std::string &line, PixelMaskRule &rule) {
+  std::istringstream stream{line};
+  std::string modality{}, manufacturer{}, size{};
+  if (!(stream >> modality >> std::quoted(manufacturer) >> size))
+    return false;
+  rule.modality = modality == "*" ? std::string{} : toUpper(modality);
+  rule.manufacturer =
+      manufacturer == "*" ? std::string{} : toUpper(manufacturer);
+
+  std::vector<unsigned int> numbers{};
+  if (size != "*") {
+    if (!parseNumbers(size, 'x', numbers) || numbers.size() != 2)
+      return false;
+    rule.columns = numbers[0];
+    rule.rows = numbers[1];
+  }
+
+  std::string region{};
+  while (stream >> region) {
+    if (!parseNumbers(region, ',', numbers) || numbers.size() != 4 ||
+        numbers[2] == 0 || numbers[3] == 0)
+      return false;
+    rule.regions.push_back({numbers[0], numbers[1], numbers[2], numbers[3]});
+  }
+  return !rule.regions.empty();
+}
+
+// values of samples repeated over the block, in memory order
+PixelFill makeFill(const Uint16 *values, unsigned int samples,
+                   unsigned int bytes) {
+  PixelFill fill{};
+  const std::size_t period = std::size_t{samples} * bytes;
+  for (std::size_t offset = 0; offset < fill.bytes.size(); offset += period) {
+    for (unsigned int s = 0; s < samples; ++s) {
+      if (bytes == 1)
+        fill.bytes[offset + s] = static_cast<std::uint8_t>(values[s]);
+      else
+        std::memcpy(&fill.bytes[offset + 2 * s], &values[s], 2);
+    }
+  }
+  return fill;
+}
+
+// darkest value of every sample, false for unsupported interpretations
+bool blankValues(const OFString &photometric, Uint16 stored,
+                 Uint16 representation, Uint16 samples, Uint16 *values) {
+  const int bits = std::clamp<int>(stored, 1, 16);
+  const bool isSigned = representation == 1;
+  if (photometric == "MONOCHROME2" && samples == 1) {
+    values[0] = isSigned ? static_cast<Uint16>(-(1 << (bits - 1))) : 0;
+  } else if (photometric == "MONOCHROME1" && samples == 1) {
+    values[0] = static_cast<Uint16>(isSigned ? (1 << (bits - 1)) - 1
+                                             : (1 << bits) - 1);
+  } else if ((photometric == "RGB" && samples == 3) ||
+             (photometric == "PALETTE COLOR" && samples == 1)) {
+    std::fill_n(values, samples, Uint16{0});
+  } else if (photometric == "YBR_FULL" && samples == 3) {
+    values[0] = 0;
+    values[1] = values[2] = static_cast<Uint16>(1 << (bits - 1));
+  } else {
+    return false;
+  }
+  return true;
+}
+} // namespace
+
+void fillPixelSpan(std::uint8_t *data, std::size_t length,
+                   const PixelFill &fill) {
+  std::size_t i{0};
+#if defined(__SSE2__)
+  const __m128i *block = reinterpret_cast<const __m128i *>(fill.bytes.data());
+  const __m128i a = _mm_load_si128(block);
+  const __m128i b = _mm_load_si128(block + 1);
+  const __m128i c = _mm_load_si128(block + 2);
+  for (; i + 48 <= length; i += 48) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), a);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i + 16), b);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i + 32), c);
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t a = vld1q_u8(fill.bytes.data());
+  const uint8x16_t b = vld1q_u8(fill.bytes.data() + 16);
+  const uint8x16_t c = vld1q_u8(fill.bytes.data() + 32);
+  for (; i + 48 <= length; i += 48) {
+    vst1q_u8(data + i, a);
+    vst1q_u8(data + i + 16, b);
+    vst1q_u8(data + i + 32, c);
+  }
+#else
+  for (; i + 48 <= length; i += 48)
+    std::memcpy(data + i, fill.bytes.data(), 48);
+#endif
+  std::memcpy(data + i, fill.bytes.data(), length - i);
+}
+
+OFCondition PixelMaskTable::load(const std::string &filename) {
+  std::ifstream file{filename, std::ios::in};
+  if (!file.is_open()) {
+    OFCondition cond{0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error,
+                     "error reading file with pixel masks"};
+    OFLOG_ERROR(anonymizerLogger, cond.text());
+    return cond;
+  }
+
+  // `#` starts a comment, manufacturers with spaces are quoted
+  std::string line{};
+  unsigned int line_number{0};
+  while (std::getline(file, line)) {
+    ++line_number;
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+      continue;
+
+    PixelMaskRule rule{};
+    if (!parseRule(line, rule)) {
+      OFLOG_ERROR(anonymizerLogger, "invalid pixel mask on line "
+                                        << line_number << " of `" << filename
+                                        << "`");
+      return {0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error,
+              "invalid pixel mask file"};
+    }
+    m_rules.push_back(std::move(rule));
+  }
+
+  if (!m_rules.empty())
+    registerDecoders();
+  OFLOG_INFO(anonymizerLogger, "loaded " << m_rules.size()
+                                         << " pixel masks from `" << filename
+                                         << "`");
+  return EC_Normal;
+}
+
+OFCondition PixelMaskTable::apply(DcmDataset *dataset, bool &masked) const {
+  masked = false;
+  OFString modality{}, manufacturer{};
+  Uint16 rows{0}, columns{0};
+  dataset->findAndGetOFString(DCM_Modality, modality);
+  dataset->findAndGetOFString(DCM_Manufacturer, manufacturer);
+  dataset->findAndGetUint16(DCM_Rows, rows);
+  dataset->findAndGetUint16(DCM_Columns, columns);
+  const std::string upperModality = toUpper(modality.c_str());
+  const std::string upperManufacturer = toUpper(manufacturer.c_str());
+
+  std::vector<PixelRegion> regions{};
+  for (const PixelMaskRule &rule : m_rules) {
+    if ((!rule.modality.empty() && rule.modality != upperModality) ||
+        !upperManufacturer.starts_with(rule.manufacturer) ||
+        (rule.columns != 0 &&
+         (rule.columns != columns || rule.rows != rows)))
+      continue;
+    for (const PixelRegion &region : rule.regions) {
+      if (region.x >= columns || region.y >= rows)
+        continue;
+      regions.push_back({region.x, region.y,
+                         std::min(region.width, columns - region.x),
+                         std::min(region.height, rows - region.y)});
+    }
+  }
+  DcmElement *element = nullptr;
+  if (regions.empty() ||
+      dataset->findAndGetElement(DCM_PixelData, element).bad() ||
+      element->ident() != EVR_PixelData)
+    return EC_Normal;
+
+  if (DcmXfer{dataset->getCurrentXfer()}.isEncapsulated()) {
+    OFCondition cond =
+        dataset->chooseRepresentation(EXS_LittleEndianExplicit, nullptr);
+    if (cond.bad())
+      return cond;
+    // the encoded original must neither be written nor encoded again
+    dataset->removeAllButCurrentRepresentations();
+  }
+
+  Uint16 samples{1}, allocated{0}, stored{0}, representation{0}, planar{0};
+  long frames{1};
+  OFString photometric{};
+  dataset->findAndGetUint16(DCM_SamplesPerPixel, samples);
+  dataset->findAndGetUint16(DCM_BitsAllocated, allocated);
+  dataset->findAndGetUint16(DCM_BitsStored, stored);
+  dataset->findAndGetUint16(DCM_PixelRepresentation, representation);
+  dataset->findAndGetUint16(DCM_PlanarConfiguration, planar);
+  dataset->findAndGetLongInt(DCM_NumberOfFrames, frames);
+  dataset->findAndGetOFStringArray(DCM_PhotometricInterpretation,
+                                   photometric);
+  if (allocated != 8 && allocated != 16)
+    return notMasked("only 8 and 16 bits allocated can be masked");
+
+  std::array<Uint16, 3> values{};
+  if (samples > values.size() ||
+      !blankValues(photometric, stored, representation, samples,
+                   values.data()))
+    return notMasked("photometric interpretation cannot be masked");
+
+  const unsigned int bytes = allocated / 8;
+  const std::size_t frameBytes =
+      std::size_t{rows} * columns * samples * bytes;
+  auto *pixelData = static_cast<DcmPixelData *>(element);
+  std::uint8_t *pixels = nullptr;
+  if (bytes == 1) {
+    Uint8 *data = nullptr;
+    if (pixelData->getUint8Array(data).good())
+      pixels = data;
+  } else {
+    Uint16 *data = nullptr;
+    if (pixelData->getUint16Array(data).good())
+      pixels = reinterpret_cast<std::uint8_t *>(data);
+  }
+  if (pixels == nullptr || frames < 1 ||
+      pixelData->getLength() < frameBytes * static_cast<std::size_t>(frames))
+    return notMasked("pixel data shorter than the image");
+
+  // interleaved samples are one plane of samples * bytes per pixel
+  const bool isPlanar = samples > 1 && planar == 1;
+  const unsigned int planes = isPlanar ? samples : 1;
+  const std::size_t pixelBytes =
+      isPlanar ? bytes : std::size_t{samples} * bytes;
+  const std::size_t rowBytes = pixelBytes * columns;
+  std::array<PixelFill, 3> fills{};
+  for (unsigned int p = 0; p < planes; ++p)
+    fills[p] = makeFill(&values[p], isPlanar ? 1 : samples, bytes);
+
+  for (long f = 0; f < frames; ++f) {
+    std::uint8_t *frame = pixels + static_cast<std::size_t>(f) * frameBytes;
+    for (unsigned int p = 0; p < planes; ++p) {
+      std::uint8_t *plane = frame + p * rowBytes * rows;
+      for (const PixelRegion &region : regions) {
+        std::uint8_t *start =
+            plane + region.y * rowBytes + region.x * pixelBytes;
+        if (region.width == columns) {
+          // whole rows are one contiguous span
+          fillPixelSpan(start, region.height * rowBytes, fills[p]);
+          continue;
+        }
+        for (unsigned int y = 0; y < region.height; ++y)
+          fillPixelSpan(start + y * rowBytes, region.width * pixelBytes,
+                        fills[p]);
+      }
+    }
+  }
+  masked = true;
+  return EC_Normal;
+}
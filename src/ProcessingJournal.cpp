@@ -0,0 +1,175 @@
+#include <exception>
+#include <filesystem>
+#include <sstream>
+#include <vector>
+
+#include "dcmtk/oflog/oflog.h"
+#include "dcmtk/ofstd/ofexit.h"
+
+#include "fmt/format.h"
+
+#include "DicomAnonymizer.hpp"
+#include "MainLogger.hpp"
+#include "ProcessingJournal.hpp"
+#include "Sha256.hpp"
+
+namespace {
+constexpr std::string_view JOURNAL_FILENAME{"fnodcmanon.journal"};
+
+std::vector<std::string> splitFields(const std::string &line) {
+  std::vector<std::string> fields{};
+  std::istringstream stream{line};
+  std::string field{};
+  while (std::getline(stream, field, '\t'))
+    fields.push_back(field);
+  return fields;
+}
+
+// a generated UID, a cut one loses its last digits or its dot
+bool isNewUid(const std::string &value) {
+  return !value.empty() && value.size() <= 64 && value.front() != '.' &&
+         value.back() != '.' &&
+         value.find_first_not_of("0123456789.") == std::string::npos;
+}
+} // namespace
+
+OFCondition ProcessingJournal::open(const std::string &output_directory,
+                                    bool resume) {
+  const std::string filename =
+      fmt::format("{}/{}", output_directory, JOURNAL_FILENAME);
+
+  if (!resume) {
+    // hashing every input costs a second read, a stale journal would be
+    // resumed against outputs it does not describe
+    std::error_code error{};
+    std::filesystem::remove(filename, error);
+    return EC_Normal;
+  }
+
+  if (std::filesystem::exists(filename)) {
+    // cut a line torn by a crashed run, appending would glue the next
+    // record onto it and lose both
+    const std::uint64_t complete = this->load(filename);
+    std::error_code ec{};
+    if (std::filesystem::file_size(filename, ec) > complete && !ec)
+      std::filesystem::resize_file(filename, complete, ec);
+    if (ec) {
+      OFCondition cond{0, EXITCODE_CANNOT_WRITE_OUTPUT_FILE, OF_error,
+                       "unable to repair processing journal"};
+      OFLOG_ERROR(mainLogger, cond.text() << " `" << filename << "`");
+      return cond;
+    }
+  }
+
+  m_file.open(filename, std::ios::out | std::ios::app);
+  if (!m_file.is_open()) {
+    OFCondition cond{0, EXITCODE_CANNOT_WRITE_OUTPUT_FILE, OF_error,
+                     "error opening processing journal"};
+    OFLOG_ERROR(mainLogger, cond.text() << " `" << filename << "`");
+    return cond;
+  }
+  return EC_Normal;
+}
+
+std::uint64_t ProcessingJournal::load(const std::string &filename) {
+  std::ifstream file{filename, std::ios::in | std::ios::binary};
+  std::string line{};
+  std::uint64_t complete{0};
+  while (std::getline(file, line)) {
+    if (file.eof())
+      break; // no newline, torn by a crash
+    complete += line.size() + 1;
+    const std::vector<std::string> fields = splitFields(line);
+
+    if (fields.size() == 4 && fields[0] == "S" && isNewUid(fields[3])) {
+      JournalStudyRecord &study = m_studies[fields[1]];
+      study.pseudoname = fields[2];
+      study.new_studyuid = fields[3];
+    } else if (fields.size() == 9 && fields[0] == "F" &&
+               isNewUid(fields[8])) {
+      JournalFileRecord record{};
+      try {
+        record.size = std::stoull(fields[3]);
+        record.mtime = std::stoll(fields[4]);
+      } catch (const std::exception &) {
+        continue;
+      }
+      record.sha256 = fields[5];
+      record.output_path = fields[6];
+      record.old_series_uid = fields[7];
+      record.new_series_uid = fields[8];
+
+      m_studies[fields[1]].series_uids[fields[7]] = fields[8];
+      m_outputs[record.output_path] = fields[2];
+      m_files[fields[2]] = std::move(record);
+    }
+  }
+
+  OFLOG_INFO(mainLogger, "resuming from journal `"
+                             << filename << "`, " << m_studies.size()
+                             << " studies, " << m_files.size() << " files");
+  return complete;
+}
+
+const JournalStudyRecord *
+ProcessingJournal::findStudy(const std::string &study_dir) const {
+  const auto it = m_studies.find(study_dir);
+  if (it == m_studies.end() || it->second.new_studyuid.empty())
+    return nullptr;
+  return &it->second;
+}
+
+const JournalFileRecord *
+ProcessingJournal::findFile(const std::string &input_file) const {
+  const auto it = m_files.find(input_file);
+  return it == m_files.end() ? nullptr : &it->second;
+}
+
+bool ProcessingJournal::isOutputTaken(const std::string &output_path) const {
+  return m_outputs.contains(output_path);
+}
+
+bool ProcessingJournal::isUnchanged(const std::string &input_file,
+                                    JournalFileRecord &current) const {
+  std::error_code ec{};
+  current.size = std::filesystem::file_size(input_file, ec);
+  if (ec)
+    return false;
+  const auto mtime = std::filesystem::last_write_time(input_file, ec);
+  current.mtime = mtime.time_since_epoch().count();
+
+  const JournalFileRecord *previous = this->findFile(input_file);
+  if (previous == nullptr || previous->size != current.size)
+    return false;
+  if (previous->mtime == current.mtime)
+    return true;
+
+  // touched or copied, the content decides
+  if (sha256File(input_file, current.sha256).bad())
+    return false;
+  return current.sha256 == previous->sha256;
+}
+
+void ProcessingJournal::recordStudy(const std::string &study_dir,
+                                    const std::string &pseudoname,
+                                    const std::string &new_studyuid) const {
+  this->appendLine(
+      fmt::format("S\t{}\t{}\t{}", study_dir, pseudoname, new_studyuid));
+}
+
+void ProcessingJournal::recordFile(const std::string &study_dir,
+                                   const std::string &input_file,
+                                   const JournalFileRecord &record) const {
+  this->appendLine(fmt::format("F\t{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}", study_dir,
+                               input_file, record.size, record.mtime,
+                               record.sha256, record.output_path,
+                               record.old_series_uid, record.new_series_uid));
+}
+
+void ProcessingJournal::appendLine(const std::string &line) const {
+  const std::lock_guard lock{m_file_mutex};
+  if (!m_file.is_open())
+    return;
+  m_file << line << '\n';
+  m_file.flush();
+}
@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+
+#include "dcmtk/ofstd/ofexit.h"
+
+#include "DicomIO.hpp"
+#include "PseudonameTable.hpp"
+
+namespace {
+constexpr std::array<char, 8> INDEX_MAGIC{'F', 'N', 'O', 'P',
+                                          'S', 'I', 'X', '1'};
+constexpr std::uint32_t INDEX_BYTE_ORDER{0x01020304};
+
+struct IndexHeader {
+  std::array<char, 8> magic{INDEX_MAGIC};
+  std::uint32_t byte_order{INDEX_BYTE_ORDER};
+  std::uint32_t slot_size{0};
+  std::uint64_t csv_size{0};
+  std::int64_t csv_mtime{0};
+  std::uint64_t count{0};
+  std::uint64_t capacity{0};
+  std::uint64_t arena_size{0};
+};
+
+enum E_CHAR_CLASS : unsigned char { K_KEEP, K_SPACE, K_ALPHA, K_SLASH };
+
+// ::isspace() and ::isalpha() of the "C" locale as one lookup
+constexpr std::array<E_CHAR_CLASS, 256> CHAR_CLASS = [] {
+  std::array<E_CHAR_CLASS, 256> table{};
+  for (const unsigned char c : {' ', '\t', '\n', '\v', '\f', '\r'})
+    table[c] = K_SPACE;
+  for (unsigned char c = 'a'; c <= 'z'; ++c)
+    table[c] = K_ALPHA;
+  for (unsigned char c = 'A'; c <= 'Z'; ++c)
+    table[c] = K_ALPHA;
+  table['/'] = K_SLASH;
+  return table;
+}();
+
+// append [begin, end) without the characters of the dropped classes
+void appendFiltered(const char *begin, const char *end, bool id,
+                    std::string &out) {
+  for (const char *c = begin; c < end; ++c) {
+    const E_CHAR_CLASS cls = CHAR_CLASS[static_cast<unsigned char>(*c)];
+    if (cls == K_KEEP || (!id && cls != K_SPACE))
+      out.push_back(*c);
+  }
+}
+
+OFCondition csvStatus(const std::string &csv_file, IndexHeader &header) {
+  std::error_code ec{};
+  header.csv_size = std::filesystem::file_size(csv_file, ec);
+  if (!ec)
+    header.csv_mtime = std::filesystem::last_write_time(csv_file, ec)
+                           .time_since_epoch()
+                           .count();
+  if (ec)
+    return {0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error,
+            "error reading file with pseudonames"};
+  return EC_Normal;
+}
+} // namespace
+
+PseudonameTable::PseudonameTable() = default;
+PseudonameTable::~PseudonameTable() = default;
+
+std::uint64_t PseudonameTable::hash(std::string_view key) {
+  // FNV-1a with a final mix, the low bits pick the slot
+  std::uint64_t h{0xcbf29ce484222325ULL};
+  for (const char c : key) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h == 0 ? 1 : h;
+}
+
+bool PseudonameTable::validSlots(const Slot *slots, std::uint64_t capacity,
+                                 std::uint64_t count,
+                                 std::uint64_t arena_size) {
+  // probe() needs an empty slot to stop and every range inside the arena
+  if (count >= capacity)
+    return false;
+
+  std::uint64_t used{0};
+  for (std::uint64_t i = 0; i < capacity; ++i) {
+    const Slot &slot = slots[i];
+    if (slot.hash == 0)
+      continue;
+    if (std::uint64_t{slot.key} + slot.key_size > arena_size ||
+        std::uint64_t{slot.value} + slot.value_size > arena_size)
+      return false;
+    ++used;
+  }
+  return used == count;
+}
+
+const PseudonameTable::Slot *
+PseudonameTable::probe(std::string_view key, std::uint64_t key_hash) const {
+  for (std::size_t i = key_hash & (m_capacity - 1);;
+       i = (i + 1) & (m_capacity - 1)) {
+    const Slot &slot = m_slots[i];
+    if (slot.hash == 0)
+      return &slot;
+    if (slot.hash == key_hash && slot.key_size == key.size() &&
+        std::memcmp(m_arena + slot.key, key.data(), key.size()) == 0)
+      return &slot;
+  }
+}
+
+void PseudonameTable::clear() {
+  m_slot_storage = {};
+  m_arena_storage = {};
+  m_mapped.reset();
+  m_slots = nullptr;
+  m_arena = nullptr;
+  m_capacity = 0;
+  m_arena_size = 0;
+  m_size = 0;
+}
+
+bool PseudonameTable::find(std::string_view patient_id,
+                           std::string_view &pseudoname) const {
+  if (m_capacity == 0)
+    return false;
+  const Slot *slot = this->probe(patient_id, hash(patient_id));
+  if (slot->hash == 0 || slot->value + slot->value_size > m_arena_size)
+    return false;
+  pseudoname = {m_arena + slot->value, slot->value_size};
+  return true;
+}
+
+OFCondition PseudonameTable::load(const std::string &csv_file) {
+  this->clear();
+
+  std::error_code ec{};
+  const std::uintmax_t fileSize = std::filesystem::file_size(csv_file, ec);
+  MappedFile mapped{};
+  if (ec || (fileSize > 0 && mapped.open(csv_file).bad()))
+    return {0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error,
+            "error reading file with pseudonames"};
+  const char *data = mapped.data();
+  const char *end = data + mapped.size();
+  const std::size_t lines =
+      static_cast<std::size_t>(std::count(data, end, '\n')) + 1;
+  m_capacity = std::bit_ceil(std::max<std::size_t>(16, 2 * lines));
+  m_slot_storage.assign(m_capacity, Slot{});
+  m_arena_storage.reserve(static_cast<std::size_t>(fileSize));
+  m_slots = m_slot_storage.data();
+  m_arena = m_arena_storage.data();
+
+  std::string id{};
+  std::string value{};
+  for (const char *line = data; line < end;) {
+    const char *eol = static_cast<const char *>(
+        std::memchr(line, '\n', static_cast<std::size_t>(end - line)));
+    if (eol == nullptr)
+      eol = end;
+    const char *comma = static_cast<const char *>(
+        std::memchr(line, ',', static_cast<std::size_t>(eol - line)));
+
+    // a line without delimiter maps to itself, as substr(npos + 1) did
+    id.clear();
+    value.clear();
+    appendFiltered(line, comma != nullptr ? comma : eol, true, id);
+    appendFiltered(comma != nullptr ? comma + 1 : line, eol, false, value);
+    line = eol + 1;
+
+    const std::uint64_t idHash = hash(id);
+    Slot &slot = m_slot_storage[static_cast<std::size_t>(
+        this->probe(id, idHash) - m_slot_storage.data())];
+    if (slot.hash != 0)
+      continue; // first pair of an ID wins
+
+    // arena offsets are 32 bit
+    if (m_arena_storage.size() + id.size() + value.size() >
+        std::numeric_limits<std::uint32_t>::max()) {
+      this->clear();
+      return {0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error,
+              "file with pseudonames too large"};
+    }
+    slot.hash = idHash;
+    slot.key = static_cast<std::uint32_t>(m_arena_storage.size());
+    slot.key_size = static_cast<std::uint32_t>(id.size());
+    m_arena_storage.insert(m_arena_storage.end(), id.begin(), id.end());
+    slot.value = static_cast<std::uint32_t>(m_arena_storage.size());
+    slot.value_size = static_cast<std::uint32_t>(value.size());
+    m_arena_storage.insert(m_arena_storage.end(), value.begin(), value.end());
+    m_arena = m_arena_storage.data();
+    ++m_size;
+  }
+  m_arena_size = m_arena_storage.size();
+  return EC_Normal;
+}
+
+OFCondition PseudonameTable::loadIndex(const std::string &index_file,
+                                       const std::string &csv_file) {
+  this->clear();
+
+  IndexHeader csv{};
+  if (OFCondition cond = csvStatus(csv_file, csv); cond.bad())
+    return cond;
+
+  auto mapped = std::make_unique<MappedFile>();
+  if (OFCondition cond = mapped->open(index_file); cond.bad())
+    return cond;
+
+  IndexHeader header{};
+  if (mapped->size() < sizeof(header))
+    return {0, 0, OF_failure, "pseudoname index truncated"};
+  std::memcpy(&header, mapped->data(), sizeof(header));
+  if (header.magic != INDEX_MAGIC || header.byte_order != INDEX_BYTE_ORDER ||
+      header.slot_size != sizeof(Slot))
+    return {0, 0, OF_failure, "not a pseudoname index of this build"};
+  if (header.csv_size != csv.csv_size || header.csv_mtime != csv.csv_mtime)
+    return {0, 0, OF_failure, "pseudoname index is stale"};
+  const std::uint64_t body = mapped->size() - sizeof(header);
+  if (!std::has_single_bit(header.capacity) ||
+      header.capacity > body / sizeof(Slot) ||
+      header.arena_size != body - header.capacity * sizeof(Slot))
+    return {0, 0, OF_failure, "pseudoname index truncated"};
+
+  // slots follow the 8 byte aligned header, the mapping is page aligned
+  const auto *slots =
+      reinterpret_cast<const Slot *>(mapped->data() + sizeof(header));
+  if (!validSlots(slots, header.capacity, header.count, header.arena_size))
+    return {0, 0, OF_failure, "pseudoname index corrupted"};
+
+  m_slots = slots;
+  m_arena = mapped->data() + sizeof(header) + header.capacity * sizeof(Slot);
+  m_capacity = static_cast<std::size_t>(header.capacity);
+  m_arena_size = static_cast<std::size_t>(header.arena_size);
+  m_size = static_cast<std::size_t>(header.count);
+  m_mapped = std::move(mapped);
+  return EC_Normal;
+}
+
+OFCondition PseudonameTable::saveIndex(const std::string &index_file,
+                                       const std::string &csv_file) const {
+  IndexHeader header{};
+  if (OFCondition cond = csvStatus(csv_file, header); cond.bad())
+    return cond;
+  header.slot_size = sizeof(Slot);
+  header.count = m_size;
+  header.capacity = m_capacity;
+  header.arena_size = m_arena_size;
+
+  // temporary file renamed into place, a concurrent run never maps half of it
+  const std::string temporary = index_file + ".tmp";
+  std::ofstream file{temporary,
+                     std::ios::out | std::ios::binary | std::ios::trunc};
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(m_slots),
+             static_cast<std::streamsize>(m_capacity * sizeof(Slot)));
+  file.write(m_arena, static_cast<std::streamsize>(m_arena_size));
+  file.close();
+  if (file.fail() ||
+      std::rename(temporary.c_str(), index_file.c_str()) != 0) {
+    std::error_code ec{};
+    std::filesystem::remove(temporary, ec);
+    return {0, 0, OF_error, "unable to write pseudoname index"};
+  }
+  return EC_Normal;
+}
@@ -0,0 +1,161 @@
+#include <cerrno>
+#include <string_view>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include "fmt/format.h"
+
+#include "dcmtk/ofstd/ofexit.h"
+
+#include "PseudonameVault.hpp"
+
+namespace {
+// exclusive lock on the whole vault, shared with other processes
+class FileLock {
+public:
+#if defined(__linux__)
+  explicit FileLock(std::FILE *file) : m_fd{::fileno(file)} {
+    while (::flock(m_fd, LOCK_EX) != 0 && errno == EINTR) {
+    }
+  }
+  ~FileLock() { ::flock(m_fd, LOCK_UN); }
+#else
+  explicit FileLock(std::FILE *) {}
+#endif
+  FileLock(const FileLock &) = delete;
+  FileLock &operator=(const FileLock &) = delete;
+
+private:
+#if defined(__linux__)
+  int m_fd{-1};
+#endif
+};
+
+OFCondition vaultError(const std::string &what, const std::string &filename) {
+  const std::string msg = fmt::format("{} `{}`", what, filename);
+  return {0, EXITCODE_CANNOT_WRITE_OUTPUT_FILE, OF_error, msg.c_str()};
+}
+} // namespace
+
+PseudonameVault::~PseudonameVault() {
+  if (m_file != nullptr)
+    std::fclose(m_file);
+}
+
+OFCondition PseudonameVault::open(const std::string &filename) {
+  m_filename = filename;
+#if defined(__linux__)
+  // readable by the owner only, the vault links patients to pseudonames
+  const int fd = ::open(filename.c_str(),
+                        O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  m_file = fd >= 0 ? ::fdopen(fd, "a+b") : nullptr;
+  if (fd >= 0 && m_file == nullptr)
+    ::close(fd);
+#else
+  m_file = std::fopen(filename.c_str(), "a+b");
+#endif
+  if (m_file == nullptr)
+    return vaultError("unable to open pseudoname vault", filename);
+
+  const std::lock_guard lock{m_mutex};
+  const FileLock fileLock{m_file};
+  return this->readNewPairs();
+}
+
+OFCondition PseudonameVault::readNewPairs() {
+  if (std::fseek(m_file, static_cast<long>(m_offset), SEEK_SET) != 0)
+    return vaultError("error reading pseudoname vault", m_filename);
+
+  std::string pending{};
+  std::vector<char> chunk(1 << 16);
+  std::size_t count{0};
+  while ((count = std::fread(chunk.data(), 1, chunk.size(), m_file)) > 0) {
+    pending.append(chunk.data(), count);
+
+    // complete lines only, a torn last line is left for the next append
+    std::size_t start{0};
+    for (std::size_t end = pending.find('\n'); end != std::string::npos;
+         start = end + 1, end = pending.find('\n', start)) {
+      const std::string_view line{pending.data() + start, end - start};
+      const std::size_t tab = line.find('\t');
+      if (tab != std::string_view::npos && tab > 0 &&
+          line.find('\t', tab + 1) == std::string_view::npos) {
+        std::string pseudoname{line.substr(tab + 1)};
+        if (m_pseudonames.try_emplace(std::string{line.substr(0, tab)},
+                                      pseudoname)
+                .second)
+          m_used.insert(std::move(pseudoname));
+      }
+    }
+    m_offset += start;
+    pending.erase(0, start);
+  }
+  if (std::ferror(m_file) != 0)
+    return vaultError("error reading pseudoname vault", m_filename);
+  std::clearerr(m_file);
+  return EC_Normal;
+}
+
+OFCondition
+PseudonameVault::assign(const std::string &patient_id,
+                        const std::function<std::string()> &generate,
+                        std::string &pseudoname) {
+  if (patient_id.empty() ||
+      patient_id.find_first_of("\t\n") != std::string::npos)
+    return {0, 0, OF_failure, "PatientID cannot be stored in the vault"};
+
+  const std::lock_guard lock{m_mutex};
+  if (const auto it = m_pseudonames.find(patient_id);
+      it != m_pseudonames.end()) {
+    pseudoname = it->second;
+    return EC_Normal;
+  }
+
+  // another process may have assigned one since the last read
+  const FileLock fileLock{m_file};
+  if (OFCondition cond = this->readNewPairs(); cond.bad())
+    return cond;
+  if (const auto it = m_pseudonames.find(patient_id);
+      it != m_pseudonames.end()) {
+    pseudoname = it->second;
+    return EC_Normal;
+  }
+
+#if defined(__linux__)
+  // cut a line torn by a crashed writer, appending would complete it
+  if (std::fseek(m_file, 0, SEEK_END) == 0 &&
+      static_cast<std::uint64_t>(std::ftell(m_file)) > m_offset &&
+      ::ftruncate(::fileno(m_file), static_cast<off_t>(m_offset)) != 0)
+    return vaultError("unable to repair pseudoname vault", m_filename);
+#endif
+
+  std::string candidate = generate();
+  while (m_used.contains(candidate))
+    candidate = generate();
+
+  const std::string line = fmt::format("{}\t{}\n", patient_id, candidate);
+  if (std::fwrite(line.data(), 1, line.size(), m_file) != line.size() ||
+      std::fflush(m_file) != 0)
+    return vaultError("error writing pseudoname vault", m_filename);
+#if defined(__linux__)
+  // on disk before any output carries the pseudoname
+  if (::fdatasync(::fileno(m_file)) != 0)
+    return vaultError("error writing pseudoname vault", m_filename);
+#endif
+
+  m_offset += line.size();
+  m_pseudonames.emplace(patient_id, candidate);
+  m_used.insert(candidate);
+  pseudoname = std::move(candidate);
+  return EC_Normal;
+}
+
+std::size_t PseudonameVault::size() const {
+  const std::lock_guard lock{m_mutex};
+  return m_pseudonames.size();
+}
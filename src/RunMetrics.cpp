@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <fstream>
+
+#include "fmt/format.h"
+
+#include "dcmtk/oflog/oflog.h"
+#include "dcmtk/ofstd/ofexit.h"
+
+#include "DatasetAnonymizer.hpp"
+#include "RunMetrics.hpp"
+
+namespace {
+constexpr std::array<const char *, S_STAGE_COUNT> STAGE_NAMES{
+    "discovery", "probe", "load",  "mask", "tag_actions",
+    "uids",      "encode", "write", "file"};
+
+constexpr std::array<const char *, T_SOURCE_COUNT> SOURCE_NAMES{
+    "basic_profile",         "patient_characteristics",
+    "device_identity",       "institution_identity",
+    "rule_file",             "private_tag",
+    "unknown_tag"};
+
+// upper bound of a histogram bucket, the last one is +Inf
+double bucketSeconds(std::size_t bucket) {
+  return static_cast<double>(std::uint64_t{1} << bucket) * 1.0e-6;
+}
+
+double perSecond(double value, double seconds) {
+  return seconds > 0.0 ? value / seconds : 0.0;
+}
+
+// temporary file renamed into place, collectors never read a partial file
+OFCondition writeFileAtomically(const std::string &filename,
+                                const std::string &content) {
+  const std::string temporary = filename + ".tmp";
+  {
+    std::ofstream file{temporary, std::ios::out | std::ios::trunc};
+    file << content;
+    if (!file.good()) {
+      OFLOG_ERROR(anonymizerLogger,
+                  "error writing metrics file `" << temporary << "`");
+      return {0, EXITCODE_CANNOT_WRITE_OUTPUT_FILE, OF_error,
+              "error writing metrics file"};
+    }
+  }
+  if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+    OFLOG_ERROR(anonymizerLogger,
+                "error renaming metrics file to `" << filename << "`");
+    return {0, EXITCODE_CANNOT_WRITE_OUTPUT_FILE, OF_error,
+            "error writing metrics file"};
+  }
+  return EC_Normal;
+}
+} // namespace
+
+void RunMetrics::record(E_STAGE stage, std::chrono::nanoseconds duration) {
+  const auto ns = static_cast<std::uint64_t>(std::max<std::int64_t>(
+      duration.count(), 0));
+  const std::size_t bucket = std::min<std::size_t>(
+      static_cast<std::size_t>(std::bit_width(ns / 1000)), BUCKETS - 1);
+
+  Stage &entry = m_stages[stage];
+  entry.count.fetch_add(1, std::memory_order_relaxed);
+  entry.total_ns.fetch_add(ns, std::memory_order_relaxed);
+  entry.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+  std::uint64_t max = entry.max_ns.load(std::memory_order_relaxed);
+  while (ns > max && !entry.max_ns.compare_exchange_weak(
+                         max, ns, std::memory_order_relaxed)) {
+  }
+}
+
+void RunMetrics::addTagCounts(const TagActionCounts &counts) {
+  for (std::size_t i = 0; i < counts.removed.size(); ++i) {
+    if (counts.removed[i] > 0)
+      m_tags_removed[i].fetch_add(counts.removed[i],
+                                  std::memory_order_relaxed);
+  }
+  this->add(C_TAGS_EMPTIED, counts.emptied);
+  this->add(C_TAGS_REPLACED, counts.replaced);
+  this->add(C_UIDS_REMAPPED, counts.uids_remapped);
+}
+
+double RunMetrics::runSeconds() const {
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - m_start;
+  return elapsed.count();
+}
+
+double RunMetrics::quantileSeconds(const Stage &stage, double quantile) const {
+  const std::uint64_t count = stage.count.load(std::memory_order_relaxed);
+  if (count == 0)
+    return 0.0;
+
+  const auto rank = static_cast<std::uint64_t>(
+      std::max(1.0, quantile * static_cast<double>(count)));
+  // bucket upper bound, never above the largest sample
+  const double max =
+      static_cast<double>(stage.max_ns.load(std::memory_order_relaxed)) *
+      1.0e-9;
+  std::uint64_t seen{0};
+  for (std::size_t i = 0; i + 1 < BUCKETS; ++i) {
+    seen += stage.buckets[i].load(std::memory_order_relaxed);
+    if (seen >= rank)
+      return std::min(bucketSeconds(i), max);
+  }
+  return max;
+}
+
+OFCondition RunMetrics::writeJson(const std::string &filename) const {
+  const double seconds = this->runSeconds();
+  const auto value = [this](E_COUNTER counter) {
+    return this->counter(counter);
+  };
+
+  std::string json = fmt::format(
+      "{{\n  \"run_seconds\": {:.3f},\n"
+      "  \"studies\": {{\"total\": {}, \"failed\": {}}},\n"
+      "  \"files\": {{\"anonymized\": {}, \"skipped\": {}, \"failed\": {}, "
+      "\"ignored\": {}, \"streamed\": {}, \"masked\": {}, "
+      "\"encoded\": {}}},\n"
+      "  \"bytes\": {{\"read\": {}, \"written\": {}}},\n"
+      "  \"pixel_data\": {{\"native\": {}, \"encoded\": {}, "
+      "\"ratio\": {:.3f}}},\n"
+      "  \"rates\": {{\"files_per_second\": {:.1f}, "
+      "\"read_mb_per_second\": {:.1f}, \"written_mb_per_second\": {:.1f}}},\n",
+      seconds, value(C_STUDIES), value(C_STUDIES_FAILED), value(C_FILES),
+      value(C_FILES_SKIPPED), value(C_FILES_FAILED), value(C_FILES_IGNORED),
+      value(C_FILES_STREAMED), value(C_FILES_MASKED), value(C_FILES_ENCODED),
+      value(C_BYTES_READ), value(C_BYTES_WRITTEN), value(C_PIXEL_BYTES_NATIVE),
+      value(C_PIXEL_BYTES_ENCODED),
+      value(C_PIXEL_BYTES_ENCODED) > 0
+          ? static_cast<double>(value(C_PIXEL_BYTES_NATIVE)) /
+                static_cast<double>(value(C_PIXEL_BYTES_ENCODED))
+          : 0.0,
+      perSecond(static_cast<double>(value(C_FILES)), seconds),
+      perSecond(static_cast<double>(value(C_BYTES_READ)) / 1.0e6, seconds),
+      perSecond(static_cast<double>(value(C_BYTES_WRITTEN)) / 1.0e6,
+                seconds));
+
+  json += "  \"tags\": {\"removed\": {";
+  for (std::size_t i = 0; i < SOURCE_NAMES.size(); ++i) {
+    json += fmt::format("{}\"{}\": {}", i == 0 ? "" : ", ", SOURCE_NAMES[i],
+                        m_tags_removed[i].load(std::memory_order_relaxed));
+  }
+  json += fmt::format("}}, \"emptied\": {}, \"replaced\": {}, "
+                      "\"uids_remapped\": {}}},\n",
+                      value(C_TAGS_EMPTIED), value(C_TAGS_REPLACED),
+                      value(C_UIDS_REMAPPED));
+
+  json += "  \"stages\": {";
+  for (std::size_t i = 0; i < m_stages.size(); ++i) {
+    const Stage &stage = m_stages[i];
+    const std::uint64_t count = stage.count.load(std::memory_order_relaxed);
+    const double total =
+        static_cast<double>(stage.total_ns.load(std::memory_order_relaxed)) *
+        1.0e-9;
+    json += fmt::format(
+        "{}\n    \"{}\": {{\"count\": {}, \"seconds\": {:.6f}, "
+        "\"mean_ms\": {:.3f}, \"p50_ms\": {:.3f}, \"p95_ms\": {:.3f}, "
+        "\"p99_ms\": {:.3f}, \"max_ms\": {:.3f}}}",
+        i == 0 ? "" : ",", STAGE_NAMES[i], count, total,
+        perSecond(total * 1.0e3, static_cast<double>(count)),
+        this->quantileSeconds(stage, 0.50) * 1.0e3,
+        this->quantileSeconds(stage, 0.95) * 1.0e3,
+        this->quantileSeconds(stage, 0.99) * 1.0e3,
+        static_cast<double>(stage.max_ns.load(std::memory_order_relaxed)) *
+            1.0e-6);
+  }
+  json += "\n  }\n}\n";
+
+  return writeFileAtomically(filename, json);
+}
+
+OFCondition RunMetrics::writePrometheus(const std::string &filename) const {
+  // text exposition format for the node exporter textfile collector
+  std::string text{};
+  const auto counter = [this, &text](const char *name, const char *help,
+                                     E_COUNTER id) {
+    text += fmt::format("# HELP fnodcmanon_{0} {1}\n# TYPE fnodcmanon_{0} "
+                        "counter\nfnodcmanon_{0} {2}\n",
+                        name, help, this->counter(id));
+  };
+
+  text += fmt::format("# HELP fnodcmanon_run_seconds Wall time of the run.\n"
+                      "# TYPE fnodcmanon_run_seconds gauge\n"
+                      "fnodcmanon_run_seconds {:.3f}\n",
+                      this->runSeconds());
+  counter("studies_total", "Studies processed.", C_STUDIES);
+  counter("studies_failed_total", "Studies that failed.", C_STUDIES_FAILED);
+  counter("files_total", "Files anonymized.", C_FILES);
+  counter("files_skipped_total", "Files unchanged since the journal.",
+          C_FILES_SKIPPED);
+  counter("files_failed_total", "Files that failed.", C_FILES_FAILED);
+  counter("files_ignored_total", "Files that are not DICOM instances.",
+          C_FILES_IGNORED);
+  counter("files_streamed_total",
+          "Files written without loading their large values.",
+          C_FILES_STREAMED);
+  counter("files_masked_total", "Files with blanked pixel regions.",
+          C_FILES_MASKED);
+  counter("files_encoded_total", "Files written with encoded pixel data.",
+          C_FILES_ENCODED);
+  counter("read_bytes_total", "Bytes of input files.", C_BYTES_READ);
+  counter("written_bytes_total", "Bytes of output files.", C_BYTES_WRITTEN);
+  counter("pixel_native_bytes_total",
+          "Pixel data of encoded files before encoding.",
+          C_PIXEL_BYTES_NATIVE);
+  counter("pixel_encoded_bytes_total",
+          "Pixel data of encoded files after encoding.",
+          C_PIXEL_BYTES_ENCODED);
+  counter("tags_emptied_total", "Elements emptied.", C_TAGS_EMPTIED);
+  counter("tags_replaced_total", "Elements replaced.", C_TAGS_REPLACED);
+  counter("uids_remapped_total", "UI elements remapped by key.",
+          C_UIDS_REMAPPED);
+
+  text += "# HELP fnodcmanon_tags_removed_total Elements removed by source.\n"
+          "# TYPE fnodcmanon_tags_removed_total counter\n";
+  for (std::size_t i = 0; i < SOURCE_NAMES.size(); ++i) {
+    text += fmt::format("fnodcmanon_tags_removed_total{{source=\"{}\"}} {}\n",
+                        SOURCE_NAMES[i],
+                        m_tags_removed[i].load(std::memory_order_relaxed));
+  }
+
+  text += "# HELP fnodcmanon_stage_seconds Latency of pipeline stages.\n"
+          "# TYPE fnodcmanon_stage_seconds histogram\n";
+  for (std::size_t i = 0; i < m_stages.size(); ++i) {
+    const Stage &stage = m_stages[i];
+    std::uint64_t cumulative{0};
+    for (std::size_t bucket = 0; bucket + 1 < BUCKETS; ++bucket) {
+      cumulative += stage.buckets[bucket].load(std::memory_order_relaxed);
+      text += fmt::format(
+          "fnodcmanon_stage_seconds_bucket{{stage=\"{}\",le=\"{}\"}} {}\n",
+          STAGE_NAMES[i], bucketSeconds(bucket), cumulative);
+    }
+    const std::uint64_t count = stage.count.load(std::memory_order_relaxed);
+    text += fmt::format(
+        "fnodcmanon_stage_seconds_bucket{{stage=\"{0}\",le=\"+Inf\"}} {1}\n"
+        "fnodcmanon_stage_seconds_sum{{stage=\"{0}\"}} {2:.6f}\n"
+        "fnodcmanon_stage_seconds_count{{stage=\"{0}\"}} {1}\n",
+        STAGE_NAMES[i], count,
+        static_cast<double>(stage.total_ns.load(std::memory_order_relaxed)) *
+            1.0e-9);
+  }
+
+  return writeFileAtomically(filename, text);
+}
@@ -0,0 +1,379 @@
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/dcmdata/dcuid.h"
+#include "dcmtk/dcmdata/dcxfer.h"
+#include "dcmtk/dcmnet/dimse.h"
+#include "dcmtk/dcmnet/scp.h"
+#include "dcmtk/dcmnet/scppool.h"
+#include "dcmtk/dcmnet/scu.h"
+#include "dcmtk/ofstd/oflist.h"
+
+#include "fmt/format.h"
+
+#include "AsyncFileIO.hpp"
+#include "DicomIO.hpp"
+#include "MainLogger.hpp"
+#include "StorageScp.hpp"
+
+// association to the forward destination, opened on the first dataset of an
+// incoming association and renegotiated when a dataset needs a presentation
+// context that was not proposed yet
+class StorageScp::Forwarder {
+public:
+  explicit Forwarder(const StorageScpOptions &options) : m_options{options} {}
+  ~Forwarder() { this->release(); }
+
+  OFCondition send(DcmDataset *dataset);
+  void release();
+
+private:
+  OFCondition connect();
+
+  const StorageScpOptions &m_options;
+  std::unique_ptr<DcmSCU> m_scu{};
+  // transfer syntaxes proposed per SOP class
+  std::map<std::string, std::set<std::string>> m_contexts{};
+};
+
+OFCondition StorageScp::Forwarder::send(DcmDataset *dataset) {
+  std::string sopClass{};
+  dataset->findAndGetOFString(DCM_SOPClassUID, sopClass);
+  E_TransferSyntax xfer = dataset->getCurrentXfer();
+  const std::string xferId = DcmXfer{xfer}.getXferID();
+
+  T_ASC_PresentationContextID presId{0};
+  if (m_scu && m_scu->isConnected())
+    presId = m_scu->findPresentationContextID(sopClass, xferId);
+
+  if (presId == 0) {
+    std::set<std::string> &xfers = m_contexts[sopClass];
+    const bool proposed = xfers.contains(xferId);
+    if (!proposed) {
+      xfers.insert(xferId);
+      xfers.insert(UID_LittleEndianExplicitTransferSyntax);
+      xfers.insert(UID_LittleEndianImplicitTransferSyntax);
+    }
+    if (!proposed || !m_scu || !m_scu->isConnected()) {
+      if (OFCondition cond = this->connect(); cond.bad())
+        return cond;
+      presId = m_scu->findPresentationContextID(sopClass, xferId);
+    }
+  }
+
+  // refused as it is, sent decoded in a transfer syntax the destination took
+  for (const E_TransferSyntax fallback :
+       {EXS_LittleEndianExplicit, EXS_LittleEndianImplicit}) {
+    if (presId != 0)
+      break;
+    presId = m_scu->findPresentationContextID(sopClass,
+                                              DcmXfer{fallback}.getXferID());
+    xfer = fallback;
+  }
+  if (presId == 0)
+    return {0, 0, OF_error, "SOP class not accepted by forward destination"};
+  if (OFCondition cond = dataset->chooseRepresentation(xfer, nullptr);
+      cond.bad())
+    return cond;
+
+  Uint16 status{0};
+  OFCondition cond =
+      m_scu->sendSTORERequest(presId, OFFilename{}, dataset, status);
+  if (cond.good() && status != STATUS_Success &&
+      !DICOM_WARNING_STATUS(status)) {
+    FNO_LOG_ERROR("forward destination answered C-STORE with 0x{:04x}",
+                  status);
+    return {0, 0, OF_error, "dataset refused by forward destination"};
+  }
+  return cond;
+}
+
+void StorageScp::Forwarder::release() {
+  if (m_scu && m_scu->isConnected())
+    m_scu->releaseAssociation();
+  m_scu.reset();
+}
+
+OFCondition StorageScp::Forwarder::connect() {
+  this->release();
+  m_scu = std::make_unique<DcmSCU>();
+  m_scu->setAETitle(m_options.aetitle);
+  m_scu->setPeerAETitle(m_options.forward_aetitle);
+  m_scu->setPeerHostName(m_options.forward_host);
+  m_scu->setPeerPort(m_options.forward_port);
+  for (const auto &[sopClass, xfers] : m_contexts) {
+    OFList<OFString> syntaxes{};
+    for (const std::string &xfer : xfers)
+      syntaxes.push_back(xfer);
+    m_scu->addPresentationContext(sopClass, syntaxes);
+  }
+
+  OFCondition cond = m_scu->initNetwork();
+  if (cond.good())
+    cond = m_scu->negotiateAssociation();
+  if (cond.bad()) {
+    FNO_LOG_ERROR("unable to connect to {}@{}:{}", m_options.forward_aetitle,
+                  m_options.forward_host, m_options.forward_port);
+    m_scu.reset();
+  }
+  return cond;
+}
+
+// DCMTK's DcmSCPPool with workers that know their StorageScp
+class StorageScp::Pool : public DcmBaseSCPPool {
+public:
+  explicit Pool(StorageScp &scp) : m_scp{scp} {}
+
+private:
+  class Worker : public DcmBaseSCPWorker, public DcmSCP {
+  public:
+    explicit Worker(Pool &pool)
+        : DcmBaseSCPWorker{pool}, m_scp{pool.m_scp},
+          m_forwarder{pool.m_scp.m_options} {}
+
+    OFCondition setSharedConfig(const DcmSharedSCPConfig &config) override {
+      return DcmSCP::setSharedConfig(config);
+    }
+
+  protected:
+    OFCondition workerListen(T_ASC_Association *const assoc) override {
+      return DcmSCP::run(assoc);
+    }
+
+    OFCondition
+    handleIncomingCommand(T_DIMSE_Message *message,
+                          const DcmPresentationContextInfo &info) override {
+      // C-ECHO is answered and other services are refused by DcmSCP
+      if (message->CommandField != DIMSE_C_STORE_RQ)
+        return DcmSCP::handleIncomingCommand(message, info);
+
+      T_DIMSE_C_StoreRQ &request = message->msg.CStoreRQ;
+      DcmDataset *received = nullptr;
+      const OFCondition cond = this->receiveSTORERequest(
+          request, info.presentationContextID, received);
+      std::unique_ptr<DcmDataset> dataset{received};
+      if (cond.bad()) {
+        FNO_LOG_ERROR("unable to receive dataset: {}", cond.text());
+        m_scp.m_anonymizer.metrics().add(C_FILES_FAILED);
+        return cond;
+      }
+
+      const Uint16 status = m_scp.store(std::move(dataset), m_forwarder);
+      return this->sendSTOREResponse(info.presentationContextID, request,
+                                     status);
+    }
+
+    void notifyAssociationTermination() override {
+      m_forwarder.release();
+      DcmSCP::notifyAssociationTermination();
+    }
+
+  private:
+    StorageScp &m_scp;
+    Forwarder m_forwarder;
+  };
+
+  DcmBaseSCPWorker *createSCPWorker() override { return new Worker{*this}; }
+
+  StorageScp &m_scp;
+};
+
+StorageScp::StorageScp(const DatasetAnonymizer &anonymizer,
+                       const StorageScpOptions &options)
+    : m_anonymizer{anonymizer}, m_options{options},
+      m_pool{std::make_unique<Pool>(*this)} {}
+
+StorageScp::~StorageScp() = default;
+
+OFCondition StorageScp::listen(const std::atomic<bool> &stop) {
+  if (OFCondition cond = this->openCsv(); cond.bad())
+    return cond;
+
+  DcmSCPConfig &config = m_pool->getConfig();
+  config.setAETitle(m_options.aetitle);
+  config.setPort(m_options.port);
+  // wait for associations in one second steps to notice stop
+  config.setConnectionBlockingMode(DUL_NOBLOCK);
+  config.setConnectionTimeout(1);
+
+  // uncompressed first, encapsulated data is taken as it is sent
+  OFList<OFString> xfers{};
+  for (const char *xfer :
+       {UID_LittleEndianExplicitTransferSyntax,
+        UID_LittleEndianImplicitTransferSyntax,
+        UID_BigEndianExplicitTransferSyntax,
+        UID_DeflatedExplicitVRLittleEndianTransferSyntax,
+        UID_JPEGProcess14SV1TransferSyntax, UID_JPEGProcess1TransferSyntax,
+        UID_JPEGLSLosslessTransferSyntax, UID_JPEGLSLossyTransferSyntax,
+        UID_RLELosslessTransferSyntax, UID_JPEG2000LosslessOnlyTransferSyntax,
+        UID_JPEG2000TransferSyntax})
+    xfers.push_back(xfer);
+  config.addPresentationContext(UID_VerificationSOPClass, xfers);
+  for (int i = 0; i < numberOfDcmAllStorageSOPClassUIDs; i++)
+    config.addPresentationContext(dcmAllStorageSOPClassUIDs[i], xfers);
+  m_pool->setMaxThreads(static_cast<Uint16>(m_options.max_associations));
+
+  std::jthread watcher{[this, &stop](const std::stop_token &token) {
+    while (!token.stop_requested() && !stop.load())
+      std::this_thread::sleep_for(std::chrono::milliseconds{200});
+    if (stop.load())
+      m_pool->stopAfterCurrentAssociations();
+  }};
+
+  FNO_LOG_CONSOLE("listening as {} on port {}, up to {} associations",
+                  m_options.aetitle, m_options.port,
+                  m_options.max_associations);
+  if (m_options.forward_host.empty())
+    FNO_LOG_CONSOLE("writing anonymized datasets to `{}`",
+                    m_options.output_directory);
+  else
+    FNO_LOG_CONSOLE("forwarding anonymized datasets to {}@{}:{}",
+                    m_options.forward_aetitle, m_options.forward_host,
+                    m_options.forward_port);
+
+  const OFCondition cond = m_pool->listen();
+  watcher.request_stop();
+  return stop.load() ? EC_Normal : cond;
+}
+
+bool StorageScp::parseDestination(const std::string &text,
+                                  StorageScpOptions &options) {
+  const std::size_t at = text.find('@');
+  const std::size_t colon = text.rfind(':');
+  // AE titles have at most 16 characters
+  if (at == std::string::npos || at == 0 || at > 16 ||
+      colon == std::string::npos || colon < at + 2)
+    return false;
+
+  unsigned long port{0};
+  std::size_t end{0};
+  try {
+    port = std::stoul(text.substr(colon + 1), &end);
+  } catch (const std::exception &) {
+    return false;
+  }
+  if (end != text.size() - colon - 1 || port == 0 || port > 65535)
+    return false;
+
+  options.forward_aetitle = text.substr(0, at);
+  options.forward_host = text.substr(at + 1, colon - at - 1);
+  options.forward_port = static_cast<Uint16>(port);
+  return true;
+}
+
+Uint16 StorageScp::store(std::unique_ptr<DcmDataset> dataset,
+                         Forwarder &forwarder) {
+  RunMetrics &metrics = m_anonymizer.metrics();
+
+  // the SOP instance names the output file and the forwarded C-STORE
+  OFString sopInstanceUid{};
+  dataset->findAndGetOFString(DCM_SOPInstanceUID, sopInstanceUid);
+  if (sopInstanceUid.empty()) {
+    FNO_LOG_ERROR("received dataset without SOPInstanceUID");
+    metrics.add(C_FILES_FAILED);
+    return STATUS_STORE_Error_CannotUnderstand;
+  }
+
+  AnonymizedDataset result{};
+  if (OFCondition cond = m_anonymizer.anonymize(dataset.get(), result);
+      cond.bad()) {
+    FNO_LOG_ERROR("unable to anonymize received dataset: {}", cond.text());
+    return STATUS_STORE_Error_CannotUnderstand;
+  }
+  if (result.new_study)
+    this->recordStudy(result);
+
+  OFCondition cond{};
+  {
+    const RunMetrics::StageTimer timer{metrics, S_WRITE};
+    cond = m_options.forward_host.empty()
+               ? this->writeDataset(std::move(dataset), result)
+               : forwarder.send(dataset.get());
+  }
+  if (cond.bad()) {
+    FNO_LOG_ERROR("unable to store {} of {}: {}", result.new_sop_instance_uid,
+                  result.pseudoname, cond.text());
+    metrics.add(C_FILES_FAILED);
+    return STATUS_STORE_Refused_OutOfResources;
+  }
+
+  FNO_LOG_DEBUG("stored {} of {}", result.new_sop_instance_uid,
+                result.pseudoname);
+  return STATUS_Success;
+}
+
+OFCondition StorageScp::writeDataset(std::unique_ptr<DcmDataset> dataset,
+                                     const AnonymizedDataset &result) const {
+  // UIDs under 1.2.840.10008 are kept as received, the name must not leave
+  // the study directory
+  const std::string &uid = result.new_sop_instance_uid;
+  if (uid.empty() || uid.find_first_not_of("0123456789.") != uid.npos)
+    return {0, 0, OF_error, "SOPInstanceUID not usable as file name"};
+
+  const std::filesystem::path directory =
+      std::filesystem::path{m_options.output_directory} / result.pseudoname /
+      "DICOM";
+  std::error_code ec{};
+  std::filesystem::create_directories(directory, ec);
+  if (ec)
+    return {0, 0, OF_error, "unable to create study directory"};
+
+  const E_TransferSyntax xfer = dataset->getCurrentXfer();
+  dataset->chooseRepresentation(xfer, nullptr);
+  // the meta header is created from the anonymized dataset
+  DcmFileFormat fileformat{dataset.release()};
+  std::vector<char> output{};
+  OFCondition cond = writeFileFormatToBuffer(
+      fileformat, xfer, EET_UndefinedLength, EGL_recalcGL, output);
+  if (cond.bad())
+    return cond;
+
+  // only complete files get their name
+  const std::string path = (directory / result.new_sop_instance_uid).string();
+  cond = writeWholeFile(path + ".part", output);
+  if (cond.good() && std::rename((path + ".part").c_str(), path.c_str()) != 0)
+    cond = {0, 0, OF_error, "unable to rename output file"};
+  if (cond.good())
+    m_anonymizer.metrics().add(C_BYTES_WRITTEN, output.size());
+  return cond;
+}
+
+void StorageScp::recordStudy(const AnonymizedDataset &result) {
+  FNO_LOG_CONSOLE("applying pseudoname {} to ID {}", result.pseudoname,
+                  result.old_patient_id);
+  if (!m_csv.is_open())
+    return;
+
+  const std::lock_guard lock{m_csv_mutex};
+  // flushed per study, the mapping survives a killed receiver
+  m_csv << fmt::format("{},{},{},{},{},{}\n", result.old_patient_id,
+                       result.old_patient_name, result.pseudoname,
+                       result.study_date, result.old_study_uid,
+                       result.new_study_uid)
+        << std::flush;
+}
+
+OFCondition StorageScp::openCsv() {
+  if (m_options.csv_file.empty())
+    return EC_Normal;
+
+  // appended, studies of earlier sessions stay listed
+  std::error_code ec{};
+  const bool isNew = !std::filesystem::exists(m_options.csv_file, ec) ||
+                     std::filesystem::file_size(m_options.csv_file, ec) == 0;
+  m_csv.open(m_options.csv_file, std::ios::out | std::ios::app);
+  if (!m_csv.is_open())
+    return {0, 0, OF_error, "unable to open output .csv"};
+  if (isNew)
+    m_csv << "PatientID,PatientName,Pseudoname,StudyDate,"
+             "OldStudyInstanceUID,NewStudyInstanceUID\n"
+          << std::flush;
+  return EC_Normal;
+}
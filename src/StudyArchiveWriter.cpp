@@ -0,0 +1,249 @@
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+
+#include "fmt/format.h"
+
+#if defined(FNO_HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+#include "MainLogger.hpp"
+#include "StudyArchiveWriter.hpp"
+
+namespace {
+constexpr std::size_t BLOCK{512};
+constexpr std::size_t BUFFER_SIZE{std::size_t{8} << 20}; // bytes per write()
+constexpr int ZSTD_LEVEL{3};
+
+using Header = std::array<char, BLOCK>;
+
+// zero terminated octal number filling the field
+void putOctal(char *field, std::size_t width, std::uint64_t value) {
+  const std::string digits = fmt::format("{:0{}o}", value, width - 1);
+  std::memcpy(field, digits.data(), width - 1);
+}
+
+// ustar header of a regular file, names over 100 characters are split into
+// prefix and name at a slash
+bool makeHeader(const std::string &name, std::uint64_t size,
+                std::int64_t mtime, Header &header) {
+  header.fill('\0');
+  char *h = header.data();
+
+  if (name.size() <= 100) {
+    std::memcpy(h, name.data(), name.size());
+  } else {
+    std::size_t slash = name.find('/');
+    while (slash != std::string::npos &&
+           (slash > 155 || name.size() - slash - 1 > 100))
+      slash = name.find('/', slash + 1);
+    if (slash == std::string::npos || slash + 1 == name.size())
+      return false;
+    std::memcpy(h, name.data() + slash + 1, name.size() - slash - 1);
+    std::memcpy(h + 345, name.data(), slash);
+  }
+
+  putOctal(h + 100, 8, 0644);
+  putOctal(h + 108, 8, 0);
+  putOctal(h + 116, 8, 0);
+  if (size < (std::uint64_t{1} << 33)) {
+    putOctal(h + 124, 12, size);
+  } else {
+    // GNU base-256 for members of 8 GiB and more
+    h[124] = static_cast<char>(0x80);
+    for (int i = 0; i < 8; ++i)
+      h[135 - i] = static_cast<char>((size >> (8 * i)) & 0xFF);
+  }
+  putOctal(h + 136, 12, static_cast<std::uint64_t>(mtime));
+  h[156] = '0';
+  std::memcpy(h + 257, "ustar", 6);
+  std::memcpy(h + 263, "00", 2);
+
+  std::memset(h + 148, ' ', 8);
+  unsigned int checksum{0};
+  for (const char c : header)
+    checksum += static_cast<unsigned char>(c);
+  putOctal(h + 148, 7, checksum);
+  return true;
+}
+
+std::size_t padding(std::uint64_t size) {
+  return static_cast<std::size_t>((BLOCK - size % BLOCK) % BLOCK);
+}
+
+#if defined(FNO_HAVE_ZSTD)
+OFCondition compressFrame(const std::vector<char> &raw,
+                          std::vector<char> &frame) {
+  // one context per worker, reused for every member
+  thread_local const std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)>
+      context{ZSTD_createCCtx(), &ZSTD_freeCCtx};
+
+  frame.resize(ZSTD_compressBound(raw.size()));
+  const std::size_t size =
+      ZSTD_compressCCtx(context.get(), frame.data(), frame.size(), raw.data(),
+                        raw.size(), ZSTD_LEVEL);
+  if (ZSTD_isError(size) != 0)
+    return {0, 0, OF_error, ZSTD_getErrorName(size)};
+  frame.resize(size);
+  return EC_Normal;
+}
+#else
+OFCondition compressFrame(const std::vector<char> &, std::vector<char> &) {
+  return {0, 0, OF_error, "built without libzstd"};
+}
+#endif
+} // namespace
+
+StudyArchiveWriter::~StudyArchiveWriter() {
+  if (m_file.is_open())
+    this->discard();
+}
+
+bool StudyArchiveWriter::isSupported([[maybe_unused]] E_OUTPUT_FORMAT format) {
+#if defined(FNO_HAVE_ZSTD)
+  return true;
+#else
+  return format != O_TAR_ZSTD;
+#endif
+}
+
+std::string_view StudyArchiveWriter::extension(E_OUTPUT_FORMAT format) {
+  return format == O_TAR_ZSTD ? ".tar.zst" : ".tar";
+}
+
+OFCondition StudyArchiveWriter::open(const std::string &filename) {
+  m_filename = filename;
+  m_mtime = std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now().time_since_epoch())
+                .count();
+  m_buffer.reserve(BUFFER_SIZE);
+
+  m_file.open(filename + ".part",
+              std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!m_file.is_open()) {
+    const std::string msg =
+        fmt::format("unable to create study archive `{}`", filename);
+    FNO_LOG_ERROR("{}", msg);
+    m_status = {0, 0, OF_error, msg.c_str()};
+  }
+  return m_status;
+}
+
+OFCondition StudyArchiveWriter::encode(const std::string &name,
+                                       const std::vector<char> &data,
+                                       std::vector<char> &member) const {
+  Header header{};
+  if (!makeHeader(name, data.size(), m_mtime, header))
+    return {0, 0, OF_error, "member name too long for ustar"};
+
+  member.clear();
+  member.reserve(BLOCK + data.size() + padding(data.size()));
+  member.insert(member.end(), header.begin(), header.end());
+  member.insert(member.end(), data.begin(), data.end());
+  member.resize(member.size() + padding(data.size()), '\0');
+  if (m_format != O_TAR_ZSTD)
+    return EC_Normal;
+
+  std::vector<char> frame{};
+  const OFCondition cond = compressFrame(member, frame);
+  member = std::move(frame);
+  return cond;
+}
+
+OFCondition StudyArchiveWriter::add(const std::string &name,
+                                    const std::vector<char> &data,
+                                    std::uint64_t *stored) {
+  std::vector<char> member{};
+  if (OFCondition cond = this->encode(name, data, member); cond.bad())
+    return cond;
+
+  const std::lock_guard lock{m_mutex};
+  if (m_status.bad())
+    return m_status;
+  m_index.push_back({name, m_offset, member.size(), data.size()});
+  if (stored != nullptr)
+    *stored = member.size();
+  return this->append(member);
+}
+
+OFCondition StudyArchiveWriter::append(std::vector<char> &member) {
+  m_offset += member.size();
+  if (m_buffer.size() + member.size() > BUFFER_SIZE) {
+    if (OFCondition cond = this->flush(); cond.bad())
+      return cond;
+  }
+  if (member.size() >= BUFFER_SIZE) {
+    // large instances go out directly, not through the buffer
+    m_file.write(member.data(), static_cast<std::streamsize>(member.size()));
+  } else {
+    m_buffer.insert(m_buffer.end(), member.begin(), member.end());
+  }
+  if (m_file.fail())
+    m_status = {0, 0, OF_error, "error writing study archive"};
+  return m_status;
+}
+
+OFCondition StudyArchiveWriter::flush() {
+  m_file.write(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+  m_buffer.clear();
+  if (m_file.fail())
+    m_status = {0, 0, OF_error, "error writing study archive"};
+  return m_status;
+}
+
+OFCondition StudyArchiveWriter::close() {
+  const std::lock_guard lock{m_mutex};
+  if (!m_file.is_open())
+    return m_status;
+
+  // end of archive, two zero blocks
+  std::vector<char> end(2 * BLOCK, '\0');
+  if (m_format == O_TAR_ZSTD && m_status.good()) {
+    std::vector<char> frame{};
+    if (OFCondition cond = compressFrame(end, frame); cond.bad())
+      m_status = cond;
+    end = std::move(frame);
+  }
+  if (m_status.good() && this->append(end).good())
+    this->flush();
+  m_file.close();
+
+  std::string index{"# member\toffset\tlength\tsize\n"};
+  for (const ArchiveIndexEntry &entry : m_index)
+    index += fmt::format("{}\t{}\t{}\t{}\n", entry.name, entry.offset,
+                         entry.length, entry.size);
+  std::ofstream indexFile{m_filename + ".idx.part",
+                          std::ios::out | std::ios::binary | std::ios::trunc};
+  indexFile << index;
+  indexFile.close();
+
+  if (m_status.good() && (m_file.fail() || indexFile.fail()))
+    m_status = {0, 0, OF_error, "error writing study archive"};
+  if (m_status.good() &&
+      (std::rename((m_filename + ".part").c_str(), m_filename.c_str()) != 0 ||
+       std::rename((m_filename + ".idx.part").c_str(),
+                   (m_filename + ".idx").c_str()) != 0))
+    m_status = {0, 0, OF_error, "unable to rename study archive"};
+
+  if (m_status.bad()) {
+    FNO_LOG_ERROR("error writing study archive `{}` ({})", m_filename,
+                  m_status.text());
+    std::error_code ec{};
+    std::filesystem::remove(m_filename + ".part", ec);
+    std::filesystem::remove(m_filename + ".idx.part", ec);
+  }
+  return m_status;
+}
+
+void StudyArchiveWriter::discard() {
+  const std::lock_guard lock{m_mutex};
+  m_file.close();
+  m_buffer.clear();
+  m_index.clear();
+  std::error_code ec{};
+  std::filesystem::remove(m_filename + ".part", ec);
+}
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "fmt/format.h"
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+
+#include "DicomAnonymizer.hpp"
+#include "DicomProbe.hpp"
+#include "MainLogger.hpp"
+#include "StudyScanner.hpp"
+#include "WorkStealingPool.hpp"
+
+OFCondition probeStudyTags(DicomProbe &probe, StudyInput &study) {
+  DicomProbeResult result{};
+  OFCondition cond = probe.probe({DCM_StudyDate, DCM_PatientName,
+                                  DCM_PatientID, DCM_StudyInstanceUID},
+                                 DCM_UndefinedTagKey, result);
+  if (cond.bad())
+    return cond;
+
+  // first value only, same as setBasicTags()
+  const auto firstValue = [&result](const DcmTagKey &tag) {
+    const std::string &value = result.values[tag];
+    return value.substr(0, value.find('\\'));
+  };
+  study.patient_id = firstValue(DCM_PatientID);
+  study.patient_name = firstValue(DCM_PatientName);
+  study.study_uid = firstValue(DCM_StudyInstanceUID);
+  study.study_date = firstValue(DCM_StudyDate);
+  if (study.study_uid.empty())
+    return {0, 0, OF_failure, "no StudyInstanceUID"};
+  return EC_Normal;
+}
+
+namespace {
+constexpr std::size_t PROBE_BATCH{256}; // files probed by one task
+
+// scan of one root directory, tasks count themselves in m_pending
+class DirectoryScan {
+public:
+  explicit DirectoryScan(unsigned int jobs) : m_pool{jobs} {}
+
+  void run(const std::filesystem::path &root) {
+    this->submit([this, root] { this->scanDirectory(root); });
+    std::unique_lock lock{m_done_mutex};
+    m_done.wait(lock, [this] { return m_pending.load() == 0; });
+  }
+
+  std::unordered_map<std::string, StudyInput> &studies() { return m_studies; }
+  std::size_t ignoredFiles() const { return m_ignored.load(); }
+
+private:
+  void submit(WorkStealingPool::Task task) {
+    m_pending.fetch_add(1);
+    m_pool.submit([this, task = std::move(task)] {
+      task();
+      if (m_pending.fetch_sub(1) == 1) {
+        const std::lock_guard lock{m_done_mutex};
+        m_done.notify_all();
+      }
+    });
+  }
+
+  void scanDirectory(const std::filesystem::path &directory) {
+    std::vector<std::string> batch{};
+    std::error_code ec{};
+    std::filesystem::directory_iterator it{
+        directory, std::filesystem::directory_options::skip_permission_denied,
+        ec};
+    if (ec) {
+      FNO_LOG_WARN("unable to list `{}` ({})", directory.string(),
+                   ec.message());
+      return;
+    }
+
+    // symlinked directories are not followed, same as
+    // recursive_directory_iterator
+    for (; it != std::filesystem::directory_iterator{}; it.increment(ec)) {
+      if (ec)
+        break;
+      const std::filesystem::directory_entry &entry = *it;
+      std::error_code status_ec{};
+      if (entry.is_symlink(status_ec) && entry.is_directory(status_ec))
+        continue;
+      if (entry.is_directory(status_ec)) {
+        this->submit(
+            [this, path = entry.path()] { this->scanDirectory(path); });
+        continue;
+      }
+      if (!entry.is_regular_file(status_ec) ||
+          entry.path().filename() == "DICOMDIR")
+        continue;
+
+      batch.push_back(entry.path().string());
+      if (batch.size() == PROBE_BATCH) {
+        this->submit([this, files = std::move(batch)] {
+          this->probeFiles(files);
+        });
+        batch = {};
+      }
+    }
+    this->probeFiles(batch);
+  }
+
+  void probeFiles(const std::vector<std::string> &files) {
+    std::vector<std::pair<std::string, StudyInput>> probed{};
+    probed.reserve(files.size());
+    for (const std::string &file : files) {
+      DicomProbe probe{file};
+      StudyInput tags{};
+      if (const OFCondition cond = probeStudyTags(probe, tags); cond.bad()) {
+        FNO_LOG_DEBUG("ignoring `{}`, {}", file, cond.text());
+        m_ignored.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      probed.emplace_back(file, std::move(tags));
+    }
+
+    // one lock per batch
+    const std::lock_guard lock{m_studies_mutex};
+    for (auto &[file, tags] : probed) {
+      StudyInput &study = m_studies[tags.study_uid];
+      if (study.dicom_files.empty())
+        study = std::move(tags);
+      study.dicom_files.push_back(std::move(file));
+    }
+  }
+
+  std::atomic<std::size_t> m_pending{0};
+  std::atomic<std::size_t> m_ignored{0};
+  std::mutex m_done_mutex;
+  std::condition_variable m_done;
+  std::mutex m_studies_mutex;
+  std::unordered_map<std::string, StudyInput> m_studies{};
+  WorkStealingPool m_pool; // last member, joined before the state is gone
+};
+} // namespace
+
+OFCondition StudyScanner::scan(const std::filesystem::path &root,
+                               std::vector<StudyInput> &studies) {
+  studies.clear();
+  m_ignored_files = 0;
+
+  DirectoryScan directory_scan{std::max(1U, m_jobs)};
+  directory_scan.run(root);
+  m_ignored_files = directory_scan.ignoredFiles();
+
+  for (auto &[study_uid, study] : directory_scan.studies()) {
+    std::ranges::sort(study.dicom_files);
+    study.input_directory =
+        std::filesystem::path{study.dicom_files.front()}.parent_path();
+    studies.push_back(std::move(study));
+  }
+  std::ranges::sort(studies, {},
+                    [](const StudyInput &study) -> const std::string & {
+                      return study.dicom_files.front();
+                    });
+
+  if (studies.empty()) {
+    const std::string msg =
+        fmt::format("no dicom studies found in `{}`", root.string());
+    FNO_LOG_WARN("{}", msg);
+    return {0, 0, OF_failure, msg.c_str()};
+  }
+
+  FNO_LOG_INFO("found {} studies in `{}`, ignored {} files", studies.size(),
+               root.string(), m_ignored_files);
+  return EC_Normal;
+}
@@ -0,0 +1,398 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <string_view>
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcelem.h"
+#include "dcmtk/dcmdata/dcsequen.h"
+#include "dcmtk/dcmdata/dctag.h"
+#include "dcmtk/oflog/oflog.h"
+#include "dcmtk/ofstd/ofexit.h"
+
+#include "DatasetAnonymizer.hpp"
+#include "TagActionTable.hpp"
+#include "UidRemapper.hpp"
+
+namespace {
+constexpr std::string_view PSEUDONAME_VALUE{"{pseudoname}"};
+
+// profile of a built-in rule, retain options switch to its retained action,
+// values match the first E_TAG_SOURCE values
+enum E_RULE_PROFILE {
+  R_BASIC,
+  R_PATIENT_CHARACTERISTICS,
+  R_DEVICE_IDENTITY,
+  R_INSTITUTION_IDENTITY
+};
+
+struct BuiltinRule {
+  DcmTagKey tag{};
+  E_RULE_PROFILE profile{R_BASIC};
+  E_TAG_ACTION action{A_REMOVE};   // profile applied
+  E_TAG_ACTION retained{A_REMOVE}; // retain option given
+  std::string_view value{};
+};
+
+// clang-format off
+const std::array BUILTIN_RULES{
+    // Basic Application Confidentiality Profile, basic patient tags
+    BuiltinRule{DCM_PatientName, R_BASIC, A_REPLACE, A_REPLACE, PSEUDONAME_VALUE},
+    BuiltinRule{DCM_PatientID, R_BASIC, A_REPLACE, A_REPLACE, PSEUDONAME_VALUE},
+    BuiltinRule{DCM_PatientSex, R_BASIC, A_REPLACE, A_REPLACE, "O"},
+    BuiltinRule{DCM_PatientAddress, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_AdditionalPatientHistory, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_PatientInstitutionResidence, R_BASIC, A_REMOVE, A_REMOVE},
+
+    // other institution staff - operator, physicians
+    BuiltinRule{DCM_ConsultingPhysicianName, R_BASIC, A_EMPTY, A_EMPTY},
+    BuiltinRule{DCM_ConsultingPhysicianIdentificationSequence, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_OperatorsName, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_NameOfPhysiciansReadingStudy, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_PerformingPhysicianName, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_PerformingPhysicianIdentificationSequence, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_PhysiciansOfRecord, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_PhysiciansOfRecordIdentificationSequence, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_ReferringPhysicianName, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_ReferringPhysicianAddress, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_ReferringPhysicianIdentificationSequence, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_ReferringPhysicianTelephoneNumbers, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_RequestingPhysician, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_ScheduledPerformingPhysicianName, R_BASIC, A_REMOVE, A_REMOVE},
+    BuiltinRule{DCM_ScheduledPerformingPhysicianIdentificationSequence, R_BASIC, A_REMOVE, A_REMOVE},
+
+    // Retain Patient Characteristics Option, some tags are cleaned when retained
+    BuiltinRule{DCM_Allergies, R_PATIENT_CHARACTERISTICS, A_REMOVE, A_EMPTY},
+    BuiltinRule{DCM_PatientAge, R_PATIENT_CHARACTERISTICS, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_PatientSexNeutered, R_PATIENT_CHARACTERISTICS, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_PatientSize, R_PATIENT_CHARACTERISTICS, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_PatientWeight, R_PATIENT_CHARACTERISTICS, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_PatientState, R_PATIENT_CHARACTERISTICS, A_REMOVE, A_EMPTY},
+    BuiltinRule{DCM_PregnancyStatus, R_PATIENT_CHARACTERISTICS, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_PreMedication, R_PATIENT_CHARACTERISTICS, A_REMOVE, A_EMPTY},
+    BuiltinRule{DCM_SmokingStatus, R_PATIENT_CHARACTERISTICS, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_SpecialNeeds, R_PATIENT_CHARACTERISTICS, A_REMOVE, A_EMPTY},
+
+    // Retain Device Identity Option
+    BuiltinRule{DCM_DeviceDescription, R_DEVICE_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_DeviceLabel, R_DEVICE_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_DeviceSerialNumber, R_DEVICE_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_ManufacturerDeviceIdentifier, R_DEVICE_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_PerformedStationName, R_DEVICE_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_PerformedStationNameCodeSequence, R_DEVICE_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_ScheduledStationName, R_DEVICE_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_ScheduledStationNameCodeSequence, R_DEVICE_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_SourceManufacturer, R_DEVICE_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_SourceSerialNumber, R_DEVICE_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_StationName, R_DEVICE_IDENTITY, A_REMOVE, A_KEEP},
+
+    // Retain Institution Identity Option
+    BuiltinRule{DCM_InstitutionAddress, R_INSTITUTION_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_InstitutionName, R_INSTITUTION_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_InstitutionalDepartmentName, R_INSTITUTION_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_InstitutionalDepartmentTypeCodeSequence, R_INSTITUTION_IDENTITY, A_REMOVE, A_KEEP},
+    BuiltinRule{DCM_InstitutionCodeSequence, R_INSTITUTION_IDENTITY, A_REMOVE, A_KEEP}};
+// clang-format on
+
+bool parseAction(std::string name, E_TAG_ACTION &action) {
+  std::ranges::transform(name, name.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+
+  if (name == "remove" || name == "x")
+    action = A_REMOVE;
+  else if (name == "empty" || name == "z")
+    action = A_EMPTY;
+  else if (name == "replace" || name == "d")
+    action = A_REPLACE;
+  else if (name == "keep" || name == "k")
+    action = A_KEEP;
+  else
+    return false;
+  return true;
+}
+
+// accepts `(gggg,eeee)` and `gggg,eeee`
+bool parseTag(const std::string &text, DcmTagKey &tag) {
+  unsigned int group{0}, element{0};
+  char comma{'\0'}, close{'\0'};
+  std::istringstream stream{text.front() == '(' ? text.substr(1) : text};
+  stream >> std::hex >> group >> comma >> element;
+  if (text.front() == '(')
+    stream >> close;
+
+  if (stream.fail() || comma != ',' || (text.front() == '(' && close != ')') ||
+      group > 0xFFFF || element > 0xFFFF)
+    return false;
+
+  tag = DcmTagKey(static_cast<Uint16>(group), static_cast<Uint16>(element));
+  return true;
+}
+
+// UIDs naming a SOP class or transfer syntax rather than an instance, private
+// ones outside 1.2.840.10008 have to stay resolvable by the receiver
+bool isClassUid(const DcmTagKey &tag) {
+  static const std::array CLASS_UID_TAGS{
+      DCM_AffectedSOPClassUID,
+      DCM_RequestedSOPClassUID,
+      DCM_MediaStorageSOPClassUID,
+      DCM_TransferSyntaxUID,
+      DCM_ImplementationClassUID,
+      DCM_ReferencedSOPClassUIDInFile,
+      DCM_ReferencedTransferSyntaxUIDInFile,
+      DCM_ReferencedRelatedGeneralSOPClassUIDInFile,
+      DCM_SOPClassUID,
+      DCM_RelatedGeneralSOPClassUID,
+      DCM_OriginalSpecializedSOPClassUID,
+      DCM_SOPClassesInStudy,
+      DCM_ReferencedSOPClassUID};
+  return std::ranges::find(CLASS_UID_TAGS, tag) != CLASS_UID_TAGS.end();
+}
+} // namespace
+
+TagActionTable
+TagActionTable::fromProfiles(const std::set<E_ADDIT_ANONYM_METHODS> &methods) {
+  TagActionTable table{};
+  for (const auto &rule : BUILTIN_RULES) {
+    const bool retained =
+        (rule.profile == R_PATIENT_CHARACTERISTICS &&
+         methods.contains(M_113108)) ||
+        (rule.profile == R_DEVICE_IDENTITY && methods.contains(M_113109)) ||
+        (rule.profile == R_INSTITUTION_IDENTITY && methods.contains(M_113112));
+
+    TagAction action{rule.tag, retained ? rule.retained : rule.action,
+                     std::string{rule.value}, rule.value == PSEUDONAME_VALUE,
+                     static_cast<E_TAG_SOURCE>(rule.profile)};
+    table.setAction(action);
+  }
+  return table;
+}
+
+OFCondition TagActionTable::mergeRuleFile(const std::string &filename) {
+  std::ifstream file{filename, std::ios::in};
+  if (!file.is_open()) {
+    OFCondition cond{0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error,
+                     "error reading file with tag rules"};
+    OFLOG_ERROR(anonymizerLogger, cond.text());
+    return cond;
+  }
+
+  // one rule per line: `(gggg,eeee) action [value]`, `#` starts a comment
+  std::string line{};
+  unsigned int line_number{0};
+  unsigned int rules{0};
+  while (std::getline(file, line)) {
+    ++line_number;
+    line = line.substr(0, line.find('#'));
+
+    std::istringstream stream{line};
+    std::string tag_text{}, action_text{}, value{};
+    if (!(stream >> tag_text))
+      continue;
+    stream >> action_text;
+    std::getline(stream >> std::ws, value);
+    while (!value.empty() && std::isspace(static_cast<unsigned char>(value.back())))
+      value.pop_back();
+
+    TagAction action{};
+    if (!parseTag(tag_text, action.tag) ||
+        !parseAction(action_text, action.action)) {
+      OFLOG_ERROR(anonymizerLogger, "invalid tag rule on line "
+                                        << line_number << " of `" << filename
+                                        << "`");
+      return {0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error,
+              "invalid tag rule file"};
+    }
+
+    action.use_pseudoname = value == PSEUDONAME_VALUE;
+    action.value = std::move(value);
+    this->setAction(action);
+    ++rules;
+  }
+
+  OFLOG_INFO(anonymizerLogger, "merged " << rules << " tag rules from `"
+                                         << filename << "`");
+  return EC_Normal;
+}
+
+OFCondition
+TagActionTable::mergeSafePrivateCreators(const std::string &filename) {
+  std::ifstream file{filename, std::ios::in};
+  if (!file.is_open()) {
+    OFCondition cond{0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error,
+                     "error reading file with safe private creators"};
+    OFLOG_ERROR(anonymizerLogger, cond.text());
+    return cond;
+  }
+
+  // one private creator per line, `#` starts a comment
+  std::string line{};
+  while (std::getline(file, line)) {
+    line = line.substr(0, line.find('#'));
+    const auto first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos)
+      continue;
+    const auto last = line.find_last_not_of(" \t\r");
+    m_safe_private_creators.push_back(line.substr(first, last - first + 1));
+  }
+
+  std::ranges::sort(m_safe_private_creators);
+  const auto duplicates = std::ranges::unique(m_safe_private_creators);
+  m_safe_private_creators.erase(duplicates.begin(), duplicates.end());
+
+  OFLOG_INFO(anonymizerLogger, "loaded " << m_safe_private_creators.size()
+                                         << " safe private creators from `"
+                                         << filename << "`");
+  return EC_Normal;
+}
+
+void TagActionTable::setAction(const TagAction &action) {
+  const auto it = std::ranges::lower_bound(m_actions, action.tag, {},
+                                           &TagAction::tag);
+  if (it != m_actions.end() && it->tag == action.tag) {
+    *it = action; // later rules override earlier ones
+    return;
+  }
+  m_actions.insert(it, action);
+}
+
+void TagActionTable::apply(DcmItem *item, const std::string &pseudoname,
+                           const UidRemapper *uid_remapper,
+                           TagActionCounts *counts) const {
+  if (item == nullptr)
+    return;
+
+  std::vector<const TagAction *> missing{};
+  TagActionCounts applied{};
+  const DcmDataDictionary &dictionary = dcmDataDict.rdlock();
+  this->applyToItem(item, pseudoname, dictionary, uid_remapper, &missing,
+                    applied);
+  dcmDataDict.rdunlock();
+  if (counts != nullptr)
+    *counts = applied;
+
+  // empty and replaced attributes are inserted if the dataset lacks them,
+  // nested items are only cleaned; DcmTag locks the dictionary on its own
+  for (const TagAction *entry : missing) {
+    if ((entry->action != A_EMPTY && entry->action != A_REPLACE) ||
+        entry->tag.isPrivate())
+      continue;
+
+    const std::string &value =
+        entry->action == A_EMPTY
+            ? std::string{}
+            : (entry->use_pseudoname ? pseudoname : entry->value);
+    item->putAndInsertString(DcmTag(entry->tag), value.c_str());
+  }
+}
+
+void TagActionTable::applyToItem(
+    DcmItem *item, const std::string &pseudoname,
+    const DcmDataDictionary &dictionary, const UidRemapper *uid_remapper,
+    std::vector<const TagAction *> *missing, TagActionCounts &counts) const {
+  std::vector<DcmElement *> kept{};
+  std::vector<DcmElement *> rejected{};
+  kept.reserve(item->card());
+
+  auto action = m_actions.begin();
+  const auto end = m_actions.end();
+
+  // creators of the current private group, indexed by block (gggg,00xx)
+  Uint16 private_group{0};
+  std::array<bool, 256> safe_blocks{};
+
+  // detach elements front to back, taking the first list entry is O(1)
+  while (DcmElement *element = item->remove(0UL)) {
+    const DcmTagKey tag = element->getTag();
+    for (; action != end && action->tag < tag; ++action) {
+      if (missing != nullptr)
+        missing->push_back(&*action);
+    }
+
+    const TagAction *current = nullptr;
+    if (action != end && action->tag == tag)
+      current = &*action++;
+
+    bool keep{true};
+    if (tag.getGroup() & 1) {
+      if (tag.getGroup() != private_group) {
+        private_group = tag.getGroup();
+        safe_blocks.fill(false);
+      }
+
+      // groups 0001-0007 and FFFF are not valid private groups,
+      // (gggg,0001-000F) are reserved, (gggg,0000) is a group length
+      const Uint16 number = tag.getElement();
+      if (private_group <= 0x0007 || private_group == 0xFFFF ||
+          number < 0x10) {
+        keep = false;
+      } else if (number <= 0xFF) {
+        keep = this->isSafePrivateCreator(element);
+        safe_blocks[number] = keep;
+      } else {
+        keep = safe_blocks[number >> 8];
+      }
+    } else {
+      // standard tags unknown to the data dictionary
+      keep = dictionary.findEntry(tag, nullptr) != nullptr;
+    }
+
+    if (!keep || (current != nullptr && current->action == A_REMOVE)) {
+      if (current != nullptr && current->action == A_REMOVE)
+        ++counts.removed[current->source];
+      else
+        ++counts.removed[tag.getGroup() & 1 ? T_PRIVATE_TAG : T_UNKNOWN_TAG];
+      rejected.push_back(element);
+      continue;
+    }
+
+    if (current != nullptr && current->action == A_EMPTY) {
+      element->clear();
+      ++counts.emptied;
+    } else if (current != nullptr && current->action == A_REPLACE) {
+      element->putString(current->use_pseudoname ? pseudoname.c_str()
+                                                 : current->value.c_str());
+      ++counts.replaced;
+    } else if (uid_remapper != nullptr && element->ident() == EVR_UI &&
+               current == nullptr && !isClassUid(tag)) {
+      uid_remapper->remapElement(element);
+      ++counts.uids_remapped;
+    }
+
+    // depth first into sequence items, every level sees the whole table
+    if (element->ident() == EVR_SQ) {
+      auto *sequence = static_cast<DcmSequenceOfItems *>(element);
+      DcmObject *object = nullptr;
+      while ((object = sequence->nextInContainer(object)) != nullptr) {
+        this->applyToItem(static_cast<DcmItem *>(object), pseudoname,
+                          dictionary, uid_remapper, nullptr, counts);
+      }
+    }
+    kept.push_back(element);
+  }
+  if (missing != nullptr) {
+    for (; action != end; ++action)
+      missing->push_back(&*action);
+  }
+
+  // elements come back in ascending order, insert() then appends in O(1)
+  for (DcmElement *element : kept) {
+    item->insert(element);
+  }
+  for (DcmElement *element : rejected) {
+    delete element;
+  }
+}
+
+bool TagActionTable::isSafePrivateCreator(DcmElement *element) const {
+  if (m_safe_private_creators.empty())
+    return false;
+
+  OFString creator{};
+  if (element->getOFString(creator, 0, OFTrue).bad())
+    return false;
+  return std::ranges::binary_search(m_safe_private_creators,
+                                    std::string{creator});
+}
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#include "dcmtk/oflog/oflog.h"
+#include "dcmtk/ofstd/ofexit.h"
+
+#include "DatasetAnonymizer.hpp"
+#include "Sha256.hpp"
+#include "UidRemapper.hpp"
+
+namespace {
+constexpr std::size_t MAX_UID_LENGTH{64};
+constexpr std::string_view STANDARD_UID_ROOT{"1.2.840.10008."};
+
+// big endian byte string to decimal digits by repeated division by 10
+std::string toDecimal(const Sha256::Digest &digest, std::size_t bytes) {
+  std::string number(digest.begin(), digest.begin() + bytes);
+  std::string digits{};
+
+  auto isZero = [&number] {
+    return std::ranges::all_of(number, [](char c) { return c == '\0'; });
+  };
+  while (!isZero()) {
+    unsigned int remainder{0};
+    for (char &byte : number) {
+      const unsigned int value =
+          remainder << 8 | static_cast<unsigned char>(byte);
+      byte = static_cast<char>(value / 10);
+      remainder = value % 10;
+    }
+    digits.push_back(static_cast<char>('0' + remainder));
+  }
+
+  if (digits.empty())
+    digits = "0";
+  std::ranges::reverse(digits);
+  return digits;
+}
+} // namespace
+
+OFCondition UidRemapper::setup(const std::string &key_file,
+                               const std::string &uid_root) {
+  std::ifstream file{key_file, std::ios::in | std::ios::binary};
+  if (!file.is_open()) {
+    OFCondition cond{0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error,
+                     "error reading UID key file"};
+    OFLOG_ERROR(anonymizerLogger, cond.text());
+    return cond;
+  }
+
+  std::string key{std::istreambuf_iterator<char>{file},
+                  std::istreambuf_iterator<char>{}};
+  while (!key.empty() && (key.back() == '\n' || key.back() == '\r'))
+    key.pop_back();
+
+  // root, a dot and at least 20 digits of the digest
+  if (key.empty() || uid_root.size() + 1 + 20 > MAX_UID_LENGTH) {
+    OFCondition cond{0, EXITCODE_COMMANDLINE_SYNTAX_ERROR, OF_error,
+                     "empty UID key or UID root too long for keyed UIDs"};
+    OFLOG_ERROR(anonymizerLogger, cond.text());
+    return cond;
+  }
+
+  m_key = std::move(key);
+  m_uid_root = uid_root;
+  return EC_Normal;
+}
+
+std::string UidRemapper::map(const std::string &uid) const {
+  if (uid.empty() || uid.starts_with(STANDARD_UID_ROOT))
+    return uid;
+
+  // 16 bytes give up to 39 digits, the first digit is never a leading zero
+  const std::string digits = toDecimal(hmacSha256(m_key, uid), 16);
+  const std::size_t available = MAX_UID_LENGTH - m_uid_root.size() - 1;
+  return m_uid_root + "." + digits.substr(0, available);
+}
+
+void UidRemapper::remapElement(DcmElement *element) const {
+  OFString values{};
+  if (element->getOFStringArray(values).bad() || values.empty())
+    return;
+
+  std::string mapped{};
+  std::size_t begin{0};
+  while (true) {
+    const std::size_t end = values.find('\\', begin);
+    mapped += this->map(values.substr(begin, end - begin));
+    if (end == std::string::npos)
+      break;
+    mapped += '\\';
+    begin = end + 1;
+  }
+  element->putOFStringArray(mapped);
+}
@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+
+#include <fcntl.h>
+#include <liburing.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "AsyncFileIO.hpp"
+
+namespace {
+constexpr std::size_t MAX_CHUNK{1 << 30}; // io_uring lengths are 32 bit
+
+/* io_uring backend, one ring shared by all workers.
+ *
+ * Files are opened and sized synchronously, the reads, writes and output
+ * closes go through the ring. Reads are submitted at once as a worker will
+ * wait for them, writes and closes are batched and submitted together once
+ * batch_size of them are queued, at the end of a completion burst or on
+ * flush(). A single reaper thread consumes completions, resubmits short
+ * transfers and runs the callbacks.
+ */
+class UringFileIO final : public AsyncFileIO {
+public:
+  explicit UringFileIO(unsigned int queue_depth);
+  ~UringFileIO() override;
+
+  bool isValid() const { return m_valid; }
+
+  void write(const std::string &filename, std::vector<char> data,
+             WriteCallback on_written) override;
+  void flush() override;
+
+protected:
+  void submitRead(const std::string &filename,
+                  std::shared_ptr<ReadSlot> slot) override;
+
+private:
+  enum E_URING_OP { U_READ, U_WRITE, U_CLOSE, U_STOP };
+
+  struct Request {
+    E_URING_OP op{U_READ};
+    int fd{-1};
+    std::size_t done{0}; // bytes transferred so far
+    std::vector<char> *buffer{nullptr};
+    std::shared_ptr<ReadSlot> slot{}; // U_READ
+    std::vector<char> data{};         // U_WRITE
+    WriteCallback on_written{};       // U_WRITE, U_CLOSE
+  };
+
+  void queue(Request *request, bool submit_now);
+  void reap();
+  void onCompletion(Request *request, int result);
+  void finish(Request *request, const OFCondition &cond);
+
+  io_uring m_ring{};
+  bool m_valid{false};
+  unsigned int m_batch_size{1};
+
+  std::mutex m_ring_mutex; // submission side, completions are reaper only
+  unsigned int m_unsubmitted{0};
+
+  std::mutex m_pending_mutex;
+  std::condition_variable m_idle;
+  std::size_t m_pending{0};
+
+  std::thread m_reaper{};
+};
+
+UringFileIO::UringFileIO(unsigned int queue_depth)
+    : AsyncFileIO{queue_depth},
+      m_batch_size{std::max(1U, queue_depth / 2)} {
+  if (io_uring_queue_init(std::max(2U, queue_depth), &m_ring, 0) < 0)
+    return;
+  m_valid = true;
+  m_reaper = std::thread{[this] { this->reap(); }};
+}
+
+UringFileIO::~UringFileIO() {
+  if (!m_valid)
+    return;
+
+  this->flush();
+  // a request without file wakes the reaper for good
+  this->queue(new Request{U_STOP}, true);
+  m_reaper.join();
+  io_uring_queue_exit(&m_ring);
+}
+
+void UringFileIO::queue(Request *request, bool submit_now) {
+  const std::lock_guard lock{m_ring_mutex};
+
+  io_uring_sqe *sqe = io_uring_get_sqe(&m_ring);
+  while (sqe == nullptr) {
+    // submission queue full, hand it to the kernel and retry
+    io_uring_submit(&m_ring);
+    m_unsubmitted = 0;
+    std::this_thread::yield();
+    sqe = io_uring_get_sqe(&m_ring);
+  }
+
+  const std::size_t size = request->buffer ? request->buffer->size() : 0;
+  const auto length = static_cast<unsigned int>(
+      std::min(size - std::min(size, request->done), MAX_CHUNK));
+  char *position =
+      request->buffer ? request->buffer->data() + request->done : nullptr;
+
+  switch (request->op) {
+  case U_READ:
+    io_uring_prep_read(sqe, request->fd, position, length, request->done);
+    break;
+  case U_WRITE:
+    io_uring_prep_write(sqe, request->fd, position, length, request->done);
+    break;
+  case U_CLOSE:
+    io_uring_prep_close(sqe, request->fd);
+    break;
+  case U_STOP:
+    io_uring_prep_nop(sqe);
+    break;
+  }
+  io_uring_sqe_set_data(sqe, request);
+
+  if (submit_now || ++m_unsubmitted >= m_batch_size) {
+    io_uring_submit(&m_ring);
+    m_unsubmitted = 0;
+  }
+}
+
+void UringFileIO::submitRead(const std::string &filename,
+                             std::shared_ptr<ReadSlot> slot) {
+  const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat info {};
+  if (fd < 0 || ::fstat(fd, &info) != 0) {
+    if (fd >= 0)
+      ::close(fd);
+    this->completeRead(*slot, {0, 0, OF_error, "unable to open input file"});
+    return;
+  }
+
+  slot->data.resize(static_cast<std::size_t>(info.st_size));
+  if (slot->data.empty()) {
+    ::close(fd);
+    this->completeRead(*slot, EC_Normal);
+    return;
+  }
+
+  auto *request = new Request{U_READ, fd};
+  request->buffer = &slot->data;
+  request->slot = std::move(slot);
+  {
+    const std::lock_guard lock{m_pending_mutex};
+    ++m_pending;
+  }
+  this->queue(request, true);
+}
+
+void UringFileIO::write(const std::string &filename, std::vector<char> data,
+                        WriteCallback on_written) {
+  const int fd = ::open(filename.c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    on_written({0, 0, OF_error, "unable to create output file"});
+    return;
+  }
+
+  auto *request = new Request{data.empty() ? U_CLOSE : U_WRITE, fd};
+  request->data = std::move(data);
+  request->buffer = &request->data;
+  request->on_written = std::move(on_written);
+  {
+    const std::lock_guard lock{m_pending_mutex};
+    ++m_pending;
+  }
+  this->queue(request, false);
+}
+
+void UringFileIO::flush() {
+  {
+    const std::lock_guard lock{m_ring_mutex};
+    if (m_unsubmitted > 0) {
+      io_uring_submit(&m_ring);
+      m_unsubmitted = 0;
+    }
+  }
+
+  std::unique_lock lock{m_pending_mutex};
+  m_idle.wait(lock, [this] { return m_pending == 0; });
+}
+
+void UringFileIO::reap() {
+  while (true) {
+    io_uring_cqe *cqe = nullptr;
+    const int ret = io_uring_wait_cqe(&m_ring, &cqe);
+    if (ret == -EINTR)
+      continue;
+    if (ret < 0)
+      return;
+
+    auto *request = static_cast<Request *>(io_uring_cqe_get_data(cqe));
+    const int result = cqe->res;
+    io_uring_cqe_seen(&m_ring, cqe);
+
+    if (request->op == U_STOP) {
+      delete request;
+      return;
+    }
+    this->onCompletion(request, result);
+
+    // end of a completion burst, closes queued by it go out together
+    io_uring_cqe *next = nullptr;
+    if (io_uring_peek_cqe(&m_ring, &next) != 0) {
+      const std::lock_guard lock{m_ring_mutex};
+      if (m_unsubmitted > 0) {
+        io_uring_submit(&m_ring);
+        m_unsubmitted = 0;
+      }
+    }
+  }
+}
+
+void UringFileIO::onCompletion(Request *request, int result) {
+  if (result == -EINTR || result == -EAGAIN) {
+    this->queue(request, true);
+    return;
+  }
+
+  if (request->op == U_CLOSE) {
+    request->fd = -1;
+    this->finish(request,
+                 result < 0 ? OFCondition{0, 0, OF_error,
+                                          "error closing output file"}
+                            : EC_Normal);
+    return;
+  }
+
+  if (result <= 0) {
+    this->finish(request, {0, 0, OF_error,
+                           request->op == U_READ ? "error reading input file"
+                                                 : "error writing output file"});
+    return;
+  }
+
+  request->done += static_cast<std::size_t>(result);
+  if (request->done < request->buffer->size()) {
+    this->queue(request, true); // short transfer, continue where it stopped
+    return;
+  }
+
+  if (request->op == U_WRITE) {
+    // closes are batched with the writes of other files
+    request->op = U_CLOSE;
+    this->queue(request, false);
+    return;
+  }
+  this->finish(request, EC_Normal);
+}
+
+void UringFileIO::finish(Request *request, const OFCondition &cond) {
+  if (request->fd >= 0)
+    ::close(request->fd);
+
+  if (request->slot)
+    this->completeRead(*request->slot, cond);
+  else if (request->on_written)
+    request->on_written(cond);
+  delete request;
+
+  {
+    const std::lock_guard lock{m_pending_mutex};
+    --m_pending;
+  }
+  m_idle.notify_all();
+}
+} // namespace
+
+std::unique_ptr<AsyncFileIO> createUringFileIO(unsigned int queue_depth) {
+  auto uring = std::make_unique<UringFileIO>(queue_depth);
+  if (!uring->isValid())
+    return nullptr;
+  return uring;
+}
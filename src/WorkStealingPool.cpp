@@ -0,0 +1,105 @@
+#include "WorkStealingPool.hpp"
+
+namespace {
+// identifies the pool and deque of the calling worker thread
+thread_local const WorkStealingPool *t_pool{nullptr};
+thread_local std::size_t t_worker_index{0};
+} // namespace
+
+WorkStealingPool::WorkStealingPool(unsigned int worker_count) {
+  if (worker_count == 0)
+    worker_count = 1;
+
+  m_queues.reserve(worker_count);
+  for (unsigned int i = 0; i < worker_count; ++i) {
+    m_queues.push_back(std::make_unique<TaskQueue>());
+  }
+
+  m_workers.reserve(worker_count);
+  for (std::size_t i = 0; i < worker_count; ++i) {
+    m_workers.emplace_back(
+        [this, i](const std::stop_token &stop) { this->workerLoop(i, stop); });
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  for (auto &worker : m_workers) {
+    worker.request_stop();
+  }
+  m_wake.notify_all();
+  m_workers.clear();
+}
+
+void WorkStealingPool::submit(Task task) {
+  TaskQueue &queue =
+      t_pool == this ? *m_queues[t_worker_index] : m_injected;
+  {
+    const std::lock_guard lock{queue.mutex};
+    queue.tasks.push_back(std::move(task));
+  }
+  {
+    // pairs with the predicate check in workerLoop, prevents lost wake-ups
+    const std::lock_guard lock{m_wake_mutex};
+    m_pending.fetch_add(1, std::memory_order_release);
+  }
+  m_wake.notify_one();
+}
+
+bool WorkStealingPool::popLocal(std::size_t worker_index, Task &task) {
+  TaskQueue &queue = *m_queues[worker_index];
+  const std::lock_guard lock{queue.mutex};
+  if (queue.tasks.empty())
+    return false;
+
+  task = std::move(queue.tasks.back());
+  queue.tasks.pop_back();
+  return true;
+}
+
+bool WorkStealingPool::steal(std::size_t worker_index, Task &task) {
+  for (std::size_t offset = 1; offset < m_queues.size(); ++offset) {
+    TaskQueue &victim = *m_queues[(worker_index + offset) % m_queues.size()];
+    const std::unique_lock lock{victim.mutex, std::try_to_lock};
+    if (!lock.owns_lock() || victim.tasks.empty())
+      continue;
+
+    task = std::move(victim.tasks.front());
+    victim.tasks.pop_front();
+    return true;
+  }
+  return false;
+}
+
+bool WorkStealingPool::popInjected(Task &task) {
+  const std::lock_guard lock{m_injected.mutex};
+  if (m_injected.tasks.empty())
+    return false;
+
+  task = std::move(m_injected.tasks.front());
+  m_injected.tasks.pop_front();
+  return true;
+}
+
+void WorkStealingPool::workerLoop(std::size_t worker_index,
+                                  const std::stop_token &stop) {
+  t_pool = this;
+  t_worker_index = worker_index;
+
+  Task task{};
+  while (!stop.stop_requested()) {
+    if (popLocal(worker_index, task) || steal(worker_index, task) ||
+        popInjected(task)) {
+      m_pending.fetch_sub(1, std::memory_order_acq_rel);
+      task();
+      task = nullptr;
+      continue;
+    }
+
+    // a steal may fail on a contended deque while tasks are still pending,
+    // only sleep once nothing is queued anywhere
+    std::unique_lock lock{m_wake_mutex};
+    m_wake.wait(lock, stop, [this] {
+      return m_pending.load(std::memory_order_acquire) > 0;
+    });
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef ARCHIVEREADER_HPP
+#define ARCHIVEREADER_HPP
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+struct archive;
+
+/* Sequential reader of the regular members of a tar or zip archive.
+ *
+ * Backed by libarchive (tar with gzip, bzip2, xz or zstd compression, zip
+ * stored or deflated), members are decompressed straight into memory and
+ * never extracted to disk. Built without libarchive open() fails.
+ */
+class ArchiveReader {
+public:
+  ArchiveReader() = default;
+  ~ArchiveReader();
+  ArchiveReader(const ArchiveReader &) = delete;
+  ArchiveReader &operator=(const ArchiveReader &) = delete;
+
+  // by file name: .tar, .tar.gz, .tgz, .tar.bz2, .tar.xz, .tar.zst, .zip
+  static bool isArchive(const std::filesystem::path &path);
+
+  OFCondition open(const std::string &filename);
+  // next regular member, false at the end of the archive or on error
+  bool next(std::string &name, std::vector<char> &data);
+  // error that ended next(), EC_Normal at the end of the archive
+  const OFCondition &status() const { return m_status; }
+
+private:
+  struct archive *m_archive{nullptr};
+  std::string m_filename{};
+  OFCondition m_status{};
+};
+
+#endif // ARCHIVEREADER_HPP
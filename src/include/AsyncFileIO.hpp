@@ -0,0 +1,77 @@
+#ifndef ASYNCFILEIO_HPP
+#define ASYNCFILEIO_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+enum E_IO_BACKEND {
+  I_SYNC,    // DCMTK file streams on the calling thread
+  I_THREADS, // dedicated I/O threads with blocking calls
+  I_URING    // io_uring, falls back to I_THREADS when not available
+};
+
+/* Whole-file reads ahead of use and fire-and-forget whole-file writes.
+ *
+ * prefetch() starts reading an input in the background, take() waits for it
+ * (or reads it right away when it was never prefetched) and hands over the
+ * bytes. write() queues a serialized output file, the callback runs on an
+ * I/O thread once the file is written and closed. At most max_prefetch
+ * inputs are held at once, further prefetch() calls are ignored until
+ * take() frees a slot, bounding memory use.
+ */
+class AsyncFileIO {
+public:
+  using WriteCallback = std::function<void(const OFCondition &)>;
+
+  explicit AsyncFileIO(unsigned int max_prefetch)
+      : m_max_prefetch{max_prefetch} {}
+  virtual ~AsyncFileIO() = default;
+  AsyncFileIO(const AsyncFileIO &) = delete;
+  AsyncFileIO &operator=(const AsyncFileIO &) = delete;
+
+  // I_URING without io_uring support returns the thread backend
+  static std::unique_ptr<AsyncFileIO> create(E_IO_BACKEND backend,
+                                             unsigned int queue_depth);
+
+  void prefetch(const std::string &filename);
+  OFCondition take(const std::string &filename, std::vector<char> &data);
+  // forget a prefetched file that will not be taken, frees its slot
+  void discard(const std::string &filename);
+
+  virtual void write(const std::string &filename, std::vector<char> data,
+                     WriteCallback on_written) = 0;
+  // submits writes still batched and waits for every queued write
+  virtual void flush() = 0;
+
+protected:
+  struct ReadSlot {
+    std::vector<char> data{};
+    OFCondition cond{};
+    bool done{false}; // guarded by m_read_mutex
+  };
+
+  virtual void submitRead(const std::string &filename,
+                          std::shared_ptr<ReadSlot> slot) = 0;
+  void completeRead(ReadSlot &slot, const OFCondition &cond);
+
+private:
+  unsigned int m_max_prefetch{0};
+  std::mutex m_read_mutex;
+  std::condition_variable m_read_done;
+  std::unordered_map<std::string, std::shared_ptr<ReadSlot>> m_reads{};
+};
+
+// blocking whole-file helpers shared by the backends
+OFCondition readWholeFile(const std::string &filename, std::vector<char> &data);
+OFCondition writeWholeFile(const std::string &filename,
+                           const std::vector<char> &data);
+
+#endif // ASYNCFILEIO_HPP
@@ -0,0 +1,136 @@
+#ifndef ASYNCLOGGER_HPP
+#define ASYNCLOGGER_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "fmt/format.h"
+
+#include "dcmtk/oflog/oflog.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+enum E_LOG_LEVEL {
+  V_DEBUG,
+  V_INFO,
+  V_WARN,
+  V_ERROR,
+  V_CONSOLE // progress printed on stdout, never filtered
+};
+
+/* Logger of the anonymization hot path.
+ *
+ * log() checks the level before anything is formatted, formats into a slot
+ * of a fixed ring buffer and returns; writing to the console and the JSON
+ * sink happens on one background thread, in batches. Producers claim slots
+ * with a compare-and-swap on the tail and publish them through a per-slot
+ * sequence number, so workers never share a lock; when the ring is full they
+ * yield until the flusher catches up, records are not dropped. Messages
+ * longer than a slot are truncated.
+ *
+ * Text output follows the dcmtk console format (`W: message` on stderr), or
+ * goes through the appenders of a dcmtk logger configured by --log-config;
+ * V_CONSOLE records go to stdout as they are. The optional JSON lines sink
+ * gets every record as {"time", "level", "thread", "message"}. Before
+ * start() and once stop() closed the ring, which sets a bit in the tail so
+ * no slot is claimed after the final drain, records are written
+ * synchronously by the caller.
+ */
+class AsyncLogger {
+public:
+  static constexpr std::size_t MESSAGE_SIZE{1000};
+  static constexpr std::size_t CAPACITY{2048}; // slots, power of two
+
+  AsyncLogger();
+  ~AsyncLogger();
+  AsyncLogger(const AsyncLogger &) = delete;
+  AsyncLogger &operator=(const AsyncLogger &) = delete;
+
+  // json_file: additional JSON lines sink, `-` replaces the text output
+  // with JSON lines on stdout; appenders: logger whose appenders write the
+  // text records instead of stderr; call before any worker logs
+  OFCondition start(E_LOG_LEVEL level, const std::string &json_file = {},
+                    const OFLogger *appenders = nullptr);
+  void stop(); // writes everything logged so far
+  void flush();
+
+  bool isEnabled(E_LOG_LEVEL level) const {
+    return level >= m_level.load(std::memory_order_relaxed);
+  }
+
+  template <typename... Args>
+  void log(E_LOG_LEVEL level, fmt::format_string<Args...> format,
+           Args &&...args) {
+    if (!this->isEnabled(level))
+      return;
+    if (Slot *slot = this->claim()) {
+      formatMessage(*slot, format, std::forward<Args>(args)...);
+      this->publish(*slot, level);
+      return;
+    }
+
+    // ring closed, formatted on the caller's stack and written right away
+    Slot slot{};
+    formatMessage(slot, format, std::forward<Args>(args)...);
+    this->writeNow(slot, level);
+  }
+
+  // level of the dcmtk logger as configured by --log-level / --log-config
+  static E_LOG_LEVEL levelOf(const OFLogger &logger);
+
+private:
+  struct Slot {
+    std::atomic<std::uint64_t> sequence{0};
+    E_LOG_LEVEL level{V_INFO};
+    std::int64_t time_us{0}; // since the epoch
+    unsigned int thread{0};
+    std::size_t size{0};
+    std::array<char, MESSAGE_SIZE> message{};
+  };
+
+  static constexpr std::uint64_t CLOSED{std::uint64_t{1} << 63}; // in m_tail
+
+  template <typename... Args>
+  static void formatMessage(Slot &slot, fmt::format_string<Args...> format,
+                            Args &&...args) {
+    const auto result = fmt::format_to_n(slot.message.data(), MESSAGE_SIZE,
+                                         format, std::forward<Args>(args)...);
+    slot.size = std::min(result.size, MESSAGE_SIZE);
+  }
+
+  Slot *claim(); // nullptr while the ring is closed
+  static void stamp(Slot &slot, E_LOG_LEVEL level);
+  void publish(Slot &slot, E_LOG_LEVEL level);
+  void writeNow(Slot &slot, E_LOG_LEVEL level);
+  void run(const std::stop_token &stop);
+  std::size_t drain(); // flusher thread only
+  void format(const Slot &slot);
+  void write();
+
+  std::unique_ptr<Slot[]> m_slots{};
+  alignas(64) std::atomic<std::uint64_t> m_tail{CLOSED};
+  alignas(64) std::uint64_t m_head{0}; // flusher thread only
+  std::atomic<std::uint64_t> m_written{0};
+  std::atomic<E_LOG_LEVEL> m_level{V_WARN};
+  std::atomic<bool> m_running{false};
+
+  std::mutex m_output_mutex; // sinks and buffers, flusher and writeNow()
+  bool m_text{true};
+  const OFLogger *m_appenders{nullptr};
+  std::FILE *m_json{nullptr};
+  std::string m_stdout{};
+  std::string m_stderr{};
+  std::string m_json_lines{};
+  std::jthread m_flusher{};
+};
+
+#endif // ASYNCLOGGER_HPP
@@ -0,0 +1,69 @@
+#ifndef BOUNDEDQUEUE_HPP
+#define BOUNDEDQUEUE_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+/* Blocking FIFO between a producer and consumer threads.
+ *
+ * push() waits while the queue holds capacity items, so a producer can run
+ * at most capacity items ahead of its consumers. pop() waits for an item and
+ * returns false once the queue is closed and drained.
+ */
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(std::size_t capacity)
+      : m_capacity{std::max<std::size_t>(capacity, 1)} {}
+
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  // false when the queue was closed
+  bool push(T item) {
+    std::unique_lock lock{m_mutex};
+    m_not_full.wait(lock,
+                    [this] { return m_closed || m_items.size() < m_capacity; });
+    if (m_closed)
+      return false;
+    m_items.push_back(std::move(item));
+    lock.unlock();
+    m_not_empty.notify_one();
+    return true;
+  }
+
+  bool pop(T &item) {
+    std::unique_lock lock{m_mutex};
+    m_not_empty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+    if (m_items.empty())
+      return false;
+    item = std::move(m_items.front());
+    m_items.pop_front();
+    lock.unlock();
+    m_not_full.notify_one();
+    return true;
+  }
+
+  // consumers drain the remaining items, further pushes fail
+  void close() {
+    {
+      const std::lock_guard lock{m_mutex};
+      m_closed = true;
+    }
+    m_not_full.notify_all();
+    m_not_empty.notify_all();
+  }
+
+private:
+  const std::size_t m_capacity;
+  std::mutex m_mutex;
+  std::condition_variable m_not_full;
+  std::condition_variable m_not_empty;
+  std::deque<T> m_items{};
+  bool m_closed{false};
+};
+
+#endif // BOUNDEDQUEUE_HPP
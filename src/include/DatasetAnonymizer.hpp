@@ -0,0 +1,172 @@
+#ifndef DATASETANONYMIZER_HPP
+#define DATASETANONYMIZER_HPP
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/oflog/oflog.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "AsyncLogger.hpp"
+#include "PixelEncoder.hpp"
+#include "PixelMaskTable.hpp"
+#include "PseudonameTable.hpp"
+#include "PseudonameVault.hpp"
+#include "RunMetrics.hpp"
+#include "TagActionTable.hpp"
+#include "UidRemapper.hpp"
+
+// dcmtk logger of the rules, masks and keys loaded by setup(), a child of
+// the root logger the application configures
+extern OFLogger anonymizerLogger;
+
+enum E_PSEUDONAME_TYPE { P_RANDOM_STRING, P_INTEGER_ORDER, P_FROM_FILE };
+
+// everything read from files is loaded once by DatasetAnonymizer::setup()
+struct AnonymizerOptions {
+  std::string pseudoname_prefix{};
+  E_PSEUDONAME_TYPE pseudoname_type{P_RANDOM_STRING};
+  unsigned short count_width{2}; // digits of P_INTEGER_ORDER pseudonames
+  std::string pseudoname_file{}; // P_FROM_FILE
+  bool pseudoname_index{false};  // keep `<pseudoname_file>.fnoidx`
+  std::string pseudoname_vault{};
+  std::string uid_root{"1.2.840.113619.2"};
+  std::string uid_key_file{}; // keyed UIDs, random otherwise
+  std::set<E_ADDIT_ANONYM_METHODS> methods{};
+  std::string tag_rule_file{};
+  std::string safe_private_file{};
+  std::string pixel_mask_file{};
+  E_PIXEL_CODEC pixel_codec{X_KEEP};
+  unsigned int encode_threads{1};
+  // studies remembered by anonymize(), least recently used ones are
+  // forgotten first, 0: all
+  std::size_t max_studies{0};
+  // sink of the messages of setup() and anonymize(), none without
+  AsyncLogger *logger{nullptr};
+};
+
+// identity of one anonymized dataset, before and after
+struct AnonymizedDataset {
+  std::string old_patient_id{};
+  std::string old_patient_name{};
+  std::string old_study_uid{};
+  std::string old_series_uid{};
+  std::string study_date{};
+  std::string pseudoname{};
+  std::string new_study_uid{};
+  std::string new_series_uid{};
+  std::string new_sop_instance_uid{};
+  bool pixels_masked{false};
+  bool pixels_encoded{false};
+  bool new_study{false}; // first dataset of its study since it was forgotten
+};
+
+// pseudoname and new StudyInstanceUID of a study, decided by the caller
+struct DatasetStudy {
+  std::string_view pseudoname{};
+  std::string_view new_study_uid{};
+  // new SeriesInstanceUID of an old one, used when UIDs are not keyed
+  std::function<std::string(const std::string &)> series_uid{};
+};
+
+/* De-identification of datasets in memory, the library part of fnodcmanon.
+ *
+ * setup() loads rules, keys, masks and pseudoname files once; afterwards
+ * anonymize() may be called from any number of threads and touches no file
+ * except an opened pseudoname vault, which records new patients. Calls with
+ * the same old StudyInstanceUID share one pseudoname and one new study UID,
+ * and the series of a study keep one new series UID each, until
+ * forgetStudies() or until the study is the least recently used one beyond
+ * max_studies. Random pseudonames come from a generator of the instance.
+ * StudyAnonymizer drives the same steps through process() for files.
+ */
+class DatasetAnonymizer {
+public:
+  DatasetAnonymizer() = default;
+  DatasetAnonymizer(const DatasetAnonymizer &) = delete;
+  DatasetAnonymizer &operator=(const DatasetAnonymizer &) = delete;
+
+  OFCondition setup(const AnonymizerOptions &options);
+  const AnonymizerOptions &options() const { return m_options; }
+
+  OFCondition anonymize(DcmDataset *dataset, AnonymizedDataset &result) const;
+  // also updates the SOP instance of the meta header
+  OFCondition anonymize(DcmFileFormat &fileformat,
+                        AnonymizedDataset &result) const;
+  // a DICOM file (preamble and meta header) in memory, output in the same
+  // transfer syntax unless pixel data is encoded
+  OFCondition anonymize(const char *data, std::size_t size,
+                        std::vector<char> &output,
+                        AnonymizedDataset &result) const;
+  void forgetStudies();
+  // callers add the stages they run around anonymize(), e.g. writing
+  RunMetrics &metrics() const { return m_metrics; }
+
+  // study_index: position of the study, numbers P_INTEGER_ORDER pseudonames
+  std::string pseudoname(const std::string &patient_id,
+                         unsigned int study_index) const;
+  std::string newStudyUid(const std::string &old_study_uid) const;
+  // mask, tag actions, UIDs and encoding of one dataset of study;
+  // encode_pixels: false where the pixel data is not in memory
+  OFCondition process(DcmDataset *dataset, const DatasetStudy &study,
+                      bool encode_pixels, RunMetrics &metrics,
+                      AnonymizedDataset &result,
+                      std::string_view name = {}) const;
+
+private:
+  struct StudyMapping {
+    unsigned int index{0};                    // m_studies_mutex held
+    std::list<std::string>::iterator order{}; // in m_study_order, same
+    std::once_flag decided;                   // pseudoname and study UID
+    std::string pseudoname{};
+    std::string new_study_uid{};
+    std::mutex series_mutex;
+    std::unordered_map<std::string, std::string> series_uids{};
+  };
+
+  template <typename... Args>
+  void log(E_LOG_LEVEL level, fmt::format_string<Args...> format,
+           Args &&...args) const {
+    if (m_options.logger != nullptr)
+      m_options.logger->log(level, format, std::forward<Args>(args)...);
+  }
+
+  std::string randomString() const;
+  std::string vaultPseudoname(const std::string &patient_id,
+                              const std::function<std::string()> &generate)
+      const;
+  OFCondition readPseudonamesFromFile(const std::string &filename,
+                                      bool use_index);
+
+  AnonymizerOptions m_options{};
+  TagActionTable m_tag_actions{};
+  PixelMaskTable m_pixel_masks{};
+  UidRemapper m_uid_remapper{}; // keyed UIDs when enabled, random otherwise
+  std::unique_ptr<PixelEncoder> m_pixel_encoder{}; // nullptr keeps the input
+  PseudonameTable m_pseudonames{}; // PatientID -> pseudoname, P_FROM_FILE
+  mutable PseudonameVault m_vault{}; // locks internally
+  mutable RunMetrics m_metrics{};  // of anonymize() calls
+
+  mutable std::mutex m_rng_mutex;
+  mutable std::mt19937_64 m_rng{std::random_device{}()};
+
+  mutable std::mutex m_studies_mutex;
+  mutable std::unordered_map<std::string, std::shared_ptr<StudyMapping>>
+      m_studies{};
+  mutable std::list<std::string> m_study_order{}; // most recently used first
+  mutable unsigned int m_study_count{0}; // numbers P_INTEGER_ORDER studies
+};
+
+#endif // DATASETANONYMIZER_HPP
@@ -5,8 +5,12 @@
 #ifndef DICOMANONYMIZER_HPP
 #define DICOMANONYMIZER_HPP
 
+#include <atomic>
+#include <cstdint>
 #include <filesystem>
-#include <set>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <unordered_map>
@@ -16,74 +20,150 @@
 #include "dcmtk/dcmdata/dcfilefo.h"
 #include "dcmtk/ofstd/ofcond.h"
 
-extern OFLogger mainLogger;
-
-void setupLogger(std::string_view logger_name);
+#include "AsyncFileIO.hpp"
+#include "DatasetAnonymizer.hpp"
+#include "DicomIO.hpp"
+#include "MemoryBudget.hpp"
+#include "ProcessingJournal.hpp"
+#include "RunMetrics.hpp"
+#include "StudyArchiveWriter.hpp"
+#include "StudyScanner.hpp"
 
 enum E_FILENAMES { F_HEX, F_MODALITY_SOPINSTUID };
 
-enum E_ADDIT_ANONYM_METHODS {
-  // https://dicom.nema.org/medical/dicom/current/output/chtml/part16/chapter_D.html#DCM_113100
-  M_113108, // Retain Patient Characteristics Option
-  M_113109, // Retain Device Identity Option
-  M_113112  // Retain Institution Identity Option
+// byte range of an input file copied verbatim behind the rewritten header
+struct PassThroughRange {
+  std::string source{};
+  std::uint64_t offset{0};
+  bool enabled{false};
 };
 
-enum E_PSEUDONAME_TYPE { P_RANDOM_STRING, P_INTEGER_ORDER, P_FROM_FILE };
+// per-study state, one instance for every anonymized study directory
+struct StudyContext {
+  std::filesystem::path input_directory{};
+  std::string study_key{}; // journal key, directory or scanned StudyInstanceUID
+  unsigned int study_index{0}; // position of the study in directory order
+
+  std::string pseudoname{};
+  std::string old_name{};
+  std::string old_id{};
+  std::string old_studyuid{};
+  std::string new_studyuid{};
+  std::string study_date{};
+  std::string output_study_dir{};
+  std::unique_ptr<StudyArchiveWriter> archive{}; // O_TAR and O_TAR_ZSTD only
+  std::atomic<unsigned int> files_skipped{0}; // unchanged since journaled
+
+  std::mutex series_uids_mutex;
+  std::unordered_map<std::string, std::string>
+      series_uids{}; // unordered_map[old_uid, new_uid]
+};
 
 class StudyAnonymizer {
 public:
-  StudyAnonymizer() = default;
-  StudyAnonymizer(const std::string &pseudoname_prefix,
-                  E_PSEUDONAME_TYPE pseudoname_type = P_RANDOM_STRING)
-      : m_pseudoname_prefix{pseudoname_prefix},
-        m_pseudoname_type{pseudoname_type} {};
+  // called once per study, in the order of the input study directories
+  using StudyCallback =
+      std::function<void(const StudyContext &, const OFCondition &)>;
 
+  StudyAnonymizer() = default;
   ~StudyAnonymizer() = default;
 
-  OFCondition findDicomFiles(const std::filesystem::path &study_directory);
-
-  OFCondition anonymizeStudy(const std::filesystem::path &study_directory,
-                             const std::string &output_directory,
-                             const std::set<E_ADDIT_ANONYM_METHODS> &methods,
-                             const std::string &uid_root);
-  void anonymizeBasicProfile();
-  void anonymizePatientCharacteristicsProfile();
-  void anonymizeInstitutionProfile();
-  void anonymizeDeviceProfile();
-  void setPseudoname();
-
-  std::string getSeriesUids(const std::string &old_series_uid,
-                            const char *root = nullptr);
-
-  OFCondition readPseudonamesFromFile(const std::string &filename);
-  OFCondition removeInvalidTags() const;
-  OFCondition setBasicTags();
-  OFCondition writeDicomFile();
-  OFCondition writeTags() const;
+  // pseudonames, tag actions, UIDs, masks and encoding of every dataset
+  OFCondition setup(const AnonymizerOptions &options);
+
+  // calls on_file for every DICOM file below directory until it returns false
+  OFCondition
+  walkDicomFiles(const std::filesystem::path &directory,
+                 const std::function<bool(const std::string &)> &on_file) const;
+  OFCondition scanStudies(const std::filesystem::path &root,
+                          std::vector<StudyInput> &studies) const;
+  // studies anonymizeStudies() opens for archive, one per StudyInstanceUID;
+  // decompresses the whole archive
+  OFCondition countArchiveStudies(const std::filesystem::path &archive,
+                                  std::size_t &count) const;
+
+  // discovery walks one study after another and queues every file as soon
+  // as it is found, m_jobs workers drain the bounded queue; anonymization
+  // starts with the first file and memory does not grow with the input;
+  // archive members are queued with their content
+  void anonymizeStudies(std::vector<StudyInput> studies,
+                        const std::string &output_directory,
+                        const std::string &uid_root,
+                        const StudyCallback &on_study_finished);
+  OFCondition prepareStudy(StudyContext &study,
+                           const std::string &output_directory);
+  // member: content of an archive member, file is then its virtual path;
+  // lease: memory budget taken for the file, shrunk once it is loaded and
+  // taken over by an asynchronous write until the output is on disk;
+  // on_written: taken over (left empty) by an asynchronous write and called
+  // with its result, unless the file fails before the write is queued
+  OFCondition
+  anonymizeFile(StudyContext &study, const std::string &file,
+                unsigned int file_index, const std::string &uid_root,
+                std::vector<char> *member = nullptr,
+                MemoryBudget::Lease *lease = nullptr,
+                AsyncFileIO::WriteCallback *on_written = nullptr) const;
+  // keep_large_values: values above DCMTK's read length limit stay in the
+  // file until they are written
+  OFCondition loadDicomFile(const std::string &file, DcmFileFormat &fileformat,
+                            PassThroughRange &pass_through,
+                            bool keep_large_values = false) const;
+  OFCondition loadFileFromMemory(const std::string &file, const char *data,
+                                 std::size_t size, DcmFileFormat &fileformat,
+                                 PassThroughRange &pass_through) const;
+  void setupIoBackend(E_IO_BACKEND backend, unsigned int queue_depth);
+  // --max-inflight-bytes, 0: unlimited; set m_jobs first
+  void setMemoryBudget(std::uint64_t bytes);
+  OFCondition openJournal(const std::string &output_directory, bool resume);
+
+  static std::string getSeriesUids(StudyContext &study,
+                                   const std::string &old_series_uid,
+                                   const char *root = nullptr);
+
+  OFCondition setBasicTags(StudyContext &study, const std::string &file) const;
+  std::string outputFilePath(const StudyContext &study, DcmDataset *dataset,
+                             unsigned int file_index) const;
+  OFCondition writeDicomFile(const std::string &path, DcmFileFormat &fileformat,
+                             const PassThroughRange &pass_through = {},
+                             const std::vector<char> *input = nullptr,
+                             bool keep_large_values = false) const;
+  OFCondition writeDicomFileAsync(const std::string &path,
+                                  DcmFileFormat &fileformat,
+                                  const PassThroughRange &pass_through,
+                                  const std::vector<char> &input,
+                                  MemoryBudget::Lease lease,
+                                  AsyncFileIO::WriteCallback on_written) const;
+  OFCondition writeTags(const StudyContext &study) const;
+
+  const RunMetrics &metrics() const { return m_metrics; }
 
   E_FILENAMES m_filename_type{F_HEX};
-  E_PSEUDONAME_TYPE m_pseudoname_type{P_RANDOM_STRING};
-  unsigned int m_study_count{1};
-  unsigned short m_count_width{2};
-  std::string m_pseudoname_prefix{};
-
-  std::string m_pseudoname{};
-  std::string m_old_name{};
-  std::string m_old_id{};
-  std::string m_old_studyuid{};
-  std::string m_new_studyuid{};
-  std::string m_study_date{};
-  std::string m_output_study_dir{};
+  E_OUTPUT_FORMAT m_output_format{O_FILES};
+  unsigned int m_jobs{1}; // worker threads shared by all studies and files
+  bool m_stream_pixel_data{false}; // rewrite header, copy pixel data as is
+  bool m_mmap_input{false};        // parse inputs from a file mapping
+  bool m_mmap_huge_pages{false};   // ask for huge pages on the mapping
 
 private:
-  unsigned int m_files_processed{0};
-  std::vector<std::string> m_dicom_files{};
-  std::unordered_map<std::string, std::string>
-      m_series_uids{}; // unordered_map[old_uid, new_uid]
-  std::unordered_map<std::string, std::string> m_id_pseudoname_map{};
-  DcmFileFormat m_fileformat;
-  DcmDataset *m_dataset{nullptr};
+  OFCondition encodeDicomFile(DcmFileFormat &fileformat,
+                              const PassThroughRange &pass_through,
+                              const std::vector<char> &input,
+                              std::vector<char> &output) const;
+  void journalFile(const std::string &study_dir, const std::string &file,
+                   JournalFileRecord record) const;
+  // above its share of the memory budget, streamed from disk
+  bool isLargeFile(std::uint64_t size) const {
+    return m_memory_budget.isLimited() && size > m_large_file_size;
+  }
+
+  DatasetAnonymizer m_dataset_anonymizer{};
+  ProcessingJournal m_journal{};
+  std::unique_ptr<AsyncFileIO> m_async_io{}; // nullptr for synchronous I/O
+  mutable RunMetrics m_metrics{}; // recorded by const workers, atomics only
+  unsigned int m_prefetch_depth{0};
+  std::atomic<unsigned int> m_files_processed{0};
+  MemoryBudget m_memory_budget{};
+  std::uint64_t m_large_file_size{0};
 };
 
 #endif // DICOMANONYMIZER_HPP
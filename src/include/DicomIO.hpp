@@ -0,0 +1,65 @@
+#ifndef DICOMIO_HPP
+#define DICOMIO_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+/* Read-only view of a whole input file.
+ *
+ * On Linux the file is mmap()ed with MADV_SEQUENTIAL so the kernel reads
+ * ahead aggressively, huge_pages additionally asks for transparent huge pages
+ * (honoured for file mappings only where the kernel and filesystem support
+ * it). Parsing from the mapping saves the read() calls and the copy into the
+ * DCMTK file stream buffer. Other platforms read the file into memory.
+ */
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  OFCondition open(const std::string &filename, bool huge_pages = false);
+
+  const char *data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+
+private:
+  const char *m_data{nullptr};
+  std::size_t m_size{0};
+  std::vector<char> m_buffer{}; // platforms without mmap()
+};
+
+// parse a complete DICOM Part 10 byte sequence held in memory
+OFCondition readFileFormatFromBuffer(DcmFileFormat &fileformat,
+                                     const char *data, std::size_t size);
+
+// serialize a complete DICOM Part 10 file into memory, same encoding options
+// as DcmFileFormat::saveFile()
+OFCondition writeFileFormatToBuffer(DcmFileFormat &fileformat,
+                                    E_TransferSyntax xfer,
+                                    E_EncodingType encoding,
+                                    E_GrpLenEncoding group_length,
+                                    std::vector<char> &buffer);
+
+// bytes of the element values held in memory, values DCMTK left in the file
+// (longer than the read length limit) are not counted
+std::uint64_t loadedValueBytes(DcmObject *object);
+
+// 128 byte preamble followed by "DICM", as every DICOM Part 10 file starts
+bool hasDicomMagic(const std::string &filename);
+
+// append bytes [offset, end of file) of source to buffer
+OFCondition readFileRange(const std::string &source, std::uint64_t offset,
+                          std::vector<char> &buffer);
+
+// append bytes [offset, end of file) of source to the end of destination
+OFCondition appendFileRange(const std::string &source, std::uint64_t offset,
+                            const std::string &destination);
+
+#endif // DICOMIO_HPP
@@ -0,0 +1,64 @@
+#ifndef DICOMPROBE_HPP
+#define DICOMPROBE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "dcmtk/dcmdata/dctagkey.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+struct DicomProbeResult {
+  std::string transfer_syntax{}; // (0002,0010) TransferSyntaxUID
+  std::uint64_t dataset_offset{0}; // first byte after the meta header
+  std::uint64_t stop_offset{0};    // first top level element not parsed
+  bool stop_tag_found{false};
+  bool stop_tag_last{false}; // nothing follows the stop tag element
+  std::map<DcmTagKey, std::string> values{}; // requested top level values
+};
+
+/* Minimal DICOM Part 10 walker reading element headers only.
+ *
+ * Checks the 128 byte preamble and "DICM" magic, reads the meta header and
+ * walks top level dataset elements without loading their values, skipping
+ * sequences and encapsulated pixel data item by item. Parsing stops at the
+ * first top level element with tag >= stop_tag, or after the last requested
+ * tag when no stop tag is given. A found stop tag element is skipped to tell
+ * whether anything follows it. Deflated transfer syntaxes are rejected.
+ */
+class DicomProbe {
+public:
+  explicit DicomProbe(const std::string &filename);
+  DicomProbe(const char *data, std::size_t size);
+
+  OFCondition probe(const std::vector<DcmTagKey> &tags,
+                    const DcmTagKey &stop_tag, DicomProbeResult &result);
+
+private:
+  struct ElementHeader {
+    DcmTagKey tag{};
+    std::uint32_t length{0};
+  };
+
+  bool read(void *buffer, std::size_t size);
+  bool skip(std::uint64_t size);
+  std::uint64_t tell();
+  bool seek(std::uint64_t offset);
+
+  std::uint16_t toUint16(const unsigned char *bytes) const;
+  std::uint32_t toUint32(const unsigned char *bytes) const;
+  bool readElementHeader(ElementHeader &header, bool explicit_vr);
+  bool isLastElement(const ElementHeader &header, bool explicit_vr);
+  bool skipUndefinedLength(bool explicit_vr, unsigned int depth);
+
+  std::ifstream m_file{};
+  const char *m_data{nullptr};
+  std::size_t m_size{0}; // of the data or the file
+  std::size_t m_position{0};
+  bool m_big_endian{false};
+};
+
+#endif // DICOMPROBE_HPP
@@ -0,0 +1,23 @@
+#ifndef MAINLOGGER_HPP
+#define MAINLOGGER_HPP
+
+#include <string_view>
+
+#include "dcmtk/oflog/oflog.h"
+
+#include "AsyncLogger.hpp"
+
+// loggers of the fnodcmanon executable and its pipelines, the library gets
+// its sink through AnonymizerOptions::logger
+extern OFLogger mainLogger;
+extern AsyncLogger asyncLogger;
+
+void setupLogger(std::string_view logger_name);
+
+#define FNO_LOG_DEBUG(...) asyncLogger.log(V_DEBUG, __VA_ARGS__)
+#define FNO_LOG_INFO(...) asyncLogger.log(V_INFO, __VA_ARGS__)
+#define FNO_LOG_WARN(...) asyncLogger.log(V_WARN, __VA_ARGS__)
+#define FNO_LOG_ERROR(...) asyncLogger.log(V_ERROR, __VA_ARGS__)
+#define FNO_LOG_CONSOLE(...) asyncLogger.log(V_CONSOLE, __VA_ARGS__)
+
+#endif // MAINLOGGER_HPP
@@ -0,0 +1,69 @@
+#ifndef MEMORYBUDGET_HPP
+#define MEMORYBUDGET_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/* Bytes the files in flight may keep in memory, shared by all workers.
+ *
+ * Discovery takes a lease for every file before it is queued and waits while
+ * the leases in flight would exceed the limit; a file larger than the whole
+ * budget is admitted once nothing else is in flight. A worker shrinks the
+ * lease to what the file really holds after loading it and the lease is
+ * returned when the file is done. A file written asynchronously hands its
+ * lease, grown to the serialized output, to the write and returns it once
+ * the output is on disk, so queued writes hold back admission too. A limit
+ * of 0 admits everything.
+ */
+class MemoryBudget {
+public:
+  class Lease {
+  public:
+    Lease() = default;
+    ~Lease();
+    Lease(Lease &&other) noexcept;
+    Lease &operator=(Lease &&other) noexcept;
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+
+    explicit operator bool() const { return m_budget != nullptr; }
+    std::uint64_t size() const { return m_bytes; }
+    void shrink(std::uint64_t bytes); // keeps at most bytes
+    void grow(std::uint64_t bytes);   // holds at least bytes, never waits
+
+  private:
+    friend class MemoryBudget;
+    Lease(MemoryBudget *budget, std::uint64_t bytes)
+        : m_budget{budget}, m_bytes{bytes} {}
+    void reset();
+
+    MemoryBudget *m_budget{nullptr};
+    std::uint64_t m_bytes{0};
+  };
+
+  explicit MemoryBudget(std::uint64_t limit = 0) : m_limit{limit} {}
+  MemoryBudget(const MemoryBudget &) = delete;
+  MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+  void setLimit(std::uint64_t limit) { m_limit = limit; } // before any lease
+  std::uint64_t limit() const { return m_limit; }
+  bool isLimited() const { return m_limit > 0; }
+
+  Lease acquire(std::uint64_t bytes); // waits until bytes fit
+  Lease tryAcquire(std::uint64_t bytes); // empty lease when they do not
+  std::uint64_t peak() const;
+
+private:
+  bool fits(std::uint64_t bytes) const; // mutex held
+  void charge(std::uint64_t bytes);
+  void release(std::uint64_t bytes);
+
+  std::uint64_t m_limit{0};
+  mutable std::mutex m_mutex;
+  std::condition_variable m_released;
+  std::uint64_t m_in_flight{0};
+  std::uint64_t m_peak{0};
+};
+
+#endif // MEMORYBUDGET_HPP
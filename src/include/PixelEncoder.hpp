@@ -0,0 +1,55 @@
+#ifndef PIXELENCODER_HPP
+#define PIXELENCODER_HPP
+
+#include <cstdint>
+#include <memory>
+
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmdata/dcxfer.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "WorkStealingPool.hpp"
+
+enum E_PIXEL_CODEC {
+  X_KEEP,          // write with the transfer syntax of the input
+  X_RLE,           // RLE Lossless
+  X_JPEG_LS,       // JPEG-LS Lossless
+  X_JPEG_LOSSLESS, // JPEG Lossless, Process 14 SV1
+};
+
+struct PixelEncodeResult {
+  bool encoded{false};
+  std::uint64_t native_bytes{0};
+  std::uint64_t encoded_bytes{0};
+};
+
+/* Lossless re-encoding of native PixelData with the DCMTK codecs.
+ *
+ * DCMTK encodes the frames of a dataset one after another, so every frame
+ * is copied into a dataset of its own and encoded as a task of a pool shared
+ * by all files; the calling worker waits for its frames and puts the
+ * compressed fragments back as the original representation of its PixelData,
+ * with a basic offset table. Datasets without native PixelData or with pixel
+ * data a codec refuses are left unchanged, as are those the codec would not
+ * make smaller.
+ */
+class PixelEncoder {
+public:
+  // threads: frames encoded at the same time, shared by all workers
+  PixelEncoder(E_PIXEL_CODEC codec, unsigned int threads);
+  ~PixelEncoder();
+  PixelEncoder(const PixelEncoder &) = delete;
+  PixelEncoder &operator=(const PixelEncoder &) = delete;
+
+  static E_TransferSyntax transferSyntax(E_PIXEL_CODEC codec);
+
+  OFCondition encode(DcmDataset *dataset, PixelEncodeResult &result);
+
+private:
+  E_PIXEL_CODEC m_codec;
+  E_TransferSyntax m_xfer;
+  std::unique_ptr<DcmRepresentationParameter> m_parameter{};
+  WorkStealingPool m_pool; // last member, joined first
+};
+
+#endif // PIXELENCODER_HPP
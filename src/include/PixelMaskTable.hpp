@@ -0,0 +1,60 @@
+#ifndef PIXELMASKTABLE_HPP
+#define PIXELMASKTABLE_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+// rectangle in pixels, clipped to the image when it is applied
+struct PixelRegion {
+  unsigned int x{0};
+  unsigned int y{0};
+  unsigned int width{0};
+  unsigned int height{0};
+};
+
+struct PixelMaskRule {
+  std::string modality{};     // empty: any
+  std::string manufacturer{}; // upper case prefix, empty: any
+  unsigned int columns{0};    // 0: any size
+  unsigned int rows{0};
+  std::vector<PixelRegion> regions{};
+};
+
+// one row of blank pixels, the period of every layout (1, 2, 3, 4 or 6
+// bytes) divides 48 so a span always starts with the first byte
+struct PixelFill {
+  alignas(16) std::array<std::uint8_t, 48> bytes{};
+};
+
+// writes fill over length bytes at data, 16 byte vector stores where the
+// target has them
+void fillPixelSpan(std::uint8_t *data, std::size_t length,
+                   const PixelFill &fill);
+
+/* Regions of burned-in annotations blanked in the pixel data.
+ *
+ * Rules are selected by Modality, Manufacturer and image size, the regions
+ * of every matching rule are blanked in every frame with the darkest value
+ * of the photometric interpretation. Encapsulated pixel data is decoded
+ * first and written native; a file whose regions cannot be blanked fails.
+ */
+class PixelMaskTable {
+public:
+  // one rule per line: `modality manufacturer size x,y,width,height ...`
+  OFCondition load(const std::string &filename);
+  bool isEmpty() const { return m_rules.empty(); }
+
+  // masked: regions were blanked, false when no rule matches
+  OFCondition apply(DcmDataset *dataset, bool &masked) const;
+
+private:
+  std::vector<PixelMaskRule> m_rules{};
+};
+
+#endif // PIXELMASKTABLE_HPP
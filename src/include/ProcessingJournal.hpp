@@ -0,0 +1,78 @@
+#ifndef PROCESSINGJOURNAL_HPP
+#define PROCESSINGJOURNAL_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+// state of a study directory recorded by an earlier run
+struct JournalStudyRecord {
+  std::string pseudoname{};
+  std::string new_studyuid{};
+  std::unordered_map<std::string, std::string>
+      series_uids{}; // unordered_map[old_uid, new_uid]
+};
+
+// state of an input file recorded once its output was written
+struct JournalFileRecord {
+  std::uint64_t size{0};
+  std::int64_t mtime{0}; // file_time_type ticks since epoch
+  std::string sha256{};  // hex digest of the input content
+  std::string output_path{};
+  std::string old_series_uid{};
+  std::string new_series_uid{};
+};
+
+/* Append-only, tab separated journal in the output directory.
+ *
+ *   S <study dir> <pseudoname> <new StudyInstanceUID>
+ *   F <study dir> <input file> <size> <mtime> <sha256> <output file>
+ *     <old SeriesInstanceUID> <new SeriesInstanceUID>
+ *
+ * Scanned studies (--scan-studies) use their old StudyInstanceUID as study
+ * dir.
+ * Each line is flushed once its study or file is done, a run killed midway
+ * leaves at most one partial line, which is cut off when the journal is
+ * loaded again; records with incomplete new UIDs are ignored. Later lines
+ * override earlier ones. Loaded records are read
+ * only while studies are processed, appends only touch the file and are
+ * therefore const.
+ */
+class ProcessingJournal {
+public:
+  // resume loads the existing journal and appends to it, otherwise an
+  // existing journal is removed and none is kept
+  OFCondition open(const std::string &output_directory, bool resume);
+  bool isOpen() const { return m_file.is_open(); }
+
+  const JournalStudyRecord *findStudy(const std::string &study_dir) const;
+  const JournalFileRecord *findFile(const std::string &input_file) const;
+  bool isOutputTaken(const std::string &output_path) const;
+
+  // fills size and mtime of the input, compares the content hash only when
+  // they differ from the journal
+  bool isUnchanged(const std::string &input_file,
+                   JournalFileRecord &current) const;
+
+  void recordStudy(const std::string &study_dir, const std::string &pseudoname,
+                   const std::string &new_studyuid) const;
+  void recordFile(const std::string &study_dir, const std::string &input_file,
+                  const JournalFileRecord &record) const;
+
+private:
+  // returns the size of the complete lines
+  std::uint64_t load(const std::string &filename);
+  void appendLine(const std::string &line) const;
+
+  std::unordered_map<std::string, JournalStudyRecord> m_studies{};
+  std::unordered_map<std::string, JournalFileRecord> m_files{};
+  std::unordered_map<std::string, std::string> m_outputs{}; // output, input
+  mutable std::mutex m_file_mutex;
+  mutable std::ofstream m_file{};
+};
+
+#endif // PROCESSINGJOURNAL_HPP
@@ -0,0 +1,73 @@
+#ifndef PSEUDONAMETABLE_HPP
+#define PSEUDONAMETABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+class MappedFile;
+
+/* PatientID -> pseudoname pairs of a `PatientID,Pseudoname` file.
+ *
+ * The file is mapped and split with memchr(), every line is normalized the
+ * way --pseudoname-file always did (whitespace removed, `/` and letters
+ * removed from the PatientID, first pair of an ID wins). Keys and values are
+ * stored back to back in one arena and found through an open addressing
+ * (linear probing) table of fixed size slots, at most half full.
+ *
+ * saveIndex() writes slots and arena as one binary sidecar together with the
+ * size and mtime of the CSV; loadIndex() maps it, checks every slot against
+ * the arena and uses it in place, so a later run with an unchanged CSV does
+ * not parse it at all.
+ */
+class PseudonameTable {
+public:
+  PseudonameTable();
+  ~PseudonameTable();
+  PseudonameTable(const PseudonameTable &) = delete;
+  PseudonameTable &operator=(const PseudonameTable &) = delete;
+
+  OFCondition load(const std::string &csv_file);
+  // fails when the sidecar is missing, foreign, corrupted or older than
+  // csv_file
+  OFCondition loadIndex(const std::string &index_file,
+                        const std::string &csv_file);
+  OFCondition saveIndex(const std::string &index_file,
+                        const std::string &csv_file) const;
+
+  bool find(std::string_view patient_id, std::string_view &pseudoname) const;
+  std::size_t size() const { return m_size; }
+
+private:
+  struct Slot {
+    std::uint64_t hash{0}; // 0 marks an empty slot
+    std::uint32_t key{0};  // arena offsets
+    std::uint32_t key_size{0};
+    std::uint32_t value{0};
+    std::uint32_t value_size{0};
+  };
+
+  static std::uint64_t hash(std::string_view key);
+  static bool validSlots(const Slot *slots, std::uint64_t capacity,
+                         std::uint64_t count, std::uint64_t arena_size);
+  const Slot *probe(std::string_view key, std::uint64_t key_hash) const;
+  void clear();
+
+  // owned when parsed, pointing into m_mapped when loaded from a sidecar
+  std::vector<Slot> m_slot_storage{};
+  std::vector<char> m_arena_storage{};
+  std::unique_ptr<MappedFile> m_mapped{};
+
+  const Slot *m_slots{nullptr};
+  const char *m_arena{nullptr};
+  std::size_t m_capacity{0}; // power of two
+  std::size_t m_arena_size{0};
+  std::size_t m_size{0};
+};
+
+#endif // PSEUDONAMETABLE_HPP
@@ -0,0 +1,53 @@
+#ifndef PSEUDONAMEVAULT_HPP
+#define PSEUDONAMEVAULT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+/* Append-only PatientID -> pseudoname file shared by runs and processes.
+ *
+ *   <PatientID> <pseudoname>       (tab separated, one pair per line)
+ *
+ * Pairs are never changed once written, the first pair of a PatientID wins.
+ * Every pair read is cached in memory, so known patients are found without
+ * touching the file. An unknown patient takes an exclusive flock() on the
+ * vault, reads the pairs other processes appended since, and only then
+ * appends a new pair, so concurrent runs agree on one pseudoname per
+ * patient. A line torn by a crash is cut off before the next append.
+ * Platforms without flock() are safe for one process only.
+ */
+class PseudonameVault {
+public:
+  PseudonameVault() = default;
+  ~PseudonameVault();
+  PseudonameVault(const PseudonameVault &) = delete;
+  PseudonameVault &operator=(const PseudonameVault &) = delete;
+
+  OFCondition open(const std::string &filename);
+  bool isOpen() const { return m_file != nullptr; }
+
+  // pseudoname of patient_id, a new one from generate() is recorded first
+  OFCondition assign(const std::string &patient_id,
+                     const std::function<std::string()> &generate,
+                     std::string &pseudoname);
+  std::size_t size() const;
+
+private:
+  OFCondition readNewPairs(); // file lock held
+
+  std::FILE *m_file{nullptr};
+  std::string m_filename{};
+  mutable std::mutex m_mutex;
+  std::uint64_t m_offset{0}; // end of the last complete line read
+  std::unordered_map<std::string, std::string> m_pseudonames{};
+  std::unordered_set<std::string> m_used{}; // pseudonames taken
+};
+
+#endif // PSEUDONAMEVAULT_HPP
@@ -0,0 +1,38 @@
+#ifndef SHA256_HPP
+#define SHA256_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+// FIPS 180-4 SHA-256, incremental
+class Sha256 {
+public:
+  using Digest = std::array<std::uint8_t, 32>;
+
+  Sha256();
+
+  void update(const void *data, std::size_t size);
+  Digest finish();
+
+  static std::string toHex(const Digest &digest);
+
+private:
+  void compress(const std::uint8_t *block);
+
+  std::array<std::uint32_t, 8> m_state{};
+  std::array<std::uint8_t, 64> m_block{};
+  std::size_t m_block_size{0};
+  std::uint64_t m_total_size{0};
+};
+
+// RFC 2104 HMAC with SHA-256
+Sha256::Digest hmacSha256(const std::string &key, const std::string &message);
+
+// hex encoded SHA-256 of the whole file content
+OFCondition sha256File(const std::string &filename, std::string &hex_digest);
+
+#endif // SHA256_HPP
@@ -0,0 +1,69 @@
+#ifndef STORAGESCP_HPP
+#define STORAGESCP_HPP
+
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "DatasetAnonymizer.hpp"
+
+struct StorageScpOptions {
+  std::string aetitle{"FNODCMANON"};
+  Uint16 port{104};
+  unsigned int max_associations{1}; // more are rejected until one ends
+  std::string output_directory{};   // <pseudoname>/DICOM/<SOPInstanceUID>
+  std::string csv_file{};           // one line per new study, empty: none
+  // C-STORE every anonymized dataset to this SCP instead of writing it
+  std::string forward_aetitle{};
+  std::string forward_host{};
+  Uint16 forward_port{0};
+};
+
+/* DICOM Storage SCP that anonymizes every received dataset in memory.
+ *
+ * Each association runs on its own thread of a DCMTK SCP pool, at most
+ * max_associations at a time. A dataset is anonymized, then written or
+ * forwarded on that thread before its C-STORE response is sent, so a slow
+ * disk or destination slows the senders down instead of piling up data in
+ * memory, and a sender only sees success once the anonymized copy is stored.
+ * Identifiable data never touches the disk.
+ */
+class StorageScp {
+public:
+  StorageScp(const DatasetAnonymizer &anonymizer,
+             const StorageScpOptions &options);
+  ~StorageScp();
+  StorageScp(const StorageScp &) = delete;
+  StorageScp &operator=(const StorageScp &) = delete;
+
+  // blocks until stop is set, running associations are finished first
+  OFCondition listen(const std::atomic<bool> &stop);
+
+  // `AETITLE@host:port`
+  static bool parseDestination(const std::string &text,
+                               StorageScpOptions &options);
+
+private:
+  class Pool;
+  class Forwarder;
+
+  // returns the C-STORE response status
+  Uint16 store(std::unique_ptr<DcmDataset> dataset, Forwarder &forwarder);
+  OFCondition writeDataset(std::unique_ptr<DcmDataset> dataset,
+                           const AnonymizedDataset &result) const;
+  void recordStudy(const AnonymizedDataset &result);
+  OFCondition openCsv();
+
+  const DatasetAnonymizer &m_anonymizer;
+  StorageScpOptions m_options{};
+  std::unique_ptr<Pool> m_pool{};
+  std::mutex m_csv_mutex;
+  std::ofstream m_csv{};
+};
+
+#endif // STORAGESCP_HPP
@@ -0,0 +1,79 @@
+#ifndef STUDYARCHIVEWRITER_HPP
+#define STUDYARCHIVEWRITER_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+enum E_OUTPUT_FORMAT {
+  O_FILES,   // one file per instance below <pseudoname>/DICOM/
+  O_TAR,     // one tar per study
+  O_TAR_ZSTD // one tar per study, every member a separate zstd frame
+};
+
+// member position in the container, see StudyArchiveWriter
+struct ArchiveIndexEntry {
+  std::string name{};
+  std::uint64_t offset{0}; // first byte of the member header or frame
+  std::uint64_t length{0}; // bytes of header, data and padding or frame
+  std::uint64_t size{0};   // bytes of member data
+};
+
+/* Sequential writer of one study container.
+ *
+ * Members are ustar entries appended through a large buffer, so a study is
+ * written with a few big writes instead of one file per instance. With
+ * O_TAR_ZSTD every member (header, data and padding) is compressed into its
+ * own zstd frame; the concatenated frames still decompress into a plain tar,
+ * and any member can be decompressed on its own.
+ *
+ * close() writes the index `<container>.idx` next to the container, one
+ * `name offset length size` line per member (tab separated): read `length`
+ * bytes at `offset`, decompress them for .tar.zst, skip the 512 byte header
+ * and take `size` bytes. Container and index are written under a temporary
+ * name and renamed when complete.
+ *
+ * add() is called by concurrent workers, encoding and compression run on the
+ * caller, only the append is serialized.
+ */
+class StudyArchiveWriter {
+public:
+  explicit StudyArchiveWriter(E_OUTPUT_FORMAT format) : m_format{format} {}
+  ~StudyArchiveWriter();
+  StudyArchiveWriter(const StudyArchiveWriter &) = delete;
+  StudyArchiveWriter &operator=(const StudyArchiveWriter &) = delete;
+
+  // false for O_TAR_ZSTD built without libzstd
+  static bool isSupported(E_OUTPUT_FORMAT format);
+  static std::string_view extension(E_OUTPUT_FORMAT format);
+
+  OFCondition open(const std::string &filename);
+  OFCondition add(const std::string &name, const std::vector<char> &data,
+                  std::uint64_t *stored = nullptr);
+  OFCondition close();
+  void discard(); // failed study, nothing is left behind
+
+private:
+  OFCondition encode(const std::string &name, const std::vector<char> &data,
+                     std::vector<char> &member) const;
+  OFCondition append(std::vector<char> &member); // m_mutex held
+  OFCondition flush();                           // m_mutex held
+
+  E_OUTPUT_FORMAT m_format{O_TAR};
+  std::string m_filename{};
+  std::ofstream m_file{};
+  std::int64_t m_mtime{0};
+
+  std::mutex m_mutex;
+  std::vector<char> m_buffer{};
+  std::uint64_t m_offset{0};
+  std::vector<ArchiveIndexEntry> m_index{};
+  OFCondition m_status{};
+};
+
+#endif // STUDYARCHIVEWRITER_HPP
@@ -0,0 +1,53 @@
+#ifndef STUDYSCANNER_HPP
+#define STUDYSCANNER_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+// input of one study: a directory searched for its files when anonymized, or
+// instances already found and grouped by StudyInstanceUID; an archive holds
+// any number of studies, its members are grouped while it is read
+struct StudyInput {
+  std::filesystem::path input_directory{};
+  std::vector<std::string> dicom_files{}; // empty: search input_directory
+  std::string patient_id{};
+  std::string patient_name{};
+  std::string study_uid{}; // empty: tags are probed from the first file
+  std::string study_date{};
+  bool archive{false}; // input_directory is a tar or zip archive
+};
+
+class DicomProbe;
+
+// basic study tags of one instance, first values only; fails without
+// StudyInstanceUID
+OFCondition probeStudyTags(DicomProbe &probe, StudyInput &study);
+
+/* Parallel, content based discovery of the studies below a root directory.
+ *
+ * Directories are listed as pool tasks, one per directory, their files are
+ * probed in batches by DicomProbe: the "DICM" magic is checked and only the
+ * element headers up to StudyInstanceUID are read. Files without the magic
+ * or without a StudyInstanceUID (DICOMDIR, reports, junk, ...) are ignored.
+ * Instances are grouped by StudyInstanceUID regardless of the directory they
+ * are in; studies are ordered by their first file and files by path, so the
+ * result does not depend on scheduling.
+ */
+class StudyScanner {
+public:
+  explicit StudyScanner(unsigned int jobs) : m_jobs{jobs} {}
+
+  OFCondition scan(const std::filesystem::path &root,
+                   std::vector<StudyInput> &studies);
+  std::size_t ignoredFiles() const { return m_ignored_files; }
+
+private:
+  unsigned int m_jobs{1};
+  std::size_t m_ignored_files{0};
+};
+
+#endif // STUDYSCANNER_HPP
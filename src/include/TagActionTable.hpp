@@ -0,0 +1,102 @@
+#ifndef TAGACTIONTABLE_HPP
+#define TAGACTIONTABLE_HPP
+
+#include <array>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "dcmtk/dcmdata/dcdict.h"
+#include "dcmtk/dcmdata/dcitem.h"
+#include "dcmtk/dcmdata/dctagkey.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+class UidRemapper;
+
+enum E_ADDIT_ANONYM_METHODS {
+  // https://dicom.nema.org/medical/dicom/current/output/chtml/part16/chapter_D.html#DCM_113100
+  M_113108, // Retain Patient Characteristics Option
+  M_113109, // Retain Device Identity Option
+  M_113112  // Retain Institution Identity Option
+};
+
+// https://dicom.nema.org/medical/dicom/current/output/chtml/part15/chapter_E.html
+enum E_TAG_ACTION {
+  A_REMOVE,  // X - remove element
+  A_EMPTY,   // Z - replace with zero length value
+  A_REPLACE, // D - replace with dummy value
+  A_KEEP     // K - keep element
+};
+
+// origin of a removed element, the first four are the built-in profiles
+enum E_TAG_SOURCE {
+  T_BASIC_PROFILE,
+  T_PATIENT_CHARACTERISTICS,
+  T_DEVICE_IDENTITY,
+  T_INSTITUTION_IDENTITY,
+  T_RULE_FILE,
+  T_PRIVATE_TAG,
+  T_UNKNOWN_TAG,
+  T_SOURCE_COUNT
+};
+
+struct TagAction {
+  DcmTagKey tag{};
+  E_TAG_ACTION action{A_KEEP};
+  std::string value{};        // replacement value of A_REPLACE
+  bool use_pseudoname{false}; // A_REPLACE with the study pseudoname
+  E_TAG_SOURCE source{T_RULE_FILE};
+};
+
+// elements changed by one apply(), nested items included
+struct TagActionCounts {
+  std::array<unsigned int, T_SOURCE_COUNT> removed{};
+  unsigned int emptied{0};
+  unsigned int replaced{0};
+  unsigned int uids_remapped{0};
+};
+
+/* De-identification profiles compiled into one table sorted by tag.
+ *
+ * Built-in profiles are resolved against the retain options once at startup,
+ * rules from a user file override them per tag. apply() is a depth first walk
+ * merging the table with the (equally sorted) elements of every item, nested
+ * sequence items included, and stripping private and unknown tags on the
+ * way. Every element is visited once, so the cost per file grows linearly
+ * with the dataset and does not depend on the number of rules.
+ *
+ * Private elements are classified by group parity and the creator of their
+ * block (gggg,xxee -> gggg,00xx), elements of creators on the safe list are
+ * kept (PS3.15 Retain Safe Private Option), all others are removed. The
+ * dictionary is read locked once per apply().
+ *
+ * With a UID remapper every kept UI element is remapped in the same walk,
+ * unless the table keeps its tag explicitly.
+ */
+class TagActionTable {
+public:
+  static TagActionTable
+  fromProfiles(const std::set<E_ADDIT_ANONYM_METHODS> &methods);
+
+  OFCondition mergeRuleFile(const std::string &filename);
+  OFCondition mergeSafePrivateCreators(const std::string &filename);
+  void apply(DcmItem *item, const std::string &pseudoname,
+             const UidRemapper *uid_remapper = nullptr,
+             TagActionCounts *counts = nullptr) const;
+
+  const std::vector<TagAction> &actions() const { return m_actions; }
+
+private:
+  void setAction(const TagAction &action);
+  void applyToItem(DcmItem *item, const std::string &pseudoname,
+                   const DcmDataDictionary &dictionary,
+                   const UidRemapper *uid_remapper,
+                   std::vector<const TagAction *> *missing,
+                   TagActionCounts &counts) const;
+  bool isSafePrivateCreator(DcmElement *element) const;
+
+  std::vector<TagAction> m_actions{}; // sorted by tag, one action per tag
+  std::vector<std::string> m_safe_private_creators{}; // sorted
+};
+
+#endif // TAGACTIONTABLE_HPP
@@ -0,0 +1,31 @@
+#ifndef UIDREMAPPER_HPP
+#define UIDREMAPPER_HPP
+
+#include <string>
+
+#include "dcmtk/dcmdata/dcelem.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+/* Keyed, stateless UID mapping: uid_root + "." + HMAC-SHA256(key, uid).
+ *
+ * The same key and root give the same new UID for an old UID in every file,
+ * study and run, so references between instances (ReferencedSOPInstanceUID,
+ * FrameOfReferenceUID, ...) stay consistent without shared state or locks.
+ * The digest is written as a decimal number cut to the 64 character UID
+ * limit. Well-known UIDs under 1.2.840.10008 (SOP classes, transfer
+ * syntaxes, ...) are left as they are.
+ */
+class UidRemapper {
+public:
+  OFCondition setup(const std::string &key_file, const std::string &uid_root);
+  bool isEnabled() const { return !m_key.empty(); }
+
+  std::string map(const std::string &uid) const;
+  void remapElement(DcmElement *element) const;
+
+private:
+  std::string m_key{};
+  std::string m_uid_root{};
+};
+
+#endif // UIDREMAPPER_HPP
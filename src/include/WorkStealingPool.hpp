@@ -0,0 +1,56 @@
+#ifndef WORKSTEALINGPOOL_HPP
+#define WORKSTEALINGPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fixed-size thread pool with one task deque per worker.
+ *
+ * Tasks submitted from a worker go to that worker's own deque and are popped
+ * LIFO by it, idle workers steal FIFO from the other deques. Tasks submitted
+ * from outside the pool go to a shared injection queue which workers only
+ * consult once there is nothing left to steal, so already started work is
+ * finished before new work is picked up.
+ */
+class WorkStealingPool {
+public:
+  using Task = std::function<void()>;
+
+  explicit WorkStealingPool(unsigned int worker_count);
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  void submit(Task task);
+  unsigned int size() const {
+    return static_cast<unsigned int>(m_workers.size());
+  }
+
+private:
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  bool popLocal(std::size_t worker_index, Task &task);
+  bool steal(std::size_t worker_index, Task &task);
+  bool popInjected(Task &task);
+  void workerLoop(std::size_t worker_index, const std::stop_token &stop);
+
+  std::vector<std::unique_ptr<TaskQueue>> m_queues{};
+  TaskQueue m_injected{};
+  std::atomic<std::size_t> m_pending{0};
+  std::mutex m_wake_mutex;
+  std::condition_variable_any m_wake;
+  std::vector<std::jthread> m_workers{}; // last member, joined first
+};
+
+#endif // WORKSTEALINGPOOL_HPP
@@ -1,9 +1,15 @@
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <csignal>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <set>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "fmt/format.h"
@@ -15,7 +21,15 @@
 #include "dcmtk/ofstd/ofcond.h"
 #include "dcmtk/ofstd/ofexit.h"
 
+#include "ArchiveReader.hpp"
 #include "DicomAnonymizer.hpp"
+#include "MainLogger.hpp"
+#include "StorageScp.hpp"
+
+// set by SIGINT and SIGTERM, ends --listen after the running associations
+std::atomic<bool> stopRequested{false};
+
+extern "C" void requestStop(int) { stopRequested = true; }
 
 void checkConflict(OFConsoleApplication &app, const char *first_opt,
                    const char *second_opt) {
@@ -31,6 +45,30 @@ void checkConflict(OFConsoleApplication &app, const char *first_opt,
   app.printError(str.c_str(), EXITCODE_COMMANDLINE_SYNTAX_ERROR);
 };
 
+// bytes with an optional K, M or G suffix (powers of 1024)
+bool parseByteSize(const std::string &text, std::uint64_t &bytes) {
+  std::size_t end{0};
+  try {
+    bytes = std::stoull(text, &end);
+  } catch (const std::exception &) {
+    return false;
+  }
+  const std::string_view suffix{text.c_str() + end};
+  unsigned int shift{0};
+  if (suffix == "K" || suffix == "k")
+    shift = 10;
+  else if (suffix == "M" || suffix == "m")
+    shift = 20;
+  else if (suffix == "G" || suffix == "g")
+    shift = 30;
+  else if (!suffix.empty())
+    return false;
+  if (bytes > (UINT64_MAX >> shift))
+    return false;
+  bytes <<= shift;
+  return true;
+}
+
 std::vector<std::filesystem::path>
 findStudyDirectories(const OFString &root_path) {
   std::vector<std::filesystem::path> dirs{};
@@ -40,9 +78,57 @@ findStudyDirectories(const OFString &root_path) {
       dirs.push_back(entry.path());
     }
   }
+  // directory_iterator order is unspecified, keep pseudonames reproducible
+  std::ranges::sort(dirs);
   return dirs;
 };
 
+std::vector<std::filesystem::path>
+findStudyArchives(const OFString &root_path) {
+  std::vector<std::filesystem::path> archives{};
+
+  for (const auto &entry : std::filesystem::directory_iterator(root_path)) {
+    if (entry.is_regular_file() && ArchiveReader::isArchive(entry.path())) {
+      archives.push_back(entry.path());
+    }
+  }
+  std::ranges::sort(archives);
+  return archives;
+};
+
+// --listen: anonymize what the C-STORE SCP receives until SIGINT or SIGTERM
+int receiveStudies(const AnonymizerOptions &options,
+                   const StorageScpOptions &scp_options,
+                   const std::string &metrics_filename, bool prometheus) {
+  DatasetAnonymizer anonymizer{};
+  if (OFCondition cond = anonymizer.setup(options); cond.bad()) {
+    asyncLogger.stop();
+    return cond.code();
+  }
+
+  (void)std::filesystem::create_directories(scp_options.output_directory);
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+
+  StorageScp scp{anonymizer, scp_options};
+  const OFCondition cond = scp.listen(stopRequested);
+  if (cond.bad())
+    FNO_LOG_ERROR("{}", cond.text());
+
+  const RunMetrics &metrics = anonymizer.metrics();
+  FNO_LOG_CONSOLE(
+      "\nreceived and anonymized {} datasets of {} studies in {:.1f} s, "
+      "{} failed",
+      metrics.counter(C_FILES), metrics.counter(C_STUDIES),
+      metrics.runSeconds(), metrics.counter(C_FILES_FAILED));
+  asyncLogger.stop();
+
+  (void)metrics.writeJson(metrics_filename + ".json");
+  if (prometheus)
+    (void)metrics.writePrometheus(metrics_filename + ".prom");
+  return cond.bad() ? cond.code() : 0;
+}
+
 void printMethods() {
   struct AnonProfiles {
     std::string_view option{};
@@ -92,18 +178,51 @@ int main(int argc, char *argv[]) {
   std::string opt_pseudonamePrefix{};
   E_PSEUDONAME_TYPE opt_pseudonameType = P_RANDOM_STRING;
   std::string opt_pseudonameFile{};
+  bool opt_pseudonameIndex{false};
+  std::string opt_pseudonameVault{};
+  std::string opt_logJson{};
+  bool opt_logConfig{false};
 
   // optional output methods
   std::string opt_outDirectory{"./anonymized_output"};
   std::string FNO_UID_ROOT{"1.2.840.113619.2"};
   std::string opt_rootUID{FNO_UID_ROOT};
+  std::string opt_uidKeyFile{};
   E_FILENAMES opt_filenameType = F_HEX;
+  bool opt_resume{false};
+  bool opt_scanStudies{false};
+  bool opt_metricsPrometheus{false};
+  E_OUTPUT_FORMAT opt_outputFormat{O_FILES};
   std::set<E_ADDIT_ANONYM_METHODS> opt_anonymizationMethods{};
+  std::string opt_tagRulesFile{};
+  std::string opt_safePrivateFile{};
+  std::string opt_pixelMaskFile{};
+
+  // optional performance params
+  unsigned long opt_jobs{1};
+  bool opt_streamPixelData{false};
+  bool opt_mmapInput{false};
+  bool opt_mmapHugePages{false};
+  E_IO_BACKEND opt_ioBackend{I_SYNC};
+  unsigned long opt_ioDepth{8};
+  std::uint64_t opt_maxInflightBytes{0};
+  E_PIXEL_CODEC opt_pixelCodec{X_KEEP};
+  unsigned long opt_encodeJobs{0};
+
+  // optional receiver params
+  unsigned long opt_listenPort{0};
+  std::string opt_aetitle{"FNODCMANON"};
+  unsigned long opt_maxAssociations{0};
+  std::string opt_forward{};
+  unsigned long opt_maxStudies{10000};
 
   constexpr int LONGCOL{20};
   constexpr int SHORTCOL{4};
   cmd.setParamColumn(LONGCOL + SHORTCOL + 4);
-  cmd.addParam("in-directory", "input directory with DICOM studies");
+  cmd.addParam("in-directory",
+               "input directory with DICOM studies, or a tar or zip archive "
+               "(not with --listen)",
+               OFCmdParam::PM_Optional);
 
   cmd.setOptionColumns(LONGCOL, SHORTCOL);
   cmd.addGroup("general options:", LONGCOL, SHORTCOL + 2);
@@ -113,6 +232,15 @@ int main(int argc, char *argv[]) {
                 OFCommandLine::AF_Exclusive);
 
   OFLog::addOptions(cmd);
+  cmd.addOption("--log-json", "-lj", 1, "file: path/to/log or -",
+                "also write log records as JSON lines to file, `-` writes "
+                "them to stdout instead of the console text");
+
+  cmd.addGroup("input options:");
+  cmd.addOption("--scan-studies", "-ss",
+                "find DICOM files anywhere below in-directory by content and "
+                "group them by StudyInstanceUID (default: one study per "
+                "directory)");
 
   cmd.addGroup("anonymization options:");
   cmd.addOption("--prefix", "-p", 1, "string: prefix (default ``)",
@@ -128,6 +256,12 @@ int main(int argc, char *argv[]) {
   cmd.addOption(
       "--pseudoname-file", "-pf", 1, "file: path/to/.csv",
       "read .csv with existing pseudonames and append to <anonymized-prefix>");
+  cmd.addOption("--pseudoname-index", "-pix",
+                "keep a binary index of the pseudoname file next to it and "
+                "load it instead of the file while the file is unchanged");
+  cmd.addOption("--pseudoname-vault", "-pv", 1, "file: path/to/vault",
+                "reuse the generated pseudoname of PatientIDs seen by "
+                "earlier runs, record new ones (shared by concurrent runs)");
 
   cmd.addSubGroup("additional anonymization profiles:");
   cmd.addOption("--retain-patient-charac-tags", "-rpt",
@@ -136,6 +270,15 @@ int main(int argc, char *argv[]) {
                 "retain device identity option");
   cmd.addOption("--retain-institution-tags", "-rit",
                 "retain institution identity option");
+  cmd.addOption("--tag-rules", "-tr", 1, "file: path/to/rules",
+                "merge de-identification rules `(gggg,eeee) action [value]` "
+                "from file, overrides profiles per tag");
+  cmd.addOption("--safe-private", "-sp", 1, "file: path/to/creators",
+                "keep private tags of creators listed in file (one per "
+                "line), other private tags are removed");
+  cmd.addOption("--pixel-masks", "-pxm", 1, "file: path/to/masks",
+                "blank burned-in regions `modality manufacturer size "
+                "x,y,w,h ...` in the pixel data of matching images");
   cmd.addOption("--print-anon-profiles",
                 "print deidentification profiles for example tags",
                 OFCommandLine::AF_Exclusive);
@@ -149,6 +292,9 @@ int main(int argc, char *argv[]) {
 
   cmd.addOption("--custom-uid-root", "-cuid", 1, "uid root: string",
                 "use custom UID root");
+  cmd.addOption("--uid-key", "-uk", 1, "file: path/to/key",
+                "derive new UIDs from HMAC-SHA256 of old UIDs with key from "
+                "file, reproducible across files, studies and runs");
 
   cmd.addGroup("output options:");
   cmd.addOption("--out-directory", "-od", 1,
@@ -157,6 +303,61 @@ int main(int argc, char *argv[]) {
   cmd.addOption("--filename-hex", "-f", "filenames in hex format (default)");
   cmd.addOption("--filename-modality-sop", "+f",
                 "filenames in MODALITY_SOPINSTUID format");
+  cmd.addOption("--resume", "-r",
+                "keep a journal in output directory and resume from it, "
+                "skip unchanged files and keep pseudonames and UIDs of "
+                "previous run");
+  cmd.addOption("--output-archive", "-oa", 1, "[t]ar, [z]std",
+                "write every study into one tar container with a member "
+                "index instead of one file per instance, zstd compresses "
+                "each member into its own frame");
+  cmd.addOption("--metrics-prometheus", "-mp",
+                "also write run metrics as Prometheus textfile next to the "
+                "JSON summary in output directory");
+
+  cmd.addGroup("performance options:");
+  cmd.addOption("--jobs", "-j", 1, "number: integer (default 1, 0 = all cores)",
+                "number of worker threads anonymizing files as discovery "
+                "queues them");
+  cmd.addOption("--stream-pixel-data", "-spd",
+                "parse and rewrite only the header, copy pixel data to the "
+                "output unchanged");
+  cmd.addOption("--mmap-input", "-mm",
+                "parse input files from a read-only memory mapping instead "
+                "of a buffered file stream");
+  cmd.addOption("--mmap-huge-pages", "-mhp",
+                "request transparent huge pages for mapped input files "
+                "(implies --mmap-input)");
+  cmd.addOption("--io-backend", "-io", 1, "[s]ync, [t]hreads, [u]ring",
+                "read inputs ahead and write outputs in the background on "
+                "I/O threads or io_uring (default sync)");
+  cmd.addOption("--io-depth", "-iod", 1, "number: integer (default 8)",
+                "files read ahead and I/O operations in flight");
+  cmd.addOption("--max-inflight-bytes", "-mib", 1, "bytes: n[K|M|G]",
+                "memory the files in flight may hold; files above their "
+                "share are written without loading their large values");
+  cmd.addOption("--compress-pixel-data", "-cpd", 1, "[r]le, jpeg-[ls], [j]peg",
+                "encode native pixel data losslessly with RLE, JPEG-LS or "
+                "JPEG lossless (process 14 SV1) on encoder threads");
+  cmd.addOption("--encode-jobs", "-ej", 1,
+                "number: integer (default --jobs, 0 = all cores)",
+                "frames encoded at the same time by --compress-pixel-data");
+
+  cmd.addGroup("receiver options:");
+  cmd.addOption("--listen", "-l", 1, "port: integer",
+                "run as C-STORE SCP on port and anonymize received datasets "
+                "instead of reading in-directory");
+  cmd.addOption("--aetitle", "-aet", 1, "string: AE title (default FNODCMANON)",
+                "AE title of the receiver, also calling AE title of --forward");
+  cmd.addOption("--max-associations", "-mas", 1,
+                "number: integer (default --jobs)",
+                "associations served at the same time, more are rejected");
+  cmd.addOption("--forward", "-fw", 1, "destination: AETITLE@host:port",
+                "send anonymized datasets to another SCP instead of writing "
+                "them to output directory");
+  cmd.addOption("--max-studies", "-mst", 1, "number: integer (default 10000)",
+                "studies remembered, the least recently received one is "
+                "forgotten first, 0 = all");
 
   prepareCmdLineArgs(argc, argv, FNO_CONSOLE_APPLICATION);
   if (app.parseCommandLine(cmd, argc, argv)) {
@@ -176,6 +377,16 @@ int main(int argc, char *argv[]) {
     // cmd.getParam(2, opt_anonymizedPrefix);
 
     OFLog::configureFromCommandLine(cmd, app);
+    if (cmd.findOption("--log-config")) {
+      opt_logConfig = true;
+    }
+    if (cmd.findOption("--log-json")) {
+      app.checkValue(cmd.getValue(opt_logJson));
+    }
+
+    if (cmd.findOption("--scan-studies")) {
+      opt_scanStudies = true;
+    }
 
     if (cmd.findOption("--prefix"))
       app.checkValue(cmd.getValue(opt_pseudonamePrefix));
@@ -191,6 +402,18 @@ int main(int argc, char *argv[]) {
     }
     cmd.endOptionBlock();
 
+    if (cmd.findOption("--pseudoname-index")) {
+      if (opt_pseudonameType != P_FROM_FILE)
+        app.printError("--pseudoname-index needs --pseudoname-file");
+      opt_pseudonameIndex = true;
+    }
+
+    if (cmd.findOption("--pseudoname-vault")) {
+      if (opt_pseudonameType == P_INTEGER_ORDER)
+        checkConflict(app, "--pseudoname-vault", "--pseudoname-integer");
+      app.checkValue(cmd.getValue(opt_pseudonameVault));
+    }
+
     if (cmd.findOption("--fno-uid-root") &&
         cmd.findOption("--offis-uid-root") &&
         cmd.findOption("--custom-uid-root")) {
@@ -216,6 +439,10 @@ int main(int argc, char *argv[]) {
       app.checkValue(cmd.getValue(opt_rootUID));
     cmd.endOptionBlock();
 
+    if (cmd.findOption("--uid-key")) {
+      app.checkValue(cmd.getValue(opt_uidKeyFile));
+    }
+
     if (cmd.findOption("--out-directory")) {
       app.checkValue(cmd.getValue(opt_outDirectory));
     }
@@ -232,6 +459,97 @@ int main(int argc, char *argv[]) {
       opt_filenameType = F_MODALITY_SOPINSTUID;
     cmd.endOptionBlock();
 
+    if (cmd.findOption("--resume")) {
+      opt_resume = true;
+    }
+
+    if (cmd.findOption("--output-archive")) {
+      std::string format{};
+      app.checkValue(cmd.getValue(format));
+      if (format == "tar" || format == "t")
+        opt_outputFormat = O_TAR;
+      else if (format == "zstd" || format == "z")
+        opt_outputFormat = O_TAR_ZSTD;
+      else
+        app.printError("unknown --output-archive, expected tar or zstd");
+      if (!StudyArchiveWriter::isSupported(opt_outputFormat))
+        app.printError("--output-archive zstd needs libzstd at build time");
+      // members of a resumed study would be missing from the new container
+      if (opt_resume)
+        checkConflict(app, "--output-archive", "--resume");
+    }
+
+    if (cmd.findOption("--metrics-prometheus")) {
+      opt_metricsPrometheus = true;
+    }
+
+    if (cmd.findOption("--jobs")) {
+      app.checkValue(cmd.getValue(opt_jobs));
+      if (opt_jobs == 0)
+        opt_jobs = std::max(1U, std::thread::hardware_concurrency());
+    }
+
+    if (cmd.findOption("--stream-pixel-data")) {
+      opt_streamPixelData = true;
+    }
+
+    if (cmd.findOption("--mmap-input")) {
+      opt_mmapInput = true;
+    }
+
+    if (cmd.findOption("--mmap-huge-pages")) {
+      opt_mmapInput = true;
+      opt_mmapHugePages = true;
+    }
+
+    if (cmd.findOption("--io-backend")) {
+      std::string backend{};
+      app.checkValue(cmd.getValue(backend));
+      if (backend == "sync" || backend == "s")
+        opt_ioBackend = I_SYNC;
+      else if (backend == "threads" || backend == "t")
+        opt_ioBackend = I_THREADS;
+      else if (backend == "uring" || backend == "u")
+        opt_ioBackend = I_URING;
+      else
+        app.printError("unknown --io-backend, expected sync, threads or uring");
+    }
+
+    if (cmd.findOption("--io-depth")) {
+      app.checkValue(cmd.getValueAndCheckMinMax(opt_ioDepth, 1, 1024));
+    }
+
+    if (cmd.findOption("--max-inflight-bytes")) {
+      std::string bytes{};
+      app.checkValue(cmd.getValue(bytes));
+      if (!parseByteSize(bytes, opt_maxInflightBytes) ||
+          opt_maxInflightBytes == 0)
+        app.printError("invalid --max-inflight-bytes, expected n[K|M|G]");
+    }
+
+    if (cmd.findOption("--compress-pixel-data")) {
+      if (opt_streamPixelData)
+        checkConflict(app, "--compress-pixel-data", "--stream-pixel-data");
+      std::string codec{};
+      app.checkValue(cmd.getValue(codec));
+      if (codec == "rle" || codec == "r")
+        opt_pixelCodec = X_RLE;
+      else if (codec == "jpeg-ls" || codec == "ls")
+        opt_pixelCodec = X_JPEG_LS;
+      else if (codec == "jpeg" || codec == "j")
+        opt_pixelCodec = X_JPEG_LOSSLESS;
+      else
+        app.printError(
+            "unknown --compress-pixel-data, expected rle, jpeg-ls or jpeg");
+    }
+
+    opt_encodeJobs = opt_jobs;
+    if (cmd.findOption("--encode-jobs")) {
+      app.checkValue(cmd.getValue(opt_encodeJobs));
+      if (opt_encodeJobs == 0)
+        opt_encodeJobs = std::max(1U, std::thread::hardware_concurrency());
+    }
+
     if (cmd.findOption("--retain-patient-charac-tags")) {
       opt_anonymizationMethods.insert(E_ADDIT_ANONYM_METHODS::M_113108);
     }
@@ -244,65 +562,206 @@ int main(int argc, char *argv[]) {
       opt_anonymizationMethods.insert(E_ADDIT_ANONYM_METHODS::M_113112);
     }
 
+    if (cmd.findOption("--tag-rules")) {
+      app.checkValue(cmd.getValue(opt_tagRulesFile));
+    }
+    if (cmd.findOption("--safe-private")) {
+      app.checkValue(cmd.getValue(opt_safePrivateFile));
+    }
+    if (cmd.findOption("--pixel-masks")) {
+      if (opt_streamPixelData)
+        checkConflict(app, "--pixel-masks", "--stream-pixel-data");
+      app.checkValue(cmd.getValue(opt_pixelMaskFile));
+    }
+
+    if (cmd.findOption("--listen")) {
+      app.checkValue(cmd.getValueAndCheckMinMax(opt_listenPort, 1, 65535));
+      if (!opt_inDirectory.empty())
+        app.printError("in-directory not allowed with --listen");
+      // nothing is read from disk, resumed or collected into containers
+      if (opt_scanStudies)
+        checkConflict(app, "--listen", "--scan-studies");
+      if (opt_resume)
+        checkConflict(app, "--listen", "--resume");
+      if (opt_outputFormat != O_FILES)
+        checkConflict(app, "--listen", "--output-archive");
+      if (opt_streamPixelData)
+        checkConflict(app, "--listen", "--stream-pixel-data");
+    } else if (opt_inDirectory.empty()) {
+      app.printError("missing parameter in-directory");
+    }
+
+    if (cmd.findOption("--aetitle")) {
+      app.checkValue(cmd.getValue(opt_aetitle));
+      if (opt_aetitle.empty() || opt_aetitle.size() > 16)
+        app.printError("invalid --aetitle, expected 1 to 16 characters");
+    }
+
+    opt_maxAssociations = opt_jobs;
+    if (cmd.findOption("--max-associations")) {
+      app.checkValue(
+          cmd.getValueAndCheckMinMax(opt_maxAssociations, 1, 65535));
+    }
+
+    if (cmd.findOption("--forward")) {
+      if (opt_listenPort == 0)
+        app.printError("--forward needs --listen");
+      app.checkValue(cmd.getValue(opt_forward));
+    }
+
+    if (cmd.findOption("--max-studies")) {
+      if (opt_listenPort == 0)
+        app.printError("--max-studies needs --listen");
+      app.checkValue(cmd.getValue(opt_maxStudies));
+    }
+
     OFLOG_DEBUG(mainLogger, rcsid.c_str() << OFendl);
   }
 
+  // from here on messages are formatted by the caller and written by the
+  // logger thread
+  if (OFCondition cond =
+          asyncLogger.start(AsyncLogger::levelOf(mainLogger), opt_logJson,
+                            opt_logConfig ? &mainLogger : nullptr);
+      cond.bad()) {
+    OFLOG_ERROR(mainLogger, cond.text());
+    return cond.code();
+  }
+
+  AnonymizerOptions options{};
+  options.logger = &asyncLogger;
+  options.pseudoname_prefix = opt_pseudonamePrefix;
+  options.pseudoname_type = opt_pseudonameType;
+  options.pseudoname_file = opt_pseudonameFile;
+  options.pseudoname_index = opt_pseudonameIndex;
+  options.pseudoname_vault = opt_pseudonameVault;
+  options.uid_root = opt_rootUID;
+  options.uid_key_file = opt_uidKeyFile;
+  options.methods = opt_anonymizationMethods;
+  options.tag_rule_file = opt_tagRulesFile;
+  options.safe_private_file = opt_safePrivateFile;
+  options.pixel_mask_file = opt_pixelMaskFile;
+  options.pixel_codec = opt_pixelCodec;
+  options.encode_threads = static_cast<unsigned int>(opt_encodeJobs);
+
+  if (opt_pseudonameType == P_INTEGER_ORDER) {
+    FNO_LOG_CONSOLE("using pseudonames as integer count order");
+  } else if (opt_pseudonameType == P_FROM_FILE) {
+    FNO_LOG_CONSOLE("using PatientID-pseudoname pairs from file `{}`",
+                    opt_pseudonameFile);
+  } else {
+    FNO_LOG_CONSOLE("using pseudonames from random string generation");
+  }
+
+  std::string csvFilename{"anonym_output.csv"};
+  if (!opt_pseudonamePrefix.empty()) {
+    csvFilename.insert(0, opt_pseudonamePrefix);
+  }
+  const std::string metricsFilename = fmt::format(
+      "{}/{}anonym_metrics", opt_outDirectory, opt_pseudonamePrefix);
+
+  if (opt_listenPort != 0) {
+    StorageScpOptions scpOptions{};
+    scpOptions.aetitle = opt_aetitle;
+    scpOptions.port = static_cast<Uint16>(opt_listenPort);
+    scpOptions.max_associations =
+        static_cast<unsigned int>(opt_maxAssociations);
+    scpOptions.output_directory = opt_outDirectory;
+    scpOptions.csv_file = opt_outDirectory + '/' + csvFilename;
+    if (!opt_forward.empty() &&
+        !StorageScp::parseDestination(opt_forward, scpOptions)) {
+      FNO_LOG_ERROR("invalid --forward `{}`, expected AETITLE@host:port",
+                    opt_forward);
+      asyncLogger.stop();
+      return EXITCODE_COMMANDLINE_SYNTAX_ERROR;
+    }
+    options.max_studies = opt_maxStudies;
+    return receiveStudies(options, scpOptions, metricsFilename,
+                          opt_metricsPrometheus);
+  }
+
+  const bool inArchive = std::filesystem::is_regular_file(opt_inDirectory) &&
+                         ArchiveReader::isArchive(opt_inDirectory.c_str());
   if (std::filesystem::exists(opt_inDirectory)) {
-    if (!std::filesystem::is_directory(opt_inDirectory)) {
-      OFLOG_ERROR(mainLogger,
-                  "invalid path, not directory `" << opt_inDirectory << "`");
+    if (!inArchive && !std::filesystem::is_directory(opt_inDirectory)) {
+      FNO_LOG_ERROR("invalid path, not directory `{}`", opt_inDirectory);
       return EXITCODE_COMMANDLINE_SYNTAX_ERROR;
     }
 
-    if (std::filesystem::is_empty(opt_inDirectory)) {
-      OFLOG_ERROR(mainLogger,
-                  "invalid path, empty directory `" << opt_inDirectory << "`");
+    if (!inArchive && std::filesystem::is_empty(opt_inDirectory)) {
+      FNO_LOG_ERROR("invalid path, empty directory `{}`", opt_inDirectory);
       return EXITCODE_COMMANDLINE_SYNTAX_ERROR;
     }
   } else {
-    OFLOG_ERROR(mainLogger, "invalid path, directory not found `"
-                                << opt_inDirectory << "`");
+    FNO_LOG_ERROR("invalid path, directory not found `{}`", opt_inDirectory);
     return EXITCODE_COMMANDLINE_SYNTAX_ERROR;
   }
 
-  std::vector<std::filesystem::path> studyDirs =
-      findStudyDirectories(opt_inDirectory);
-
-  StudyAnonymizer anonymizer{opt_pseudonamePrefix, opt_pseudonameType};
-
-  if (anonymizer.m_pseudoname_type == P_INTEGER_ORDER) {
-    fmt::print("using pseudonames as integer count order\n");
-    anonymizer.m_count_width =
-        static_cast<unsigned short>(std::to_string(studyDirs.size()).length());
-    ++anonymizer.m_count_width;
-    /* increment m_count_width by 1 for always at least one leading zero in
+  StudyAnonymizer anonymizer{};
+  anonymizer.m_jobs = static_cast<unsigned int>(opt_jobs);
+  anonymizer.setMemoryBudget(opt_maxInflightBytes);
+
+  // archives are read in place, each holds any number of studies
+  std::vector<StudyInput> studies{};
+  std::vector<std::filesystem::path> archives{};
+  if (inArchive) {
+    archives.emplace_back(opt_inDirectory.c_str());
+  } else if (opt_scanStudies) {
+    archives = findStudyArchives(opt_inDirectory);
+    if (OFCondition cond = anonymizer.scanStudies(opt_inDirectory, studies);
+        cond.bad() && archives.empty()) {
+      return EXITCODE_NO_INPUT_FILES;
+    }
+    FNO_LOG_CONSOLE("found {} studies, ignored {} files", studies.size(),
+                    anonymizer.metrics().counter(C_FILES_IGNORED));
+  } else {
+    archives = findStudyArchives(opt_inDirectory);
+    for (const auto &directory : findStudyDirectories(opt_inDirectory))
+      studies.push_back(StudyInput{directory});
+  }
+  for (const auto &archive : archives)
+    studies.push_back(StudyInput{.input_directory = archive, .archive = true});
+
+  anonymizer.m_output_format = opt_outputFormat;
+  anonymizer.m_stream_pixel_data = opt_streamPixelData;
+  anonymizer.m_mmap_input = opt_mmapInput;
+  anonymizer.m_mmap_huge_pages = opt_mmapHugePages;
+  anonymizer.setupIoBackend(opt_ioBackend,
+                            static_cast<unsigned int>(opt_ioDepth));
+
+  if (opt_pseudonameType == P_INTEGER_ORDER) {
+    // an archive holds any number of studies, counted in an extra pass
+    std::size_t studyCount = studies.size() - archives.size();
+    for (const auto &archive : archives) {
+      std::size_t count{0};
+      if (OFCondition cond = anonymizer.countArchiveStudies(archive, count);
+          cond.bad())
+        FNO_LOG_WARN("unable to count studies in `{}`: {}", archive.string(),
+                     cond.text());
+      studyCount += count;
+    }
+    options.count_width =
+        static_cast<unsigned short>(std::to_string(studyCount).length());
+    ++options.count_width;
+    /* increment count_width by 1 for always at least one leading zero in
     formatted pseudoname:
 
     studies found: 5 -> string length = 1
     - normal: width = 1, PSEUDONAME_1, ..., PSEUDONAME_5
     - incremented: width = 2, PSEUDONAME_01, ..., PSEUDONAME_05
     */
+  }
 
-  } else if (anonymizer.m_pseudoname_type == P_FROM_FILE) {
-    fmt::print("using PatientID-pseudoname pairs from file `{}`\n",
-               opt_pseudonameFile);
-    OFCondition cond = anonymizer.readPseudonamesFromFile(opt_pseudonameFile);
-    if (cond.bad()) {
-      OFLOG_ERROR(mainLogger, cond.text());
-      return cond.code();
-    }
-
-  } else {
-    fmt::print("using pseudonames from random string generation\n");
+  if (OFCondition cond = anonymizer.setup(options); cond.bad()) {
+    return cond.code();
   }
 
   (void)std::filesystem::create_directories(opt_outDirectory);
-  OFLOG_INFO(mainLogger,
-             fmt::format("created output directory `{}`", opt_outDirectory));
+  FNO_LOG_INFO("created output directory `{}`", opt_outDirectory);
 
-  std::string csvFilename{"anonym_output.csv"};
-  if (!opt_pseudonamePrefix.empty()) {
-    csvFilename.insert(0, opt_pseudonamePrefix);
+  if (OFCondition cond = anonymizer.openJournal(opt_outDirectory, opt_resume);
+      cond.bad()) {
+    return cond.code();
   }
 
   std::ofstream outputAnonymFile{opt_outDirectory + '/' + csvFilename,
@@ -310,26 +769,42 @@ int main(int argc, char *argv[]) {
   outputAnonymFile << "PatientID,PatientName,Pseudoname,StudyDate,"
                       "OldStudyInstanceUID,NewStudyInstanceUID\n";
 
-  for (const auto &study_dir : studyDirs) {
-
-    OFCondition cond{};
-    cond = anonymizer.anonymizeStudy(study_dir, opt_outDirectory,
-                                     opt_anonymizationMethods, opt_rootUID);
-
-    // something bad happened
-    if (cond.bad()) {
-      const std::string msg =
-          fmt::format("error while anonymizing study `{}`", study_dir.string());
-      OFLOG_ERROR(mainLogger, msg.c_str());
-      continue;
-    }
-
-    outputAnonymFile << fmt::format(
-        "{},{},{},{},{},{}\n", anonymizer.m_old_id, anonymizer.m_old_name,
-        anonymizer.m_pseudoname, anonymizer.m_study_date,
-        anonymizer.m_old_studyuid, anonymizer.m_new_studyuid);
-  }
+  anonymizer.anonymizeStudies(
+      std::move(studies), opt_outDirectory, opt_rootUID,
+      [&outputAnonymFile](const StudyContext &study, const OFCondition &cond) {
+        // something bad happened
+        if (cond.bad()) {
+          FNO_LOG_ERROR("error while anonymizing study `{}`",
+                        study.input_directory.string());
+          return;
+        }
+
+        outputAnonymFile << fmt::format(
+            "{},{},{},{},{},{}\n", study.old_id, study.old_name,
+            study.pseudoname, study.study_date, study.old_studyuid,
+            study.new_studyuid);
+      });
   outputAnonymFile.close();
 
+  const RunMetrics &metrics = anonymizer.metrics();
+  FNO_LOG_CONSOLE(
+      "\nanonymized {} files ({:.1f} MB) of {} studies in {:.1f} s, "
+      "{} skipped, {} failed",
+      metrics.counter(C_FILES),
+      static_cast<double>(metrics.counter(C_BYTES_READ)) / 1.0e6,
+      metrics.counter(C_STUDIES), metrics.runSeconds(),
+      metrics.counter(C_FILES_SKIPPED), metrics.counter(C_FILES_FAILED));
+  if (metrics.counter(C_FILES_ENCODED) > 0)
+    FNO_LOG_CONSOLE(
+        "encoded pixel data of {} files, {:.1f} MB to {:.1f} MB",
+        metrics.counter(C_FILES_ENCODED),
+        static_cast<double>(metrics.counter(C_PIXEL_BYTES_NATIVE)) / 1.0e6,
+        static_cast<double>(metrics.counter(C_PIXEL_BYTES_ENCODED)) / 1.0e6);
+  asyncLogger.stop();
+
+  (void)metrics.writeJson(metricsFilename + ".json");
+  if (opt_metricsPrometheus)
+    (void)metrics.writePrometheus(metricsFilename + ".prom");
+
   return 0;
 }